@@ -0,0 +1,182 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _ADDRKEY_H_
+#define _ADDRKEY_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "netbase.h"
+
+// Packed forms of a CService, for use as hash map keys.
+//
+// IPv4 addresses (most of the nodes) pack into a single 64-bit word:
+//   bits 0-15 port, 16-47 address, 48-55 network (NET_IPV4)
+// Everything else (IPv6, Tor, I2P) takes 24 bytes: the address, port, network
+// class and a precomputed hash.
+//
+// Hashes are seeded per process, so peers cannot choose addresses that all land
+// in the same bucket.
+
+struct CAddrKey6 {
+  unsigned char ip[16];
+  uint16_t port;
+  uint8_t net;
+  uint8_t reserved;
+  uint32_t hash;
+
+  bool operator==(const CAddrKey6 &b) const {
+    return hash == b.hash && memcmp(ip, b.ip, 16) == 0 && port == b.port;
+  }
+};
+
+static_assert(sizeof(CAddrKey6) == 24, "CAddrKey6 must be packed");
+
+extern const uint64_t nAddrKeySeed;
+
+static inline uint64_t AddrKeyMix(uint64_t n) {
+  n ^= nAddrKeySeed;
+  n ^= n >> 33;
+  n *= 0xff51afd7ed558ccdULL;
+  n ^= n >> 33;
+  n *= 0xc4ceb9fe1a85ec53ULL;
+  n ^= n >> 33;
+  return n;
+}
+
+// returns false (and leaves n alone) if addr is not IPv4
+static inline bool MakeAddrKey4(const CService &addr, uint64_t &n) {
+  static const unsigned char pchIPv4[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+  struct in6_addr addr6;
+  addr.GetIn6Addr(&addr6);
+  if (memcmp(addr6.s6_addr, pchIPv4, 12) != 0)
+    return false;
+  uint32_t ipv4 = ((uint32_t)addr6.s6_addr[12] << 24) | ((uint32_t)addr6.s6_addr[13] << 16) |
+                  ((uint32_t)addr6.s6_addr[14] << 8) | addr6.s6_addr[15];
+  n = ((uint64_t)NET_IPV4 << 48) | ((uint64_t)ipv4 << 16) | addr.GetPort();
+  return true;
+}
+
+static inline CAddrKey6 MakeAddrKey6(const CService &addr) {
+  CAddrKey6 key;
+  struct in6_addr addr6;
+  addr.GetIn6Addr(&addr6);
+  memcpy(key.ip, addr6.s6_addr, 16);
+  key.port = addr.GetPort();
+  key.net = addr.GetNetwork();
+  key.reserved = 0;
+  uint64_t a, b;
+  memcpy(&a, key.ip, 8);
+  memcpy(&b, key.ip + 8, 8);
+  key.hash = AddrKeyMix(AddrKeyMix(a) ^ b ^ ((uint64_t)key.port << 48));
+  return key;
+}
+
+static inline CService AddrFromKey4(uint64_t n) {
+  struct in_addr addr;
+  addr.s_addr = htonl((uint32_t)(n >> 16));
+  return CService(addr, (unsigned short)n);
+}
+
+static inline CService AddrFromKey6(const CAddrKey6 &key) {
+  struct in6_addr addr6;
+  memcpy(addr6.s6_addr, key.ip, 16);
+  return CService(addr6, key.port);
+}
+
+// CNetAddr::GetGroup() packed into an integer (groups are at most 6 bytes long), with
+// a fast path for routable IPv4 addresses
+static inline uint64_t GetGroupKey(const CNetAddr &addr) {
+  struct in6_addr addr6;
+  addr.GetIn6Addr(&addr6);
+  static const unsigned char pchIPv4[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+  if (memcmp(addr6.s6_addr, pchIPv4, 12) == 0 && addr.IsRoutable())
+    return ((uint64_t)NET_IPV4 << 16) | ((uint64_t)addr6.s6_addr[12] << 8) | addr6.s6_addr[13];
+  std::vector<unsigned char> vchGroup = addr.GetGroup();
+  uint64_t n = 0;
+  for (size_t i = 0; i < vchGroup.size() && i < 8; i++)
+    n = (n << 8) | vchGroup[i];
+  return n;
+}
+
+struct CAddrKeyHash {
+  size_t operator()(uint64_t n) const { return AddrKeyMix(n); }
+  size_t operator()(const CAddrKey6 &key) const { return key.hash; }
+};
+
+// Map from CService to T, keeping IPv4 and other addresses in separate hash maps
+// with packed keys.
+template<typename T>
+class CAddrMap {
+private:
+  std::unordered_map<uint64_t, T, CAddrKeyHash> map4;
+  std::unordered_map<CAddrKey6, T, CAddrKeyHash> map6;
+
+public:
+  size_t size() const { return map4.size() + map6.size(); }
+  bool empty() const { return map4.empty() && map6.empty(); }
+  void clear() { map4.clear(); map6.clear(); }
+  void reserve(size_t n) { map4.reserve(n); }
+
+  T *Find(const CService &addr) {
+    uint64_t n;
+    if (MakeAddrKey4(addr, n)) {
+      typename std::unordered_map<uint64_t, T, CAddrKeyHash>::iterator it = map4.find(n);
+      return it == map4.end() ? NULL : &(*it).second;
+    }
+    typename std::unordered_map<CAddrKey6, T, CAddrKeyHash>::iterator it = map6.find(MakeAddrKey6(addr));
+    return it == map6.end() ? NULL : &(*it).second;
+  }
+  const T *Find(const CService &addr) const {
+    return const_cast<CAddrMap*>(this)->Find(addr);
+  }
+  size_t count(const CService &addr) const { return Find(addr) != NULL; }
+
+  T &operator[](const CService &addr) {
+    uint64_t n;
+    if (MakeAddrKey4(addr, n))
+      return map4[n];
+    return map6[MakeAddrKey6(addr)];
+  }
+
+  size_t erase(const CService &addr) {
+    uint64_t n;
+    if (MakeAddrKey4(addr, n))
+      return map4.erase(n);
+    return map6.erase(MakeAddrKey6(addr));
+  }
+
+  // f(const CService &addr, const T &value) for every entry, IPv4 first
+  template<typename F>
+  void ForEach(F f) const {
+    for (typename std::unordered_map<uint64_t, T, CAddrKeyHash>::const_iterator it = map4.begin(); it != map4.end(); it++)
+      f(AddrFromKey4((*it).first), (*it).second);
+    for (typename std::unordered_map<CAddrKey6, T, CAddrKeyHash>::const_iterator it = map6.begin(); it != map6.end(); it++)
+      f(AddrFromKey6((*it).first), (*it).second);
+  }
+};
+
+#endif
@@ -0,0 +1,121 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+// Microbenchmarks for database operations on a synthetic in-memory database.
+// Usage: bench [nodes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db.h"
+
+using namespace std;
+
+// nNodes good nodes, every fourth one IPv6, every third one without NODE_BLOOM
+static void FillDb(CAddrDb &db, int nNodes) {
+  vector<CAddress> vAddr;
+  for (int i = 0; i < nNodes; i++) {
+    CNetAddr ip;
+    if (i % 4 == 3) {
+      struct in6_addr addr6;
+      memset(&addr6, 0, sizeof(addr6));
+      addr6.s6_addr[0] = 0x20;
+      addr6.s6_addr[1] = 0x01;
+      addr6.s6_addr[2] = 0x0d;
+      addr6.s6_addr[3] = 0xb9 + 1; // outside the documentation prefix
+      memcpy(addr6.s6_addr + 12, &i, 4);
+      ip = CNetAddr(addr6);
+    } else {
+      struct in_addr addr;
+      addr.s_addr = htonl(0x05000000 + i);
+      ip = CNetAddr(addr);
+    }
+    CAddress addr(CService(ip, MainNetParams().nDefaultPort), NODE_NETWORK | (i % 3 ? NODE_BLOOM : 0));
+    addr.nTime = time(NULL);
+    vAddr.push_back(addr);
+  }
+  db.Add(vAddr, true);
+  for (int i = 0; i < vAddr.size(); i++)
+    db.Good(vAddr[i], MainNetParams().nRequireVersion, "/bench/", MainNetParams().nRequireHeight);
+}
+
+// the DNS cache refresh before SampleIPs: GetIPs into a set, then converted to addr_t
+static int RefreshGetIPs(CAddrDb &db, vector<addr_t> &cache, uint64_t flags) {
+  static bool nets[NET_MAX] = {};
+  nets[NET_IPV4] = true;
+  nets[NET_IPV6] = true;
+  set<CNetAddr> ips;
+  db.GetIPs(ips, flags, 1000, nets);
+  cache.clear();
+  cache.reserve(ips.size());
+  for (set<CNetAddr>::iterator it = ips.begin(); it != ips.end(); it++) {
+    struct in_addr addr;
+    struct in6_addr addr6;
+    addr_t a;
+    if ((*it).GetInAddr(&addr)) {
+      a.v = 4;
+      memcpy(&a.data.v4, &addr, 4);
+    } else if ((*it).GetIn6Addr(&addr6)) {
+      a.v = 6;
+      memcpy(&a.data.v6, &addr6, 16);
+    }
+    cache.push_back(a);
+  }
+  return cache.size();
+}
+
+static int RefreshSampleIPs(CAddrDb &db, vector<addr_t> &cache, uint64_t flags) {
+  static const int quota[NET_MAX] = {0, 1000, 1000};
+  cache.resize(1000);
+  int n = db.SampleIPs(&cache[0], 1000, flags, quota);
+  cache.resize(n);
+  return n;
+}
+
+static void Run(const char *pszName, int (*f)(CAddrDb&, vector<addr_t>&, uint64_t), CAddrDb &db, uint64_t flags) {
+  vector<addr_t> cache;
+  int nIter = 2000;
+  int64 nResults = 0;
+  int64 nStart = GetTimeMicros();
+  for (int i = 0; i < nIter; i++)
+    nResults += f(db, cache, flags);
+  int64 nTime = GetTimeMicros() - nStart;
+  printf("%-12s flags %03llx: %8.2f us/refresh, %lld addresses/refresh\n", pszName, (unsigned long long)flags,
+         (double)nTime / nIter, (long long)(nResults / nIter));
+}
+
+int main(int argc, char **argv) {
+  int nNodes = argc > 1 ? atoi(argv[1]) : 100000;
+  CAddrDb db;
+  int64 nStart = GetTimeMicros();
+  FillDb(db, nNodes);
+  CAddrDbStats stats;
+  db.GetStats(stats);
+  printf("%i good nodes (filled in %i ms)\n", stats.nGood, (int)((GetTimeMicros() - nStart) / 1000));
+  uint64_t flags[] = {0, NODE_NETWORK | NODE_BLOOM};
+  for (int i = 0; i < 2; i++) {
+    Run("GetIPs", RefreshGetIPs, db, flags[i]);
+    Run("SampleIPs", RefreshSampleIPs, db, flags[i]);
+  }
+  return 0;
+}
@@ -21,9 +21,12 @@
 ** THE SOFTWARE.
 */
 #include <algorithm>
+#include <fcntl.h>
 
+#include "bitcoin.h"
 #include "db.h"
 #include "netbase.h"
+#include "netparams.h"
 #include "protocol.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -33,6 +36,7 @@
 using namespace std;
 
 class CNode {
+  const CNetParams &net;
   SOCKET sock;
   CDataStream vSend;
   CDataStream vRecv;
@@ -45,6 +49,18 @@ class CNode {
   int ban;
   int64 doneAfter;
   CAddress you;
+  bool fPersistent; // a CNodeLink: stays connected, and answers pings
+  bool fVerack;
+  uint64 nPingNonce;
+  int64 nLastPong;
+  int64 nVersionSent; // when our version message went out (us), 0 if not yet
+  int64 nPingSent;    // when the outstanding ping went out (us)
+  int nConnectMs;     // round trip times measured (ms), -1 if not (yet)
+  int nHandshakeMs;
+  int nPingMs;
+  uint64 nTheirNonce;  // nonce and own address from the node's version message, to recognize
+  CService addrTheirs; // it under other addresses (see SetClusterKeys)
+  int nError;          // why the connection failed (an errno value, ETIMEDOUT on a timeout), 0 if it did not
 
   int GetTimeout() {
       if (you.IsTor())
@@ -56,7 +72,7 @@ class CNode {
   void BeginMessage(const char *pszCommand) {
     if (nHeaderStart != -1) AbortMessage();
     nHeaderStart = vSend.size();
-    vSend << CMessageHeader(pszCommand, 0);
+    vSend << CMessageHeader(net.pchMessageStart, pszCommand, 0);
     nMessageStart = vSend.size();
 //    printf("%s: SEND %s\n", ToString(you).c_str(), pszCommand); 
   }
@@ -89,27 +105,44 @@ class CNode {
     int nBytes = send(sock, &vSend[0], vSend.size(), 0);
     if (nBytes > 0) {
       vSend.erase(vSend.begin(), vSend.begin() + nBytes);
+    } else if (fPersistent && nBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // non-blocking: the rest goes out once the socket is writable
     } else {
       close(sock);
       sock = INVALID_SOCKET;
     }
   }
   
+  // connect, and time it
+  bool Connect() {
+    int64 nStart = GetTimeMicros();
+    errno = 0;
+    if (!ConnectSocket(you, sock)) {
+      nError = errno ? errno : ECONNREFUSED;
+      return false;
+    }
+    nConnectMs = (GetTimeMicros() - nStart) / 1000;
+    return true;
+  }
+
   void PushVersion() {
     int64 nTime = time(NULL);
     uint64 nLocalNonce = VEIL_SEED_NONCE;
     int64 nLocalServices = 0;
     CAddress me(CService("0.0.0.0"));
     BeginMessage("version");
-    int nBestHeight = GetRequireHeight();
+    int nBestHeight = net.nRequireHeight;
     string ver = "/veil-seeder:1.0/";
     uint8_t fRelayTxs = 0;
     vSend << PROTOCOL_VERSION << nLocalServices << nTime << you << me << nLocalNonce << ver << nBestHeight << fRelayTxs;
     EndMessage();
+    nVersionSent = GetTimeMicros();
   }
  
   void GotVersion() {
-    if (vAddr) {
+    if (fPersistent) {
+      fVerack = true;
+    } else if (vAddr) {
  //     printf("\n%s: %s: Sending getaddr\n", __func__, ToString(you).c_str());
       BeginMessage("getaddr");
       EndMessage();
@@ -125,8 +158,10 @@ class CNode {
       int64 nTime;
       CAddress addrMe;
       CAddress addrFrom;
-      uint64 nNonce = 1;
+      uint64 nNonce = 0;
       vRecv >> nVersion >> you.nServices >> nTime >> addrMe;
+      if (nVersionSent && nHandshakeMs < 0)
+        nHandshakeMs = (GetTimeMicros() - nVersionSent) / 1000;
       if (nVersion == 10300) nVersion = 300;
       if (nVersion >= 106 && !vRecv.empty())
         vRecv >> addrFrom >> nNonce;
@@ -134,6 +169,8 @@ class CNode {
         vRecv >> strSubVer;
       if (nVersion >= 209 && !vRecv.empty())
         vRecv >> nStartingHeight;
+      nTheirNonce = nNonce;
+      addrTheirs = addrFrom;
       
       if (nVersion >= 209) {
         BeginMessage("verack");
@@ -153,6 +190,29 @@ class CNode {
       return false;
     }
     
+    if (strCommand == "ping" && fPersistent) {
+      // BIP 31: answer with the same nonce (older versions expect no answer)
+      if (nVersion > 60000) {
+        uint64 nNonce = 0;
+        vRecv >> nNonce;
+        BeginMessage("pong");
+        vSend << nNonce;
+        EndMessage();
+      }
+      return false;
+    }
+
+    if (strCommand == "pong" && fPersistent) {
+      uint64 nNonce = 0;
+      vRecv >> nNonce;
+      if (nPingNonce && nNonce == nPingNonce) {
+        nLastPong = time(NULL);
+        nPingMs = (GetTimeMicros() - nPingSent) / 1000;
+        nPingNonce = 0;
+      }
+      return false;
+    }
+
     if (strCommand == "addr" && vAddr) {
       vector<CAddress> vAddrNew;
       vRecv >> vAddrNew;
@@ -161,7 +221,7 @@ class CNode {
 
       int64 now = time(NULL);
       vector<CAddress>::iterator it = vAddrNew.begin();
-      if (vAddrNew.size() > 1) {
+      if (vAddrNew.size() > 1 && !fPersistent) {
         if (doneAfter == 0 || doneAfter > now + 1) doneAfter = now + 1;
       }
       while (it != vAddrNew.end()) {
@@ -174,7 +234,7 @@ class CNode {
           vAddr->push_back(addr);
 //          printf("\n%s: added address %s (#%i)\n", ToString(you).c_str(), addr.ToString().c_str(), (int)(vAddr->size()));
         }
-        if (vAddr->size() > 1000) {doneAfter = 1; return true; }
+        if (vAddr->size() > 1000 && !fPersistent) {doneAfter = 1; return true; }
       }
       return false;
     }
@@ -185,7 +245,7 @@ class CNode {
   bool ProcessMessages() {
     if (vRecv.empty()) return false;
     do {
-      CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(), BEGIN(pchMessageStart), END(pchMessageStart));
+      CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(), (const char*)net.pchMessageStart, (const char*)net.pchMessageStart + MESSAGE_START_SIZE);
       int nHeaderSize = vRecv.GetSerializeSize(CMessageHeader());
       if (vRecv.end() - pstart < nHeaderSize) {
         if (vRecv.size() > nHeaderSize) {
@@ -197,7 +257,7 @@ class CNode {
       vector<char> vHeaderSave(vRecv.begin(), vRecv.begin() + nHeaderSize);
       CMessageHeader hdr;
       vRecv >> hdr;
-      if (!hdr.IsValid()) { 
+      if (!hdr.IsValid(net.pchMessageStart)) { 
         printf("%s: BAD (invalid header)\n", ToString(you).c_str());
         ban = 100000; return true;
       }
@@ -228,7 +288,7 @@ class CNode {
   }
   
 public:
-  CNode(const CService& ip, vector<CAddress>* vAddrIn) : you(ip), nHeaderStart(-1), nMessageStart(-1), vAddr(vAddrIn), ban(0), doneAfter(0), nVersion(0) {
+  CNode(const CNetParams &netIn, const CService& ip, vector<CAddress>* vAddrIn, bool fPersistentIn = false) : net(netIn), sock(INVALID_SOCKET), you(ip), nHeaderStart(-1), nMessageStart(-1), vAddr(vAddrIn), ban(0), doneAfter(0), nVersion(0), nStartingHeight(0), fPersistent(fPersistentIn), fVerack(false), nPingNonce(0), nLastPong(0), nVersionSent(0), nPingSent(0), nConnectMs(-1), nHandshakeMs(-1), nPingMs(-1), nTheirNonce(0), nError(0) {
     vSend.SetType(SER_NETWORK);
     vSend.SetVersion(0);
     vRecv.SetType(SER_NETWORK);
@@ -240,7 +300,7 @@ public:
   }
   bool Run() {
     bool res = true;
-    if (!ConnectSocket(you, sock)) {
+    if (!Connect()) {
         return false;
     }
     PushVersion();
@@ -261,10 +321,12 @@ public:
       }
       int ret = select(sock+1, &set, NULL, &set, &wa);
       if (ret != 1) {
+        int nErr = ret == 0 ? ETIMEDOUT : errno;
         if (EINPROGRESS != errno) {
             printf("%s: select failed: %s\n", __func__, strerror(errno));
             if (!doneAfter) res = false;
         }
+        if (!doneAfter) nError = nErr;
         break;
       }
       int nBytes = recv(sock, pchBuf, sizeof(pchBuf), 0);
@@ -273,6 +335,7 @@ public:
         vRecv.resize(nPos + nBytes);
         memcpy(&vRecv[nPos], pchBuf, nBytes);
       } else {
+        nError = nBytes == 0 ? ECONNRESET : errno;
         if (EINPROGRESS != errno) {
             printf("%s: receive failed: %s\n", __func__, strerror(errno));
         }
@@ -306,11 +369,114 @@ public:
   int GetStartingHeight() {
     return nStartingHeight;
   }
+
+  uint64_t GetServices() {
+    return nVersion ? you.nServices : 0; // only known after the version message
+  }
+
+  // Persistent connections (see CNodeLink): connect (blocking) and send our version; the
+  // socket is non-blocking afterwards.
+  bool Open() {
+    if (!Connect())
+      return false;
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    PushVersion();
+    Send();
+    return sock != INVALID_SOCKET;
+  }
+
+  // read what has arrived and send what we can; false once the connection is gone
+  bool Pump() {
+    char pchBuf[0x10000];
+    while (sock != INVALID_SOCKET) {
+      int nBytes = recv(sock, pchBuf, sizeof(pchBuf), 0);
+      if (nBytes > 0) {
+        int nPos = vRecv.size();
+        vRecv.resize(nPos + nBytes);
+        memcpy(&vRecv[nPos], pchBuf, nBytes);
+        continue;
+      }
+      if (nBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      close(sock);
+      sock = INVALID_SOCKET;
+    }
+    ProcessMessages();
+    Send();
+    return sock != INVALID_SOCKET && ban == 0;
+  }
+
+  void Ping(uint64 nNonce) {
+    nPingNonce = nNonce;
+    nPingSent = GetTimeMicros();
+    BeginMessage("ping");
+    vSend << nNonce;
+    EndMessage();
+    Send();
+  }
+
+  void Close() {
+    if (sock != INVALID_SOCKET)
+      close(sock);
+    sock = INVALID_SOCKET;
+  }
+
+  SOCKET GetSocket() const { return sock; }
+  bool WantsWrite() const { return !vSend.empty(); }
+  bool IsReady() const { return fVerack; }
+  int64 GetLastPong() const { return nLastPong; }
+
+  void GetRtt(int &nConnect, int &nHandshake, int &nPing) const {
+    nConnect = nConnectMs;
+    nHandshake = nHandshakeMs;
+    nPing = nPingMs;
+  }
+
+  void GetIdentity(uint64 &nNonce, CService &addr) const {
+    nNonce = nTheirNonce;
+    addr = addrTheirs;
+  }
+
+  int GetError() const { return nError; }
 };
 
-bool TestNode(const CService &cip, int &ban, int &clientV, std::string &clientSV, int &blocks, vector<CAddress>* vAddr) {
+CNodeLink::CNodeLink(const CNetParams &net, const CService &ip, bool fHarvest) : pNode(new CNode(net, ip, fHarvest ? &vAddr : NULL, true)) {}
+
+CNodeLink::~CNodeLink() {
+  pNode->Close();
+  delete pNode;
+}
+
+bool CNodeLink::Open() { return pNode->Open(); }
+
+bool CNodeLink::Pump() {
+  try {
+    return pNode->Pump();
+  } catch(std::ios_base::failure& e) {
+    return false;
+  }
+}
+
+void CNodeLink::Ping(uint64 nNonce) { pNode->Ping(nNonce); }
+
+void CNodeLink::TakeAddr(vector<CAddress> &vAddrOut) {
+  vAddrOut.swap(vAddr);
+  vAddr.clear();
+}
+SOCKET CNodeLink::GetSocket() const { return pNode->GetSocket(); }
+bool CNodeLink::WantsWrite() const { return pNode->WantsWrite(); }
+bool CNodeLink::IsReady() const { return pNode->IsReady(); }
+int64 CNodeLink::GetLastPong() const { return pNode->GetLastPong(); }
+void CNodeLink::GetRtt(int &nConnect, int &nHandshake, int &nPing) const { pNode->GetRtt(nConnect, nHandshake, nPing); }
+void CNodeLink::GetIdentity(uint64 &nNonce, CService &addrFrom) const { pNode->GetIdentity(nNonce, addrFrom); }
+int CNodeLink::GetClientVersion() const { return pNode->GetClientVersion(); }
+std::string CNodeLink::GetClientSubVersion() const { return pNode->GetClientSubVersion(); }
+int CNodeLink::GetStartingHeight() const { return pNode->GetStartingHeight(); }
+uint64_t CNodeLink::GetServices() const { return pNode->GetServices(); }
+
+bool TestNode(const CNetParams &net, const CService &cip, int &ban, int &clientV, std::string &clientSV, int &blocks, uint64_t &services, int &connectMs, int &handshakeMs, uint64 &nonce, CService &addrFrom, int &error, vector<CAddress>* vAddr) {
   try {
-    CNode node(cip, vAddr);
+    CNode node(net, cip, vAddr);
     bool ret = node.Run();
     if (!ret) {
       ban = node.GetBan();
@@ -320,11 +486,21 @@ bool TestNode(const CService &cip, int &ban, int &clientV, std::string &clientSV
     clientV = node.GetClientVersion();
     clientSV = node.GetClientSubVersion();
     blocks = node.GetStartingHeight();
+    services = node.GetServices();
+    int pingMs;
+    node.GetRtt(connectMs, handshakeMs, pingMs);
+    node.GetIdentity(nonce, addrFrom);
+    error = ret ? 0 : node.GetError();
 //    if (!ret)
 //        printf("%s: %s!!!\n", cip.ToString().c_str(), ret ? "GOOD" : "BAD");
     return ret;
   } catch(std::ios_base::failure& e) {
     ban = 0;
+    services = 0;
+    connectMs = handshakeMs = -1;
+    nonce = 0;
+    addrFrom = CService();
+    error = 0;
     return false;
   }
 }
@@ -23,8 +23,44 @@
 #ifndef _BITCOIN_H_
 #define _BITCOIN_H_ 1
 
+#include "netparams.h"
 #include "protocol.h"
 
-bool TestNode(const CService &cip, int &ban, int &client, std::string &clientSV, int &blocks, std::vector<CAddress>* vAddr);
+class CNode;
+
+// A connection to a good node that is kept open and pinged, so that it can be revalidated
+// without reconnecting (see keepalive.h). Except for Open, nothing blocks: the owner polls
+// the socket and calls Pump when it is readable (or writable, if WantsWrite).
+class CNodeLink {
+  std::vector<CAddress> vAddr; // addr gossip received, if harvesting
+  CNode *pNode;
+
+  CNodeLink(const CNodeLink&);
+  CNodeLink& operator=(const CNodeLink&);
+
+public:
+  CNodeLink(const CNetParams &net, const CService &ip, bool fHarvest = false);
+  ~CNodeLink();
+
+  bool Open(); // connect and start the handshake; false if the node cannot be reached
+  bool Pump(); // false once the connection is lost, or the node misbehaved
+  void Ping(uint64 nNonce);
+  void TakeAddr(std::vector<CAddress> &vAddrOut); // addresses gossiped since the last call (if harvesting)
+  SOCKET GetSocket() const;
+  bool WantsWrite() const;
+  bool IsReady() const;      // the handshake is complete
+  int64 GetLastPong() const; // when the last ping was answered (0 if none was)
+  void GetRtt(int &nConnect, int &nHandshake, int &nPing) const; // round trip times in ms (-1: not measured); nPing is the latest pong
+  void GetIdentity(uint64 &nNonce, CService &addrFrom) const; // nonce and own address from the node's version message
+  int GetClientVersion() const;
+  std::string GetClientSubVersion() const;
+  int GetStartingHeight() const;
+  uint64_t GetServices() const;
+};
+
+// Probe a node. On failure, error says why the connection failed (an errno value, ETIMEDOUT
+// if the node did not connect or complete the handshake in time), or is 0 if it was refused
+// on other grounds (a ban, or a protocol error).
+bool TestNode(const CNetParams &net, const CService &cip, int &ban, int &client, std::string &clientSV, int &blocks, uint64_t &services, int &connectMs, int &handshakeMs, uint64 &nonce, CService &addrFrom, int &error, std::vector<CAddress>* vAddr);
 
 #endif
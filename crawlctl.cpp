@@ -0,0 +1,157 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "crawlctl.h"
+
+using namespace std;
+
+int ClassifyProbe(bool fGood, int nError) {
+  if (fGood) return PROBE_OK;
+  switch (nError) {
+    case ETIMEDOUT:
+    case EHOSTUNREACH:
+    case ENETUNREACH:
+      return PROBE_TIMEOUT;
+    case EMFILE:
+    case ENFILE:
+    case EADDRNOTAVAIL:
+    case EAGAIN:
+    case ENOBUFS:
+    case ENOMEM:
+      return PROBE_LOCAL;
+  }
+  return PROBE_OK;
+}
+
+CCrawlControl::CCrawlControl(int nMinIn, int nMaxIn) : nMin(std::max(nMinIn, 1)), nMax(std::max(nMaxIn, 1)), nActive(0), nIdle(0), nWake(0), nHold(0), nProbes(0), nConnSamples(0), nIncreases(0), nDecreases(0), dFailShort(0), dFailLong(0), dConnShort(0), dConnLong(0), nLastCut(0), nRateProbes(0), nRateTime(GetTimeMillis()) {
+  nMin = std::min(nMin, nMax);
+  dSetpoint = nMax;
+}
+
+void CCrawlControl::Acquire() {
+  unique_lock<mutex> lock(mtx);
+  cvSlot.wait(lock, [this]() { return nActive < (int)dSetpoint; });
+  nActive++;
+}
+
+void CCrawlControl::Release(int nOutcome, int nError, int nConnectMs) {
+  lock_guard<mutex> lock(mtx);
+  nActive--;
+  Note_(nOutcome, nError, nConnectMs);
+  if (nActive < (int)dSetpoint)
+    cvSlot.notify_one();
+}
+
+void CCrawlControl::Note(int nOutcome, int nError, int nConnectMs) {
+  lock_guard<mutex> lock(mtx);
+  Note_(nOutcome, nError, nConnectMs);
+}
+
+void CCrawlControl::Note_(int nOutcome, int nError, int nConnectMs) {
+  nProbes++;
+  // averages over about the last n samples, plain means until there are n
+  double fFail = nOutcome == PROBE_TIMEOUT;
+  dFailShort += (fFail - dFailShort) * std::max(1.0 / nProbes, 1.0 / CRAWLCTL_SHORT);
+  dFailLong += (fFail - dFailLong) * std::max(1.0 / nProbes, 1.0 / CRAWLCTL_LONG);
+  if (nConnectMs >= 0) {
+    nConnSamples++;
+    dConnShort += (nConnectMs - dConnShort) * std::max(1.0 / nConnSamples, 1.0 / CRAWLCTL_SHORT);
+    dConnLong += (nConnectMs - dConnLong) * std::max(1.0 / nConnSamples, 1.0 / CRAWLCTL_LONG);
+  }
+  if (nHold > 0) {
+    nHold--;
+    return;
+  }
+  if (nOutcome == PROBE_LOCAL) {
+    Cut_(strprintf("local resources exhausted (%s)", strerror(nError)));
+    return;
+  }
+  if (nProbes >= CRAWLCTL_WARMUP && dFailShort > dFailLong + CRAWLCTL_FAIL_MARGIN) {
+    Cut_(strprintf("%.0f%% of recent probes timed out or found no route (usually %.0f%%)", 100 * dFailShort, 100 * dFailLong));
+    return;
+  }
+  if (nConnSamples >= CRAWLCTL_WARMUP && dConnShort > CRAWLCTL_SLOW * dConnLong && dConnShort > CRAWLCTL_SLOW_MIN) {
+    Cut_(strprintf("connecting takes %.0f ms (usually %.0f ms)", dConnShort, dConnLong));
+    return;
+  }
+  int nBefore = dSetpoint;
+  dSetpoint = std::min(dSetpoint + 1.0 / dSetpoint, (double)nMax);
+  if ((int)dSetpoint > nBefore) {
+    nIncreases++;
+    cvSlot.notify_one();
+  }
+}
+
+void CCrawlControl::Cut_(const string &strWhy) {
+  int nBefore = dSetpoint;
+  nHold = nBefore;
+  dSetpoint = std::max(dSetpoint * CRAWLCTL_DECREASE, (double)nMin);
+  nLastCut = time(NULL);
+  strLastCut = strWhy;
+  if ((int)dSetpoint == nBefore) return;
+  nDecreases++;
+  printf("Crawl concurrency %i -> %i: %s\n", nBefore, (int)dSetpoint, strWhy.c_str());
+}
+
+void CCrawlControl::Idle(int nMillis) {
+  unique_lock<mutex> lock(mtx);
+  nIdle++;
+  cvWork.wait_for(lock, chrono::milliseconds(nMillis), [this]() { return nWake > 0; });
+  if (nWake > 0) nWake--;
+  nIdle--;
+}
+
+void CCrawlControl::Wake(int n) {
+  lock_guard<mutex> lock(mtx);
+  n = std::min(n, nIdle - nWake);
+  for (int i = 0; i < n; i++) {
+    nWake++;
+    cvWork.notify_one();
+  }
+}
+
+void CCrawlControl::GetStats(CCrawlControlStats &stats) {
+  lock_guard<mutex> lock(mtx);
+  int64 now = GetTimeMillis();
+  stats.nSetpoint = dSetpoint;
+  stats.nMin = nMin;
+  stats.nMax = nMax;
+  stats.nActive = nActive;
+  stats.nIdle = nIdle;
+  stats.nProbes = nProbes;
+  stats.dRate = now > nRateTime ? 1000.0 * (nProbes - nRateProbes) / (now - nRateTime) : 0;
+  nRateProbes = nProbes;
+  nRateTime = now;
+  stats.nIncreases = nIncreases;
+  stats.nDecreases = nDecreases;
+  stats.dFail = dFailShort;
+  stats.dFailBase = dFailLong;
+  stats.dConnectMs = dConnShort;
+  stats.dConnectMsBase = dConnLong;
+  stats.nLastCut = nLastCut;
+  stats.strLastCut = strLastCut;
+}
@@ -0,0 +1,119 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _CRAWLCTL_H_
+#define _CRAWLCTL_H_ 1
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include "util.h"
+
+// Crawl concurrency control.
+//
+// Rather than every crawler thread (-t) probing all the time, the number of probes in
+// flight is held to a setpoint between a lower bound and the number of threads, which
+// follows how the network and this host cope, additive-increase/multiplicative-decrease
+// style. Each probe that completes normally adds 1/setpoint, so the setpoint grows by one
+// per setpoint probes. It is cut by CRAWLCTL_DECREASE when
+//  - a probe fails for lack of local resources (file descriptors, ephemeral ports, buffers);
+//  - the share of probes that time out or find no route, over about the last CRAWLCTL_SHORT
+//    probes, exceeds its long-term level (over about CRAWLCTL_LONG probes) by CRAWLCTL_FAIL_MARGIN;
+//  - or the average connect time rises to CRAWLCTL_SLOW times its long-term level.
+// After a cut, signals are ignored until as many probes completed as were allowed in flight
+// before it, so that one storm leads to one cut. Refused connections are not a signal: the
+// network delivered them, only the node is down.
+//
+// Crawlers wait for a slot before each probe. Crawlers that find no work wait until woken
+// (Wake, once work is due) instead of sleeping for a fixed time.
+
+#define CRAWLCTL_DECREASE 0.5    // factor applied to the setpoint on a congestion signal
+#define CRAWLCTL_SHORT 64        // probes in the short-term averages
+#define CRAWLCTL_LONG 4096       // probes in the long-term averages
+#define CRAWLCTL_WARMUP 1024     // probes before the averages are compared
+#define CRAWLCTL_FAIL_MARGIN 0.2 // rise in the share of timeouts that counts as a storm
+#define CRAWLCTL_SLOW 2.0        // rise (factor) in the connect time that counts as congestion
+#define CRAWLCTL_SLOW_MIN 50     // connect times (ms) below which no rise counts
+
+// how a probe ended, as far as crawl concurrency is concerned
+enum {
+  PROBE_OK,      // the node answered, refused the connection, or was refused by us
+  PROBE_TIMEOUT, // no answer in time, or no route to the node
+  PROBE_LOCAL,   // we ran out of file descriptors, ephemeral ports or buffers
+};
+
+// classify a probe from TestNode's result and error
+int ClassifyProbe(bool fGood, int nError);
+
+class CCrawlControlStats {
+public:
+  int nSetpoint;      // probes allowed in flight
+  int nMin, nMax;     // bounds of the setpoint
+  int nActive;        // probes in flight
+  int nIdle;          // crawlers waiting for work
+  int64 nProbes;      // probes completed
+  double dRate;       // probes completed per second, since the last call
+  int64 nIncreases;   // steps up of the setpoint
+  int64 nDecreases;   // cuts
+  double dFail;       // recent share of probes that timed out or found no route
+  double dFailBase;   // long-term share
+  double dConnectMs;  // recent average connect time
+  double dConnectMsBase; // long-term average
+  int64 nLastCut;     // when the setpoint was last cut (0: never)
+  std::string strLastCut; // why
+};
+
+class CCrawlControl {
+private:
+  std::mutex mtx;
+  std::condition_variable cvSlot;  // crawlers waiting for a slot
+  std::condition_variable cvWork;  // crawlers waiting for work
+  int nMin, nMax;
+  double dSetpoint;
+  int nActive;
+  int nIdle;
+  int nWake;          // idle crawlers told to look for work, not yet awake
+  int nHold;          // completions to wait for before reacting to another signal
+  int64 nProbes, nConnSamples, nIncreases, nDecreases;
+  double dFailShort, dFailLong, dConnShort, dConnLong;
+  int64 nLastCut;
+  std::string strLastCut;
+  int64 nRateProbes;  // nProbes and time (ms) at the last GetStats
+  int64 nRateTime;
+
+  void Note_(int nOutcome, int nError, int nConnectMs); // mtx held
+  void Cut_(const std::string &strWhy);
+
+public:
+  CCrawlControl(int nMinIn, int nMaxIn);
+
+  void Acquire();                                // wait for a slot, then probe
+  void Release(int nOutcome, int nError, int nConnectMs); // the probe ended (see ClassifyProbe; nConnectMs -1 if not connected)
+  void Note(int nOutcome, int nError, int nConnectMs);    // the same for a probe made without a slot
+  void Idle(int nMillis);                        // no work: wait until woken, or for nMillis
+  void Wake(int n);                              // work is waiting for up to n more crawlers
+
+  void GetStats(CCrawlControlStats &stats);
+};
+
+#endif
@@ -23,10 +23,50 @@
 #include "db.h"
 #include <stdlib.h>
 
+#include <unordered_set>
+
 using namespace std;
 
-void CAddrInfo::Update(bool good) {
-  uint32_t now = time(NULL);
+static uint64_t GetAddrKeySeed() {
+  uint64_t n = ((uint64_t)time(NULL) << 32) ^ getpid();
+  FILE *file = fopen("/dev/urandom", "rb");
+  if (file) {
+    if (fread(&n, sizeof(n), 1, file) != 1) n ^= (uint64_t)&n;
+    fclose(file);
+  }
+  return n;
+}
+
+const uint64_t nAddrKeySeed = GetAddrKeySeed();
+
+// fold a sample into an average (negative: none yet); returns how far off the average the
+// sample was, or -1 if it was the first
+static float UpdateRtt(float &avg, float sample) {
+  if (avg < 0) {
+    avg = sample;
+    return -1;
+  }
+  float dev = fabs(sample - avg);
+  avg += RTT_ALPHA * (sample - avg);
+  return dev;
+}
+
+void CAddrRtt::Update(const CProbeRtt &rtt) {
+  if (rtt.nConnect >= 0)
+    UpdateRtt(connect, rtt.nConnect);
+  // jitter follows the deviation of handshake and ping samples from their averages
+  float dev = -1;
+  if (rtt.nHandshake >= 0)
+    dev = std::max(dev, UpdateRtt(handshake, rtt.nHandshake));
+  if (rtt.nPing >= 0)
+    dev = std::max(dev, UpdateRtt(ping, rtt.nPing));
+  if (dev >= 0)
+    UpdateRtt(jitter, dev);
+}
+
+void CAddrInfo::Update(bool good, int64 now, const CNetParams &net) {
+  if (ourLastTry == 0 || lastChange == 0 || good != (ourLastSuccess == ourLastTry))
+    lastChange = now;
   if (ourLastTry == 0)
     ourLastTry = now - MIN_RETRY;
   int age = now - ourLastTry;
@@ -43,7 +83,7 @@ void CAddrInfo::Update(bool good) {
   stat1D.Update(good, age, 3600*24);
   stat1W.Update(good, age, 3600*24*7);
   stat1M.Update(good, age, 3600*24*30);
-  int ign = GetIgnoreTime();
+  int ign = GetIgnoreTime(net);
   if (ign && (ignoreTill==0 || ignoreTill < ign+now)) ignoreTill = ign+now;
 //  printf("%s: got %s result: success=%i/%i; 2H:%.2f%%-%.2f%%(%.2f) 8H:%.2f%%-%.2f%%(%.2f) 1D:%.2f%%-%.2f%%(%.2f) 1W:%.2f%%-%.2f%%(%.2f) \n", ToString(ip).c_str(), good ? "good" : "bad", success, total, 
 //  100.0 * stat2H.reliability, 100.0 * (stat2H.reliability + 1.0 - stat2H.weight), stat2H.count,
@@ -51,90 +91,537 @@ void CAddrInfo::Update(bool good) {
 //  100.0 * stat1D.reliability, 100.0 * (stat1D.reliability + 1.0 - stat1D.weight), stat1D.count,
 //  100.0 * stat1W.reliability, 100.0 * (stat1W.reliability + 1.0 - stat1W.weight), stat1W.count);
 }
+// The success rates seen over the windows that have a few probes should all be near 0 or
+// all near 1, and agree with each other.
+double CAddrInfo::GetStability() const {
+  const CAddrStat *stats[5] = {&stat2H, &stat8H, &stat1D, &stat1W, &stat1M};
+  double lo = 1, hi = 0, var = 0;
+  for (int i = 0; i < 5; i++) {
+    if (stats[i]->count <= 2 || stats[i]->weight <= 0) continue;
+    double r = std::min(stats[i]->reliability / stats[i]->weight, 1.0f);
+    lo = std::min(lo, r);
+    hi = std::max(hi, r);
+    var = std::max(var, r * (1 - r));
+  }
+  if (hi < lo) return 0;
+  return std::max(0.0, 1.0 - 4 * var - (hi - lo));
+}
+
 bool CAddrDb::Get_(CServiceResult &ip, int &wait) {
   int64 now = time(NULL);
-  int cont = 0;
-  int tot = unkId.size() + ourId.size();
-  if (tot == 0) {
-    wait = 5;
-    return false;
-  }
-  do {
+  Expire_(now);
+  // in a cluster, a pick may be left to another member; then try again
+  int nParkedNow = 0;
+  for (int nTry = 0; nTry < PARTITION_TRIES; nTry++) {
+    int tot = unkId.size() + schedule.GetReady() + warmId.size();
+    if (tot == 0) {
+      wait = 5;
+      return false;
+    }
     int rnd = rand() % tot;
-    int ret;
-    if (rnd < unkId.size()) {
-      set<int>::iterator it = unkId.end(); it--;
-      ret = *it;
-      unkId.erase(it);
+    const CAddrInfo *pInfo;
+    if (!warmId.empty()) {
+      pInfo = TakeWarm_();
+    } else if (rnd < unkId.size()) {
+      CAddrInfo *pUnk = PickUnknown_(now);
+      if (!pUnk) continue;
+      UnsetUnknown_(*pUnk);
+      Dispatch_(*pUnk);
+      pInfo = pUnk;
     } else {
-      ret = ourId.front();
-      if (time(NULL) - idToInfo[ret].ourLastTry < MIN_RETRY) return false;
-      ourId.pop_front();
+      int64 nDue = schedule.GetDue(schedule.GetFirstReady());
+      int ret = schedule.PopReady();
+      CAddrInfo &info = idToInfo[ret];
+      info.nSchedule = -1;
+      if (!Claim_(info, now)) {
+        info.nSchedule = schedule.Insert(ret, std::max(info.GetNextTry(), nPartitionStart) + PARTITION_GRACE);
+        nDeferred++;
+        continue;
+      }
+      if (Covered_(info, now)) {
+        info.nSchedule = schedule.Insert(ret, now + MIN_RETRY);
+        nClusterDeferred++;
+        continue;
+      }
+      if (GroupFull_(info)) {
+        // not a pick: holding back a run of due nodes of one group costs no try
+        Park_(ret, info);
+        if (++nParkedNow < PARK_MAX) nTry--;
+        continue;
+      }
+      dLate += (std::max(now - nDue, (int64)0) - dLate) * 0.01;
+      Dispatch_(info);
+      pInfo = &info;
     }
-    if (idToInfo[ret].ignoreTill && idToInfo[ret].ignoreTill < now) {
-      ourId.push_back(ret);
-      idToInfo[ret].ourLastTry = now;
-    } else {
-      ip.service = idToInfo[ret].ip;
-      ip.ourLastSuccess = idToInfo[ret].ourLastSuccess;
-      break;
+    if (pPartition && pInfo->nWarmPos != WARM_INFLIGHT && !pPartition->IsMine(pInfo->ip))
+      nTakenOver++;
+    ip.service = pInfo->ip;
+    ip.ourLastSuccess = pInfo->ourLastSuccess;
+    return true;
+  }
+  wait = 1;
+  return false;
+}
+
+// In a cluster, nodes owned by another live member are left to it: it reports the
+// outcomes, which we apply like our own (see Remote_). If it has not done so
+// PARTITION_GRACE seconds after the node became due (it may not know the node, or have
+// lost it), we probe the node ourselves.
+bool CAddrDb::Claim_(CAddrInfo &info, int64 now) {
+  if (!pPartition || pPartition->IsMine(info.ip)) return true;
+  if (info.nUnkPos >= 0) {
+    // untried nodes are never due as such: the grace period starts when one is first passed over
+    if (!info.nClaimAfter) info.nClaimAfter = now + PARTITION_GRACE;
+    return now >= info.nClaimAfter;
+  }
+  return now >= std::max(info.GetNextTry(), nPartitionStart) + PARTITION_GRACE;
+}
+
+// ss holds what identifies the node
+static uint64_t GetClusterKey(CDataStream &ss, const CServiceResult &res) {
+  ss << res.nClientV << GetSubVersion(res.nClientSV) << res.nServices;
+  uint256 hash = Hash(ss.begin(), ss.end());
+  uint64_t nKey;
+  memcpy(&nKey, hash.begin(), sizeof(nKey));
+  return nKey ? nKey : 1;
+}
+
+void SetClusterKeys(CServiceResult &res, uint64 nNonce, const CService &addrFrom) {
+  res.nCluster = 0;
+  res.addrFrom = addrFrom;
+  res.nClusterFrom = 0;
+  if (nNonce) {
+    CDataStream ss(SER_DISK, 0);
+    ss << 'n' << nNonce;
+    res.nCluster = GetClusterKey(ss, res);
+  }
+  if (addrFrom.IsRoutable()) {
+    CDataStream ss(SER_DISK, 0);
+    ss << 'a' << addrFrom;
+    res.nClusterFrom = GetClusterKey(ss, res);
+  }
+}
+
+// The claimed address counts if this probe reached the node there, or if the last probe of
+// that address reached a node with the same key; otherwise the nonce has to do.
+uint64_t CAddrDb::ClusterKey_(const CServiceResult &res) {
+  if (!res.nClusterFrom) return res.nCluster;
+  if (res.addrFrom == res.service) return res.nClusterFrom;
+  int id = Lookup_(res.addrFrom);
+  if (id != -1) {
+    const CAddrInfo &info = idToInfo[id];
+    if (info.nCluster == res.nClusterFrom && info.ourLastSuccess && info.ourLastSuccess == info.ourLastTry)
+      return res.nClusterFrom;
+  }
+  return res.nCluster;
+}
+
+void CAddrDb::SetCluster_(int id, CAddrInfo &info, uint64_t nCluster) {
+  if (info.nCluster == nCluster) return;
+  if (info.nCluster) {
+    std::unordered_map<uint64_t, std::vector<int> >::iterator it = mapCluster.find(info.nCluster);
+    std::vector<int> &vId = (*it).second;
+    vId.erase(std::find(vId.begin(), vId.end(), id));
+    if (vId.size() == 1) nClusters--;
+    if (vId.empty()) mapCluster.erase(it);
+  }
+  info.nCluster = nCluster;
+  if (nCluster) {
+    std::vector<int> &vId = mapCluster[nCluster];
+    vId.push_back(id);
+    if (vId.size() == 2) nClusters++;
+  }
+}
+
+const std::vector<int> *CAddrDb::GetCluster_(const CAddrInfo &info) const {
+  if (!info.nCluster) return NULL;
+  std::unordered_map<uint64_t, std::vector<int> >::const_iterator it = mapCluster.find(info.nCluster);
+  if (it == mapCluster.end() || (*it).second.size() < 2 || (*it).second.size() > CLUSTER_MAX) return NULL;
+  return &(*it).second;
+}
+
+// An address of a clustered node need not be probed if another one was confirmed since it
+// was last tried (and is still fine), as long as this one was fine itself last time and
+// not too long ago. Ties go to probing, so one address always keeps carrying the node.
+bool CAddrDb::Covered_(const CAddrInfo &info, int64 now) const {
+  if (info.ourLastSuccess != info.ourLastTry || now - info.ourLastTry >= CLUSTER_REVISIT) return false;
+  if (nRevisitMax && nStaleMax && now - info.ourLastTry >= nStaleMax) return false;
+  const std::vector<int> *pvId = GetCluster_(info);
+  if (!pvId) return false;
+  for (int i = 0; i < pvId->size(); i++) {
+    const CAddrInfo &other = (*idToInfo.find((*pvId)[i])).second;
+    if (&other != &info && other.ourLastSuccess == other.ourLastTry && other.ourLastSuccess > info.ourLastTry)
+      return true;
+  }
+  return false;
+}
+
+double DefaultProbeScore(const CProbeCandidate &cand) {
+  double score = -log2(1.0 + cand.nAge / 3600.0);
+  if (!cand.fDefaultPort) score -= 8;
+  if (!(cand.services & NODE_NETWORK)) score -= 4;
+  score -= 0.5 * log2(1.0 + cand.nGroupNodes);
+  score += 4.0 * (cand.sourceQuality - 0.5);
+  return score;
+}
+
+// Scores a random sample of untried nodes and takes the best. Every so often a node is
+// taken at random instead, so low-scoring nodes are still tried eventually. Nodes of network
+// groups at their cap are drawn again (up to a point), so a group flooding unkId does not
+// crowd out the rest of the sample.
+CAddrInfo *CAddrDb::PickUnknown_(int64 now) {
+  if (rand() % PROBE_EXPLORE == 0) {
+    CAddrInfo *pInfo = unkId[rand() % unkId.size()];
+    if (!Claim_(*pInfo, now)) {
+      nDeferred++;
+      return NULL;
     }
-  } while(1);
-  nDirty++;
-  return true;
+    if (!GroupFull_(*pInfo)) return pInfo;
+    nGroupSkipped++;
+  }
+  CAddrInfo *pBest = NULL;
+  double scoreBest = 0;
+  bool fDeferred = false;
+  int nRedrawn = 0;
+  for (int i = 0; i < PROBE_SAMPLE; i++) {
+    CAddrInfo *pInfo = unkId[rand() % unkId.size()];
+    if (!Claim_(*pInfo, now)) {
+      fDeferred = true;
+      continue;
+    }
+    if (GroupFull_(*pInfo)) {
+      nGroupSkipped++;
+      if (++nRedrawn < PROBE_SAMPLE * 3) i--;
+      continue;
+    }
+    CProbeCandidate cand;
+    cand.nAge = now > pInfo->lastTry ? now - pInfo->lastTry : 0;
+    cand.services = pInfo->services;
+    cand.fDefaultPort = pInfo->ip.GetPort() == pNet->nDefaultPort;
+    std::unordered_map<uint64_t, int>::const_iterator gi = mapGroupCount.find(GetGroupKey(pInfo->ip));
+    cand.nGroupNodes = gi != mapGroupCount.end() ? (*gi).second : 0;
+    cand.sourceQuality = vSources[pInfo->nSource].GetQuality();
+    double score = pProbeScore(cand);
+    if (!pBest || score > scoreBest) {
+      pBest = pInfo;
+      scoreBest = score;
+    }
+  }
+  if (!pBest && fDeferred) nDeferred++;
+  return pBest;
+}
+
+bool CAddrDb::GroupFull_(const CAddrInfo &info) const {
+  if (!nGroupFlight) return false;
+  std::unordered_map<uint64_t, CGroupFlight>::const_iterator it = mapGroupFlight.find(GetGroupKey(info.ip));
+  return it != mapGroupFlight.end() && (*it).second.nInFlight >= nGroupFlight;
+}
+
+void CAddrDb::Dispatch_(CAddrInfo &info) {
+  mapGroupFlight[GetGroupKey(info.ip)].nInFlight++;
+  info.nFlight = 1;
+}
+
+void CAddrDb::Park_(int id, CAddrInfo &info) {
+  CGroupFlight &group = mapGroupFlight[GetGroupKey(info.ip)];
+  group.vParked.push_back(id);
+  group.nParked++;
+  info.nFlight = FLIGHT_PARKED;
+  nParked++;
+  nParkedTotal++;
+}
+
+// Room freed in a group goes to the node of it held back longest, which becomes due at the
+// end of the ready queue, so groups at their cap take turns with each other and the rest.
+void CAddrDb::Land_(CAddrInfo &info) {
+  if (!info.nFlight) return;
+  std::unordered_map<uint64_t, CGroupFlight>::iterator it = mapGroupFlight.find(GetGroupKey(info.ip));
+  CGroupFlight &group = (*it).second;
+  if (info.nFlight == FLIGHT_PARKED) {
+    group.nParked--;
+    nParked--;
+  } else {
+    group.nInFlight--;
+  }
+  info.nFlight = 0;
+  while (group.nParked > 0 && (!nGroupFlight || group.nInFlight < nGroupFlight)) {
+    int id = group.vParked.front();
+    group.vParked.pop_front();
+    std::map<int, CAddrInfo>::iterator jt = idToInfo.find(id);
+    if (jt == idToInfo.end() || (*jt).second.nFlight != FLIGHT_PARKED) continue; // reported on or dropped meanwhile
+    CAddrInfo &next = (*jt).second;
+    next.nFlight = 0;
+    group.nParked--;
+    nParked--;
+    next.nSchedule = schedule.Insert(id, schedule.GetNow());
+    break;
+  }
+  if (!group.nInFlight && !group.nParked)
+    mapGroupFlight.erase(it);
+}
+
+void CAddrDb::GetGroupStats(CGroupStats &stats, int nTop) const {
+  SHARED_CRITICAL_BLOCK(cs) {
+    stats.nGroups = 0;
+    stats.nFull = 0;
+    stats.nInFlight = 0;
+    stats.nParked = nParked;
+    stats.nParkedTotal = nParkedTotal;
+    stats.nSkipped = nGroupSkipped;
+    std::unordered_map<uint64_t, std::pair<int, CService> > mapWaiting;
+    for (std::unordered_map<uint64_t, CGroupFlight>::const_iterator it = mapGroupFlight.begin(); it != mapGroupFlight.end(); it++) {
+      const CGroupFlight &group = (*it).second;
+      if (group.nInFlight) stats.nGroups++;
+      if (nGroupFlight && group.nInFlight >= nGroupFlight) stats.nFull++;
+      stats.nInFlight += group.nInFlight;
+      for (std::deque<int>::const_iterator jt = group.vParked.begin(); jt != group.vParked.end(); jt++) {
+        std::map<int, CAddrInfo>::const_iterator kt = idToInfo.find(*jt);
+        if (kt == idToInfo.end() || (*kt).second.nFlight != FLIGHT_PARKED) continue;
+        std::pair<int, CService> &waiting = mapWaiting[(*it).first];
+        if (!waiting.first++) waiting.second = (*kt).second.ip;
+      }
+    }
+    for (std::vector<CAddrInfo*>::const_iterator it = unkId.begin(); it != unkId.end(); it++) {
+      std::pair<int, CService> &waiting = mapWaiting[GetGroupKey((*it)->ip)];
+      if (!waiting.first++) waiting.second = (*it)->ip;
+    }
+    stats.vTop.clear();
+    for (std::unordered_map<uint64_t, std::pair<int, CService> >::const_iterator it = mapWaiting.begin(); it != mapWaiting.end(); it++)
+      stats.vTop.push_back((*it).second);
+    int n = std::min((size_t)std::max(nTop, 0), stats.vTop.size());
+    std::partial_sort(stats.vTop.begin(), stats.vTop.begin() + n, stats.vTop.end(),
+                      [](const std::pair<int, CService> &a, const std::pair<int, CService> &b) { return a.first > b.first; });
+    stats.vTop.resize(n);
+  }
+}
+
+void CAddrDb::SetWarm_(CAddrInfo &info) {
+  if (info.nWarmPos != -1) return;
+  info.nWarmPos = warmId.size();
+  warmId.push_back(&info);
+  nWarmTotal++;
+}
+
+CAddrInfo *CAddrDb::TakeWarm_() {
+  if (warmId.empty()) return NULL;
+  CAddrInfo *pInfo = warmId.back();
+  warmId.pop_back();
+  pInfo->nWarmPos = WARM_INFLIGHT;
+  if (pInfo->nSchedule >= 0) {
+    schedule.Remove(pInfo->nSchedule);
+    pInfo->nSchedule = -1;
+  }
+  return pInfo;
+}
+
+// Good nodes whose last probe succeeded, and that are not due yet (a node released after a
+// dropped connection is probed normally first), at random. They are taken off the schedule
+// and count as being tried until released.
+void CAddrDb::TakeKeep_(std::vector<CService> &ips, int max, int64 now) {
+  for (int nTry = 0; nTry < max * 4 && ips.size() < max && nGood > 0; nTry++) {
+    int n = rand() % nGood;
+    std::map<uint64_t, std::vector<CAddrInfo*> >::iterator it = goodId.begin();
+    while (it != goodId.end() && n >= (*it).second.size()) {
+      n -= (*it).second.size();
+      it++;
+    }
+    if (it == goodId.end()) break;
+    CAddrInfo &info = *(*it).second[n];
+    if (info.nSchedule < 0 || info.nWarmPos != -1 || info.ourLastSuccess != info.ourLastTry || schedule.GetDue(info.nSchedule) <= now)
+      continue;
+    if (pPartition && !pPartition->IsMine(info.ip))
+      continue;
+    schedule.Remove(info.nSchedule);
+    info.nSchedule = -1;
+    ips.push_back(info.ip);
+  }
+}
+
+void CAddrDb::Release_(const CService &ip, bool fNow, int64 now) {
+  int id = Lookup_(ip);
+  if (id == -1) return;
+  CAddrInfo &info = idToInfo[id];
+  if (info.nSchedule >= 0 || info.nUnkPos >= 0 || info.nWarmPos != -1 || info.nFlight) return;
+  info.nSchedule = schedule.Insert(id, fNow ? now : info.GetNextTry());
+}
+
+void CAddrDb::NoteWarm_(CAddrInfo &info, bool fGood) {
+  if (info.nWarmPos == -1) return;
+  if (info.nWarmPos >= 0) {
+    CAddrInfo *pLast = warmId.back();
+    warmId[info.nWarmPos] = pLast;
+    pLast->nWarmPos = info.nWarmPos;
+    warmId.pop_back();
+  }
+  info.nWarmPos = -1;
+  nWarmDone++;
+  if (fGood) nWarmGood++;
+  if (!nWarmStart) return;
+  int nMillis = (GetTimeMicros() - nWarmStart) / 1000;
+  if (fGood && nWarmMillis[0] < 0) nWarmMillis[0] = nMillis;
+  if (nWarmDone * 2 >= nWarmTotal && nWarmMillis[1] < 0) nWarmMillis[1] = nMillis;
+  if (nWarmDone * 10 >= nWarmTotal * 9 && nWarmMillis[2] < 0) nWarmMillis[2] = nMillis;
+  if (nWarmDone >= nWarmTotal && nWarmMillis[3] < 0) nWarmMillis[3] = nMillis;
+}
+
+void CAddrDb::SetUnknown_(CAddrInfo &info) {
+  if (info.nUnkPos >= 0) return;
+  info.nUnkPos = unkId.size();
+  unkId.push_back(&info);
+}
+
+void CAddrDb::UnsetUnknown_(CAddrInfo &info) {
+  if (info.nUnkPos < 0) return;
+  CAddrInfo *pLast = unkId.back();
+  unkId[info.nUnkPos] = pLast;
+  pLast->nUnkPos = info.nUnkPos;
+  unkId.pop_back();
+  info.nUnkPos = -1;
+}
+
+// A node that has behaved the same way for a while, and predictably so, is likely to go on
+// doing so for a good fraction of that time: the interval grows with the length of its run
+// of equal outcomes, scaled by its stability. Nodes that were up are capped by the staleness
+// target, less twice the current lateness of revisits as a margin, so good ones stay confirmed
+// in time (and those not good yet get the probes to become so).
+int CAddrDb::GetRevisit_(const CAddrInfo &info) const {
+  if (!nRevisitMax || !info.lastChange) return 0;
+  double dRun = info.ourLastTry - info.lastChange;
+  int64 nMax = nRevisitMax;
+  if (info.ourLastSuccess == info.ourLastTry) {
+    // the shorter windows only keep a node good if it is tried every few hours; longer
+    // intervals have to wait until the week or month window would do so on its own
+    const CAddrStat &week = info.stat1W, &month = info.stat1M;
+    bool fLongTerm = (week.count > 20 && week.reliability > 0.5) || (month.count > 40 && month.reliability > 0.4);
+    nMax = std::min(nMax, (int64)(fLongTerm ? REVISIT_GOOD_MAX : REVISIT_UP_MAX));
+    if (nStaleMax) nMax = std::min(nMax, (int64)(nStaleMax - 2 * dLate));
+  }
+  return std::max((int64)MIN_RETRY, std::min(nMax, (int64)(dRun * info.GetStability() / REVISIT_SHARE)));
+}
+
+void CAddrDb::GetRevisitStats(CRevisitStats &stats) const {
+  SHARED_CRITICAL_BLOCK(cs) {
+    int64 now = time(NULL);
+    stats.dProbeRate = 0;
+    for (std::vector<CAddrInfo*>::const_iterator it = vNodes.begin(); it != vNodes.end(); it++)
+      if ((*it)->nSchedule >= 0)
+        stats.dProbeRate += 3600.0 / std::max((*it)->GetNextTry() - (*it)->ourLastTry, (int64)MIN_RETRY);
+    stats.nLate = dLate;
+    stats.nStale = 0;
+    stats.nOldest = 0;
+    for (std::map<uint64_t, std::vector<CAddrInfo*> >::const_iterator it = goodId.begin(); it != goodId.end(); it++) {
+      for (std::vector<CAddrInfo*>::const_iterator jt = (*it).second.begin(); jt != (*it).second.end(); jt++) {
+        int64 nAge = now - (*jt)->ourLastTry;
+        if (nStaleMax && nAge > nStaleMax) stats.nStale++;
+        stats.nOldest = std::max(stats.nOldest, nAge);
+      }
+    }
+  }
+}
+
+void CAddrDb::Schedule_(int id) {
+  CAddrInfo &info = idToInfo[id];
+  info.nRevisit = GetRevisit_(info);
+  if (info.nSchedule >= 0)
+    schedule.Reschedule(info.nSchedule, info.GetNextTry());
+  else
+    info.nSchedule = schedule.Insert(id, info.GetNextTry());
+}
+
+void CAddrDb::Unschedule_(int id) {
+  std::map<int, CAddrInfo>::iterator it = idToInfo.find(id);
+  if (it != idToInfo.end() && (*it).second.nSchedule >= 0) {
+    schedule.Remove((*it).second.nSchedule);
+    (*it).second.nSchedule = -1;
+  }
+}
+
+void CAddrDb::Ban_(const CService &ip, int64 nUntil) {
+  banned[ip] = nUntil;
+  unban.Insert(ip, nUntil);
+}
+
+void CAddrDb::Expire_(int64 now) {
+  // nodes that become due were either waiting for MIN_RETRY or for their ignore time to pass
+  schedule.Advance(now, [&](int h) {
+    std::map<int, CAddrInfo>::iterator it = idToInfo.find(schedule.Get(h));
+    if (it != idToInfo.end() && (*it).second.ignoreTill && (*it).second.ignoreTill <= now)
+      (*it).second.ignoreTill = 0;
+  });
+  unban.Advance(now, [](int h) {});
+  while (unban.GetReady()) {
+    CService ip = unban.PopReady();
+    time_t *pUntil = banned.Find(ip);
+    if (pUntil && *pUntil <= now)
+      banned.erase(ip);
+  }
 }
 
 int CAddrDb::Lookup_(const CService &ip) {
-  if (ipToId.count(ip))
-    return ipToId[ip];
-  return -1;
+  const int *pId = ipToId.Find(ip);
+  return pId ? *pId : -1;
 }
 
-void CAddrDb::Good_(const CService &addr, int clientV, std::string clientSV, int blocks) {
+void CAddrDb::Good_(const CService &addr, int clientV, uint32_t clientSV, int blocks, int64 now, const CProbeRtt &rtt) {
   int id = Lookup_(addr);
   if (id == -1) return;
-  unkId.erase(id);
+  if (journal) {
+    journal->BeginRecord(JOURNAL_GOOD, now) << addr << clientV << GetSubVersion(clientSV) << blocks << rtt.nConnect << rtt.nHandshake << rtt.nPing;
+    journal->EndRecord();
+  }
   banned.erase(addr);
   CAddrInfo &info = idToInfo[id];
+  UnsetUnknown_(info);
+  Land_(info);
+  NoteResult_(info, true);
   info.clientVersion = clientV;
   info.clientSubVersion = clientSV;
   info.blocks = blocks;
-  info.Update(true);
-  if (info.IsGood() && goodId.count(id)==0) {
-    goodId.insert(id);
-    // printf("%s: good; %i good nodes now\n", ToString(addr).c_str(), (int)goodId.size());
+  info.rtt.Update(rtt);
+  info.Update(true, now, *pNet);
+  if (info.nWarmPos == WARM_INFLIGHT)
+    NoteWarm_(info, info.IsGood(*pNet));
+  // nodes still awaiting revalidation (when replaying the journal) only become good once tried
+  if (info.IsGood(*pNet) && info.nGoodPos < 0 && info.nWarmPos < 0) {
+    SetGood_(info);
+    // printf("%s: good; %i good nodes now\n", ToString(addr).c_str(), nGood);
   } else {
-    // printf("%s: not good; %i good nodes now\n", ToString(addr).c_str(), (int)goodId.size());
+    // printf("%s: not good; %i good nodes now\n", ToString(addr).c_str(), nGood);
   }
   nDirty++;
-  ourId.push_back(id);
+  Schedule_(id);
 }
 
-void CAddrDb::Bad_(const CService &addr, int ban)
+void CAddrDb::Bad_(const CService &addr, int ban, int64 now)
 {
   int id = Lookup_(addr);
   if (id == -1) return;
-  unkId.erase(id);
+  if (journal) {
+    journal->BeginRecord(JOURNAL_BAD, now) << addr << ban;
+    journal->EndRecord();
+  }
   CAddrInfo &info = idToInfo[id];
-  info.Update(false);
-  uint32_t now = time(NULL);
-  int ter = info.GetBanTime();
+  UnsetUnknown_(info);
+  Land_(info);
+  NoteResult_(info, false);
+  if (info.nWarmPos == WARM_INFLIGHT)
+    NoteWarm_(info, false);
+  info.Update(false, now, *pNet);
+  int ter = info.GetBanTime(*pNet);
   if (ter) {
 //    printf("%s: terrible\n", ToString(addr).c_str());
     if (ban < ter) ban = ter;
   }
   if (ban > 0) {
 //    printf("%s: ban for %i seconds\n", ToString(addr).c_str(), ban);
-    banned[info.ip] = ban + now;
-    ipToId.erase(info.ip);
-    goodId.erase(id);
-    idToInfo.erase(id);
+    Ban_(info.ip, ban + now);
+    Remove_(id);
   } else {
-    if (/*!info.IsGood() && */ goodId.count(id)==1) {
-      goodId.erase(id);
-//      printf("%s: not good; %i good nodes left\n", ToString(addr).c_str(), (int)goodId.size());
+    if (/*!info.IsGood() && */ info.nGoodPos >= 0) {
+      UnsetGood_(info);
+//      printf("%s: not good; %i good nodes left\n", ToString(addr).c_str(), nGood);
     }
-    ourId.push_back(id);
+    Schedule_(id);
   }
   nDirty++;
 }
@@ -143,37 +630,146 @@ void CAddrDb::Skipped_(const CService &addr)
 {
   int id = Lookup_(addr);
   if (id == -1) return;
-  unkId.erase(id);
-  ourId.push_back(id);
+  if (journal) {
+    journal->BeginRecord(JOURNAL_SKIP, time(NULL)) << addr;
+    journal->EndRecord();
+  }
+  CAddrInfo &info = idToInfo[id];
+  UnsetUnknown_(info);
+  Land_(info);
+  if (info.nWarmPos == WARM_INFLIGHT)
+    NoteWarm_(info, false);
+  Schedule_(id);
 //  printf("%s: skipped\n", ToString(addr).c_str());
   nDirty++;
 }
 
+// Another seeder's probe outcome is secondary evidence: it can introduce a node (like an
+// addr message from that peer) or postpone our own revisit of a node we have reached
+// ourselves by up to one interval (see GetNextTry), but it never touches our statistics,
+// so it never makes or keeps a node good, bans it or ignores it. The exception are nodes
+// a cluster member probes on our behalf (see Claim_): its outcomes count like ours.
+bool CAddrDb::Remote_(const CRemoteResult &res, int nSource, int64 now, int nMember) {
+  if (res.nTime > now + 600) return false; // from a skewed clock
+  if (nMember >= 0 && pPartition) {
+    if (pPartition->IsSample(res.service)) {
+      // probed by every member: compare with our own outcome from about the same time
+      int id = Lookup_(res.service);
+      if (id != -1 && idToInfo[id].ourLastTry && llabs(res.nTime - idToInfo[id].ourLastTry) <= MIN_RETRY)
+        pPartition->NoteCrossCheck(nMember, res.fGood == (idToInfo[id].ourLastSuccess == idToInfo[id].ourLastTry));
+      return false;
+    }
+    if (pPartition->GetOwner(res.service) == nMember) {
+      int id = Lookup_(res.service);
+      if (id == -1 && res.fGood) {
+        CAddress addr(res.service, res.nServices);
+        addr.nTime = res.nTime;
+        Add_(addr, false, now, nSource);
+        id = Lookup_(res.service);
+      }
+      if (id == -1) return false;
+      CAddrInfo &info = idToInfo[id];
+      // being tried by us right now (after the owner's grace period), or we know better
+      if ((info.nSchedule < 0 && info.nUnkPos < 0) || res.nTime <= info.ourLastTry)
+        return false;
+      if (info.nWarmPos >= 0)
+        NoteWarm_(info, res.fGood);
+      if (info.nUnkPos >= 0)
+        info.nClaimAfter = 0; // see Claim_
+      if (res.fGood)
+        Good_(res.service, res.nClientV, InternPeerSubVersion(res.strClientSV, GetGroupKey(res.service)), res.nHeight, res.nTime);
+      else
+        Bad_(res.service, 0, res.nTime);
+      return true;
+    }
+  }
+  int id = Lookup_(res.service);
+  if (id == -1 || idToInfo[id].nUnkPos >= 0) {
+    // new or untried: only a success is worth an (earlier) try of our own
+    if (!res.fGood) return false;
+    CAddress addr(res.service, res.nServices);
+    addr.nTime = res.nTime;
+    int64 nDirtyBefore = nDirty;
+    Add_(addr, false, now, nSource, id == -1);
+    return nDirty != nDirtyBefore;
+  }
+  CAddrInfo &info = idToInfo[id];
+  // being tried or awaiting revalidation by us, or we know better
+  if (info.nSchedule < 0 || info.nWarmPos != -1 || res.nTime <= info.ourLastTry)
+    return false;
+  if (!res.fGood) {
+    // a good node that failed elsewhere: check it ourselves now
+    if (info.nGoodPos < 0) return false;
+    schedule.Reschedule(info.nSchedule, now);
+    return true;
+  }
+  if (!info.success || res.nTime <= info.remoteLastSuccess) return false;
+  if (journal) {
+    journal->BeginRecord(JOURNAL_REMOTE, now) << res;
+    journal->EndRecord();
+  }
+  info.remoteLastSuccess = res.nTime;
+  nDirty++;
+  Schedule_(id);
+  return true;
+}
 
-void CAddrDb::Add_(const CAddress &addr, bool force) {
+
+void CAddrDb::Add_(const CAddress &addr, bool force, int64 now, int nSource, bool fQuota) {
   if (!force && !addr.IsRoutable())
     return;
   CService ipp(addr);
-  if (banned.count(ipp)) {
-    time_t bantime = banned[ipp];
-    if (force || (bantime < time(NULL) && addr.nTime > bantime))
-      banned.erase(ipp);
-    else
-      return;
-  }
-  if (ipToId.count(ipp)) {
-    CAddrInfo &ai = idToInfo[ipToId[ipp]];
+  if (!banned.empty()) {
+    time_t *pBanTime = banned.Find(ipp);
+    if (pBanTime) {
+      if (force || (*pBanTime < now && addr.nTime > *pBanTime))
+        banned.erase(ipp);
+      else
+        return;
+    }
+  }
+  const int *pId = ipToId.Find(ipp);
+  if (pId) {
+    int id = *pId;
+    CAddrInfo &ai = idToInfo[id];
+    bool fChanged = force;
     if (addr.nTime > ai.lastTry || ai.services != addr.nServices)
     {
       ai.lastTry = addr.nTime;
+      if ((ai.services | addr.nServices) != ai.services && ai.nGoodPos >= 0) {
+        // move to the goodId group of the new flags
+        UnsetGood_(ai);
+        ai.services |= addr.nServices;
+        SetGood_(ai);
+      }
       ai.services |= addr.nServices;
+      fChanged = true;
 //      printf("%s: updated\n", ToString(addr).c_str());
     }
     if (force) {
       ai.ignoreTill = 0;
+      if (ai.nSchedule >= 0)
+        Schedule_(id);
     }
+    if (fChanged) {
+      if (journal) {
+        journal->BeginRecord(JOURNAL_ADD, now) << addr << force;
+        journal->EndRecord();
+      }
+      nDirty++;
+    }
+    return;
+  }
+  if (fQuota && !TakeQuota_(nSource, ipp, now)) {
+    nOverQuota++;
     return;
   }
+  if (journal) {
+    CDataStream &ss = journal->BeginRecord(JOURNAL_ADD, now) << addr << force;
+    if (nSource)
+      ss << vSources[nSource].ip;
+    journal->EndRecord();
+  }
   CAddrInfo ai;
   ai.ip = ipp;
   ai.services = addr.nServices;
@@ -181,49 +777,478 @@ void CAddrDb::Add_(const CAddress &addr, bool force) {
   ai.ourLastTry = 0;
   ai.total = 0;
   ai.success = 0;
+  ai.nSource = nSource;
+  vSources[nSource].nAdded++;
   int id = nId++;
-  idToInfo[id] = ai;
-  ipToId[ipp] = id;
+  CAddrInfo &info = idToInfo[id] = ai;
+  Index_(id, info);
 //  printf("%s: added\n", ToString(ipp).c_str(), ipToId[ipp]);
-  unkId.insert(id);
+  SetUnknown_(info);
+  nDirty++;
+}
+
+void CAddrDb::Index_(int id, CAddrInfo &info) {
+  ipToId[info.ip] = id;
+  info.nNodePos = vNodes.size();
+  vNodes.push_back(&info);
+  mapGroupCount[GetGroupKey(info.ip)]++;
+  vSources[info.nSource].nRef++;
+}
+
+void CAddrDb::Remove_(int id) {
+  std::map<int, CAddrInfo>::iterator it = idToInfo.find(id);
+  if (it == idToInfo.end()) return;
+  CAddrInfo &info = (*it).second;
+  UnsetUnknown_(info);
+  Land_(info);
+  NoteWarm_(info, false);
+  Unschedule_(id);
+  UnsetGood_(info);
+  SetCluster_(id, info, 0);
+  ipToId.erase(info.ip);
+  CAddrInfo *pLast = vNodes.back();
+  vNodes[info.nNodePos] = pLast;
+  pLast->nNodePos = info.nNodePos;
+  vNodes.pop_back();
+  vSources[info.nSource].nRef--;
+  std::unordered_map<uint64_t, int>::iterator gi = mapGroupCount.find(GetGroupKey(info.ip));
+  if (gi != mapGroupCount.end() && --(*gi).second <= 0)
+    mapGroupCount.erase(gi);
+  idToInfo.erase(it);
+}
+
+// Only nodes that were never tried, or have not worked for a month, can be evicted.
+// Higher scores are kept: recently advertised nodes, nodes with fewer failed tries, from
+// network groups with few others, and from good sources. (Evicting a node that is being
+// tried is harmless: its result is ignored.)
+bool CAddrDb::GetEvictScore_(const CAddrInfo &info, int64 now, double &score) {
+  if (info.success > 0 && now - info.ourLastSuccess < 30*86400) return false;
+  double age = now > info.lastTry ? now - info.lastTry : 0;
+  score = -log2(1.0 + age / 3600.0);
+  score -= std::min(info.total - info.success, 16) * 0.5;
+  std::unordered_map<uint64_t, int>::const_iterator gi = mapGroupCount.find(GetGroupKey(info.ip));
+  if (gi != mapGroupCount.end())
+    score -= log2((double)(*gi).second);
+  score += 4.0 * (vSources[info.nSource].GetQuality() - 0.5);
+  return true;
+}
+
+void CAddrDb::Evict_(const CService &ip, int64 now) {
+  int id = Lookup_(ip);
+  if (id == -1) return;
+  if (journal) {
+    journal->BeginRecord(JOURNAL_EVICT, now) << ip;
+    journal->EndRecord();
+  }
+  Remove_(id);
+  nEvicted++;
   nDirty++;
 }
 
+// Evict the lowest-scoring nodes until at most nMaxNodes remain. Each round scores a
+// random sample of 8 nodes per node over the cap, and evicts the worst of them.
+void CAddrDb::Trim_(int64 now) {
+  std::vector<std::pair<double, CService> > vCand;
+  while (nMaxNodes > 0 && vNodes.size() > (size_t)nMaxNodes) {
+    size_t nExcess = vNodes.size() - nMaxNodes;
+    size_t nProbe = std::max(nExcess * 8, (size_t)64);
+    bool fAll = nProbe >= vNodes.size();
+    vCand.clear();
+    for (size_t i = 0; i < (fAll ? vNodes.size() : nProbe); i++) {
+      const CAddrInfo *pInfo = vNodes[fAll ? i : rand() % vNodes.size()];
+      double score;
+      if (GetEvictScore_(*pInfo, now, score))
+        vCand.push_back(std::make_pair(score, pInfo->ip));
+    }
+    if (vCand.empty()) break;
+    size_t nEvict = std::min(nExcess, vCand.size());
+    std::nth_element(vCand.begin(), vCand.begin() + (nEvict - 1), vCand.end());
+    for (size_t i = 0; i < nEvict; i++)
+      Evict_(vCand[i].second, now);
+  }
+}
+
+int CAddrDb::GetSource_(const CService &ip) {
+  int &nSource = sourceToId[ip];
+  if (!nSource) {
+    if (!vFreeSources.empty()) {
+      nSource = vFreeSources.back();
+      vFreeSources.pop_back();
+      vSources[nSource] = CAddrSource();
+    } else {
+      nSource = vSources.size();
+      vSources.push_back(CAddrSource());
+    }
+    vSources[nSource].ip = ip;
+  }
+  return nSource;
+}
+
+// Like the snapshot does, forget sources no node refers to that are not nodes themselves,
+// unless they added nodes in the current quota interval, so every relaying peer does not
+// stay around for good. Their entries are reused.
+void CAddrDb::ExpireSources_(int nKeep) {
+  for (int i = 1; i < vSources.size(); i++) {
+    CAddrSource &source = vSources[i];
+    if (i == nKeep || source.nQuotaEpoch < 0 || source.nRef > 0 || source.nQuotaEpoch == nQuotaEpoch || ipToId.Find(source.ip))
+      continue;
+    sourceToId.erase(source.ip);
+    source = CAddrSource();
+    source.nQuotaEpoch = -1;
+    vFreeSources.push_back(i);
+  }
+}
+
+// A source may add twice its base quota times its quality per interval, so sources
+// whose addresses turn out to be unreachable are throttled towards nothing.
+bool CAddrDb::TakeQuota_(int nSource, const CService &ip, int64 now) {
+  int64 nEpoch = now / ADD_QUOTA_INTERVAL;
+  if (nEpoch != nQuotaEpoch) {
+    nQuotaEpoch = nEpoch;
+    mapGroupQuota.clear();
+    ExpireSources_(nSource);
+  }
+  CAddrSource &source = vSources[nSource];
+  if (source.nQuotaEpoch != nEpoch) {
+    source.nQuotaEpoch = nEpoch;
+    source.nQuotaUsed = 0;
+  }
+  if (nSource && nSourceQuota > 0 && source.nQuotaUsed >= 2.0 * nSourceQuota * source.GetQuality())
+    return false;
+  if (nGroupQuota > 0) {
+    int &nUsed = mapGroupQuota[GetGroupKey(ip)];
+    if (nUsed >= nGroupQuota) return false;
+    nUsed++;
+  }
+  source.nQuotaUsed++;
+  return true;
+}
+
+void CAddrDb::NoteResult_(const CAddrInfo &info, bool fGood) {
+  if (info.total) return;
+  nFirstTried++;
+  if (fGood) nFirstGood++;
+  if (!info.nSource) return;
+  CAddrSource &source = vSources[info.nSource];
+  source.nTried++;
+  if (fGood) source.nGood++;
+}
+
+void CAddrDb::SetGood_(CAddrInfo &info) {
+  if (info.nGoodPos >= 0) return;
+  std::vector<CAddrInfo*> &group = goodId[info.services];
+  info.nGoodPos = group.size();
+  group.push_back(&info);
+  nGood++;
+  for (int i = 0, n = 1; i < 5; i++, n *= 10) {
+    if (nGood == n && nTimeToGood[i] < 0)
+      nTimeToGood[i] = time(NULL) - nStartTime;
+  }
+}
+
+void CAddrDb::UnsetGood_(CAddrInfo &info) {
+  if (info.nGoodPos < 0) return;
+  std::map<uint64_t, std::vector<CAddrInfo*> >::iterator it = goodId.find(info.services);
+  std::vector<CAddrInfo*> &group = (*it).second;
+  // move the last node into the hole
+  CAddrInfo *pLast = group.back();
+  group[info.nGoodPos] = pLast;
+  pLast->nGoodPos = info.nGoodPos;
+  group.pop_back();
+  if (group.empty())
+    goodId.erase(it);
+  info.nGoodPos = -1;
+  nGood--;
+}
+
 void CAddrDb::GetIPs_(set<CNetAddr>& ips, uint64_t requestedFlags, int max, const bool* nets) {
-  if (goodId.size() == 0) {
-    int id = -1;
-    if (ourId.size() == 0) {
+  if (nGood == 0 && warmId.empty()) {
+    const CAddrInfo *pInfo = NULL;
+    if (schedule.size() == 0) {
       if (unkId.size() == 0) return;
-      id = *unkId.begin();
+      pInfo = unkId[0];
     } else {
-      id = *ourId.begin();
+      pInfo = &idToInfo[schedule.Get(schedule.First())];
     }
-    if (id >= 0 && (idToInfo[id].services & requestedFlags) == requestedFlags) {
-      ips.insert(idToInfo[id].ip);
+    if ((pInfo->services & requestedFlags) == requestedFlags) {
+      ips.insert(pInfo->ip);
     }
     return;
   }
-  std::vector<int> goodIdFiltered;
-  for (std::set<int>::const_iterator it = goodId.begin(); it != goodId.end(); it++) {
-    if ((idToInfo[*it].services & requestedFlags) == requestedFlags)
-      goodIdFiltered.push_back(*it);
+  // only the groups of good nodes with all requested flags are visited
+  std::vector<const std::vector<CAddrInfo*>*> groups;
+  int nFiltered = 0;
+  for (std::map<uint64_t, std::vector<CAddrInfo*> >::const_iterator it = goodId.begin(); it != goodId.end(); it++) {
+    if (((*it).first & requestedFlags) == requestedFlags) {
+      groups.push_back(&(*it).second);
+      nFiltered += (*it).second.size();
+    }
   }
 
-  if (!goodIdFiltered.size())
-    return;
-
-  if (max > goodIdFiltered.size() / 2)
-    max = goodIdFiltered.size() / 2;
-  if (max < 1)
-    max = 1;
-
-  set<int> ids;
-  while (ids.size() < max) {
-    ids.insert(goodIdFiltered[rand() % goodIdFiltered.size()]);
+  set<const CAddrInfo*> nodes;
+  if (nFiltered) {
+    int k = max;
+    if (k > nFiltered / 2)
+      k = nFiltered / 2;
+    if (k < 1)
+      k = 1;
+    while (nodes.size() < k) {
+      int n = rand() % nFiltered;
+      int g = 0;
+      while (n >= groups[g]->size())
+        n -= groups[g++]->size();
+      nodes.insert((*groups[g])[n]);
+    }
   }
-  for (set<int>::const_iterator it = ids.begin(); it != ids.end(); it++) {
-    CService &ip = idToInfo[*it].ip;
+  // during a warm start, top up with nodes that were good before and are not reconfirmed yet
+  if (nodes.size() < max && !warmId.empty()) {
+    int k = std::min(max - (int)nodes.size(), std::max((int)warmId.size() / 2, 1));
+    for (int i = 0; i < k; i++) {
+      const CAddrInfo *pInfo = warmId[rand() % warmId.size()];
+      if ((pInfo->services & requestedFlags) == requestedFlags)
+        nodes.insert(pInfo);
+    }
+  }
+  for (set<const CAddrInfo*>::const_iterator it = nodes.begin(); it != nodes.end(); it++) {
+    const CService &ip = (*it)->ip;
     if (nets[ip.GetNetwork()])
       ips.insert(ip);
   }
 }
+
+// Open addressing set of small non-negative ints, reused between calls.
+class CSampleSet {
+private:
+  std::vector<int> vTable;
+  int nMask;
+public:
+  void Reset(int nMax) {
+    int nSize = 16;
+    while (nSize < nMax * 2) nSize *= 2;
+    if (vTable.size() < nSize) vTable.resize(nSize);
+    nMask = nSize - 1;
+    std::fill(vTable.begin(), vTable.begin() + nSize, -1);
+  }
+  bool Contains(int n) const {
+    unsigned int i = (unsigned int)n * 2654435761u;
+    while (true) {
+      i &= nMask;
+      if (vTable[i] == n) return true;
+      if (vTable[i] < 0) return false;
+      i++;
+    }
+  }
+  // returns false if n was already in the set
+  bool Insert(int n) {
+    unsigned int i = (unsigned int)n * 2654435761u;
+    while (true) {
+      i &= nMask;
+      if (vTable[i] == n) return false;
+      if (vTable[i] < 0) {
+        vTable[i] = n;
+        return true;
+      }
+      i++;
+    }
+  }
+};
+
+// the n-th node of the concatenated groups
+static const CAddrInfo *GetNth(const std::vector<const std::vector<CAddrInfo*>*> &groups, int n) {
+  int g = 0;
+  while (n >= groups[g]->size())
+    n -= groups[g++]->size();
+  return (*groups[g])[n];
+}
+
+// write ip to a if its network is still within quota
+static bool WriteAddr(addr_t &a, const CNetAddr &ip, int *count, const int *quota) {
+  if (ip.IsIPv4()) {
+    if (count[NET_IPV4] >= quota[NET_IPV4]) return false;
+    a.v = 4;
+    ip.GetInAddr((struct in_addr*)a.data.v4);
+    count[NET_IPV4]++;
+    return true;
+  }
+  if (ip.IsIPv6()) {
+    if (count[NET_IPV6] >= quota[NET_IPV6]) return false;
+    a.v = 6;
+    ip.GetIn6Addr((struct in6_addr*)a.data.v6);
+    count[NET_IPV6]++;
+    return true;
+  }
+  return false;
+}
+
+int CAddrDb::SampleIPs_(addr_t *addr, int max, uint64_t requestedFlags, const int *quota) {
+  static thread_local std::vector<const std::vector<CAddrInfo*>*> groups;
+  static thread_local CSampleSet chosen;
+  static thread_local std::unordered_set<uint64_t> setCluster;
+  int count[NET_MAX] = {};
+  if (nGood == 0 && warmId.empty()) {
+    // while bootstrapping, hand out one known node (like GetIPs_)
+    const CAddrInfo *pInfo = NULL;
+    if (schedule.size() == 0) {
+      if (unkId.size() == 0) return 0;
+      pInfo = unkId[0];
+    } else {
+      pInfo = &idToInfo[schedule.Get(schedule.First())];
+    }
+    if (max > 0 && (pInfo->services & requestedFlags) == requestedFlags)
+      return WriteAddr(addr[0], pInfo->ip, count, quota) ? 1 : 0;
+    return 0;
+  }
+  groups.clear();
+  int nFiltered = 0;
+  for (std::map<uint64_t, std::vector<CAddrInfo*> >::const_iterator it = goodId.begin(); it != goodId.end(); it++) {
+    if (((*it).first & requestedFlags) == requestedFlags) {
+      groups.push_back(&(*it).second);
+      nFiltered += (*it).second.size();
+    }
+  }
+  int ret = 0;
+  setCluster.clear();
+  // write a node, unless another address of it was written already
+  auto writeNode = [&](const CAddrInfo *pInfo) {
+    bool fCluster = GetCluster_(*pInfo) != NULL;
+    if (fCluster && setCluster.count(pInfo->nCluster)) return;
+    if (!WriteAddr(addr[ret], pInfo->ip, count, quota)) return;
+    if (fCluster) setCluster.insert(pInfo->nCluster);
+    ret++;
+  };
+  if (nFiltered) {
+    int k = max;
+    if (k > nFiltered / 2)
+      k = nFiltered / 2;
+    if (k < 1)
+      k = 1;
+
+    chosen.Reset(k);
+    if (nRttBias > 1) {
+      // each of the k distinct nodes is the best by round trip time of nRttBias drawn
+      // among those not chosen yet (at least half of them, as k <= nFiltered / 2)
+      for (int i = 0; i < k; i++) {
+        int nBest = -1;
+        double dBest = 0;
+        for (int t = 0; t < nRttBias || nBest < 0; t++) {
+          int n = rand() % nFiltered;
+          if (chosen.Contains(n)) continue;
+          double d = GetNth(groups, n)->rtt.GetScore();
+          if (nBest < 0 || d < dBest) {
+            nBest = n;
+            dBest = d;
+          }
+        }
+        chosen.Insert(nBest);
+        writeNode(GetNth(groups, nBest));
+      }
+    } else {
+      // Floyd's algorithm: k distinct indices out of nFiltered, uniformly
+      for (int j = nFiltered - k; j < nFiltered; j++) {
+        int n = rand() % (j + 1);
+        if (!chosen.Insert(n)) {
+          n = j;
+          chosen.Insert(n);
+        }
+        writeNode(GetNth(groups, n));
+      }
+    }
+  }
+
+  // during a warm start, top up with nodes that were good before and are not reconfirmed yet
+  int nWarm = warmId.size();
+  if (ret < max && nWarm > 0) {
+    int k = std::min(max - ret, std::max(nWarm / 2, 1));
+    chosen.Reset(k);
+    for (int j = nWarm - k; j < nWarm; j++) {
+      int n = rand() % (j + 1);
+      if (!chosen.Insert(n)) {
+        n = j;
+        chosen.Insert(n);
+      }
+      const CAddrInfo *pInfo = warmId[n];
+      if ((pInfo->services & requestedFlags) == requestedFlags)
+        writeNode(pInfo);
+    }
+  }
+  return ret;
+}
+
+void CAddrDb::Replay_(unsigned char nType, int64 nTime, CDataStream &ssBody) {
+  switch (nType) {
+    case JOURNAL_ADD: {
+      CAddress addr;
+      bool force;
+      ssBody >> addr >> force;
+      int nSource = 0;
+      if (!ssBody.empty()) {
+        CService source;
+        ssBody >> source;
+        nSource = GetSource_(source);
+      }
+      Add_(addr, force, nTime, nSource);
+      break;
+    }
+    case JOURNAL_GOOD: {
+      CService ip;
+      int clientV, blocks;
+      string clientSV;
+      ssBody >> ip >> clientV >> clientSV >> blocks;
+      CProbeRtt rtt;
+      if (!ssBody.empty())
+        ssBody >> rtt.nConnect >> rtt.nHandshake >> rtt.nPing;
+      Good_(ip, clientV, InternSubVersion(clientSV), blocks, nTime, rtt);
+      break;
+    }
+    case JOURNAL_BAD: {
+      CService ip;
+      int ban;
+      ssBody >> ip >> ban;
+      Bad_(ip, ban, nTime);
+      break;
+    }
+    case JOURNAL_SKIP: {
+      CService ip;
+      ssBody >> ip;
+      Skipped_(ip);
+      break;
+    }
+    case JOURNAL_EVICT: {
+      CService ip;
+      ssBody >> ip;
+      Evict_(ip, nTime);
+      break;
+    }
+    case JOURNAL_REMOTE: {
+      CRemoteResult res;
+      ssBody >> res;
+      Remote_(res, 0, nTime);
+      break;
+    }
+  }
+}
+
+long CAddrDb::ReplayJournal(const string &strFile, int &nReplayed, uint64 &nSeqLast) {
+  FILE *file = fopen(strFile.c_str(), "rb");
+  if (!file) return 0;
+  long nValid = 0;
+  CDataStream ssBody(SER_DISK);
+  unsigned char nType;
+  uint64 nSeq;
+  int64 nTime;
+  CRITICAL_BLOCK(cs) {
+    while (ReadJournalRecord(file, nType, nSeq, nTime, ssBody)) {
+      nValid = ftell(file);
+      if (nSeq > nSeqLast) nSeqLast = nSeq;
+      if (nSeq <= nSnapSeq) continue;
+      try {
+        Replay_(nType, nTime, ssBody);
+      } catch (std::ios_base::failure& e) {
+        continue;
+      }
+      nReplayed++;
+    }
+  }
+  fclose(file);
+  return nValid;
+}
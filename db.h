@@ -20,35 +20,48 @@
 ** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 ** THE SOFTWARE.
 */
+#ifndef _DB_H_
+#define _DB_H_ 1
+
 #include <stdint.h>
 #include <math.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <set>
 #include <map>
 #include <vector>
 #include <deque>
+#include <atomic>
 
+#include "addr.h"
+#include "addrkey.h"
+#include "intern.h"
+#include "journal.h"
 #include "netbase.h"
+#include "netparams.h"
+#include "partition.h"
 #include "protocol.h"
 #include "util.h"
+#include "wheel.h"
 
 #define MIN_RETRY 1000
+#define ADD_QUOTA_INTERVAL 3600
+#define PROBE_SAMPLE 8   // untried nodes scored per pick
+#define PROBE_EXPLORE 8  // one in this many picks is uniformly random
+#define WARM_INFLIGHT -2 // CAddrInfo::nWarmPos of a node taken for revalidation
+#define PARTITION_TRIES 16 // picks Get_ may leave to other cluster members before giving up
+#define RTT_ALPHA 0.25   // weight of a new sample in the round trip time averages
+#define RTT_UNKNOWN 1000 // score (ms) of a node whose round trip time was not measured yet
+#define CLUSTER_MAX 8    // addresses one node plausibly has; bigger clusters are ignored as bogus
+#define CLUSTER_REVISIT (6*3600) // every address of a cluster is still probed at least this often
+#define REVISIT_SHARE 8  // a node that behaved the same for time t is revisited after at most t / REVISIT_SHARE
+#define REVISIT_UP_MAX (2*3600) // longest revisit interval of a node that is up (enough for the day window of IsGood)
+#define REVISIT_GOOD_MAX (8*3600) // the same once its week or month window would keep it good on its own
+#define FLIGHT_PARKED -1 // CAddrInfo::nFlight of a due node held back while its network group is at its cap
+#define PARK_MAX 1024    // due nodes Get_ may hold back per call, on top of its PARTITION_TRIES picks
 
-static const int MAINNET_REQUIRE_VERSION = 70027;
-static const int TESTNET_REQUIRE_VERSION = 70025;
-
-static const int MAINNET_REQUIRE_HEIGHT = 450000;
-static const int TESTNET_REQUIRE_HEIGHT = 0;
-
-static inline int GetRequireHeight(const bool mainnet = fMainNet)
-{
-    return mainnet ? MAINNET_REQUIRE_HEIGHT : TESTNET_REQUIRE_HEIGHT;
-}
-
-static inline int GetRequireVersion(const bool mainnet = fMainNet)
-{
-    return mainnet ? MAINNET_REQUIRE_VERSION : TESTNET_REQUIRE_VERSION;
-}
+struct CDbFileNode;
 
 std::string static inline ToString(const CService &ip) {
   std::string str = ip.ToString();
@@ -78,6 +91,36 @@ public:
   )
 
   friend class CAddrInfo;
+  friend class CAddrDb;
+};
+
+// Round trip times measured by one probe, in milliseconds (-1 if not measured)
+struct CProbeRtt {
+  int nConnect;   // TCP connect
+  int nHandshake; // from sending our version message until theirs arrived
+  int nPing;      // ping/pong, on a keep-alive link
+  CProbeRtt() : nConnect(-1), nHandshake(-1), nPing(-1) {}
+};
+
+// Exponentially weighted averages of a node's round trip times, in milliseconds (negative
+// if not measured yet), and of how far samples deviate from them.
+class CAddrRtt {
+public:
+  float connect;
+  float handshake;
+  float ping;
+  float jitter;
+
+  CAddrRtt() : connect(-1), handshake(-1), ping(-1), jitter(-1) {}
+
+  void Update(const CProbeRtt &rtt);
+
+  // lower is better: handshake (or else ping, or else connect) time plus twice the jitter
+  double GetScore() const {
+    double base = handshake >= 0 ? handshake : ping >= 0 ? ping : connect;
+    if (base < 0) return RTT_UNKNOWN;
+    return base + 2 * std::max(jitter, 0.0f);
+  }
 };
 
 class CAddrReport {
@@ -86,10 +129,11 @@ public:
   int clientVersion;
   int blocks;
   double uptime[5];
-  std::string clientSubVersion;
+  uint32_t clientSubVersion; // interned, see GetSubVersion()
   int64_t lastSuccess;
   bool fGood;
   uint64_t services;
+  CAddrRtt rtt;
 };
 
 
@@ -101,6 +145,7 @@ private:
   int64 ourLastTry;
   int64 ourLastSuccess;
   int64 ignoreTill;
+  int64 lastChange; // time of the first try of the current run of equal outcomes, 0 if unknown
   CAddrStat stat2H;
   CAddrStat stat8H;
   CAddrStat stat1D;
@@ -110,12 +155,29 @@ private:
   int blocks;
   int total;
   int success;
-  std::string clientSubVersion;
+  uint32_t clientSubVersion; // interned, see GetSubVersion()
+  CAddrRtt rtt;
+  int64 remoteLastSuccess; // latest success a federation peer reported, 0 if none (not serialized, see CAddrDb::Remote_)
+  int64 nClaimAfter; // when an untried node of another cluster member becomes ours to probe, 0 if not passed over yet (not serialized, see CAddrDb::Claim_)
+  uint64_t nCluster; // identity of the node that answered the last good probe (see SetClusterKeys), 0 if none (not serialized)
+  int nRevisit;  // seconds after ourLastTry the node is due again (see CAddrDb::GetRevisit_), 0 for MIN_RETRY (not serialized)
+  int nSchedule; // handle in CAddrDb::schedule, -1 if not scheduled (not serialized)
+  int nGoodPos;  // position in CAddrDb::goodId[services], -1 if not good (not serialized)
+  int nNodePos;  // position in CAddrDb::vNodes (not serialized)
+  int nSource;   // index in CAddrDb::vSources of the peer we learned this node from, 0 if unknown
+  int nUnkPos;   // position in CAddrDb::unkId, -1 if not unknown (not serialized)
+  int nWarmPos;  // position in CAddrDb::warmId, WARM_INFLIGHT while being revalidated, -1 otherwise (not serialized)
+  int nFlight;   // 1 while handed to a crawler by Get_, FLIGHT_PARKED while held back for its network group, 0 otherwise (not serialized)
 public:
-  CAddrInfo() : services(0), lastTry(0), ourLastTry(0), ourLastSuccess(0), ignoreTill(0), clientVersion(0), blocks(0), total(0), success(0) {}
+  CAddrInfo() : services(0), lastTry(0), ourLastTry(0), ourLastSuccess(0), ignoreTill(0), lastChange(0), clientVersion(0), blocks(0), total(0), success(0), clientSubVersion(0), remoteLastSuccess(0), nClaimAfter(0), nCluster(0), nRevisit(0), nSchedule(-1), nGoodPos(-1), nNodePos(-1), nSource(0), nUnkPos(-1), nWarmPos(-1), nFlight(0) {}
   
-  CAddrReport GetReport() const {
+  CAddrReport GetReport(const CNetParams &net) const {
     CAddrReport ret;
+    GetReport(net, ret);
+    return ret;
+  }
+
+  void GetReport(const CNetParams &net, CAddrReport &ret) const {
     ret.ip = ip;
     ret.clientVersion = clientVersion;
     ret.clientSubVersion = clientSubVersion;
@@ -126,17 +188,17 @@ public:
     ret.uptime[3] = stat1W.reliability;
     ret.uptime[4] = stat1M.reliability;
     ret.lastSuccess = ourLastSuccess;
-    ret.fGood = IsGood();
+    ret.fGood = IsGood(net);
     ret.services = services;
-    return ret;
+    ret.rtt = rtt;
   }
   
-  bool IsGood() const {
-    if (ip.GetPort() != GetDefaultPort()) return false;
+  bool IsGood(const CNetParams &net) const {
+    if (ip.GetPort() != net.nDefaultPort) return false;
     if (!(services & NODE_NETWORK)) return false;
     if (!ip.IsRoutable()) return false;
-    if (clientVersion && clientVersion < GetRequireVersion()) return false;
-    if (blocks && blocks < GetRequireHeight()) return false;
+    if (clientVersion && clientVersion < net.nRequireVersion) return false;
+    if (blocks && blocks < net.nRequireHeight) return false;
 
     if (total <= 3 && success * 2 >= total) return true;
 
@@ -148,16 +210,16 @@ public:
     
     return false;
   }
-  int GetBanTime() const {
-    if (IsGood()) return 0;
+  int GetBanTime(const CNetParams &net) const {
+    if (IsGood(net)) return 0;
     if (clientVersion && clientVersion < 31900) { return 604800; }
     if (stat1M.reliability - stat1M.weight + 1.0 < 0.15 && stat1M.count > 32) { return 30*86400; }
     if (stat1W.reliability - stat1W.weight + 1.0 < 0.10 && stat1W.count > 16) { return 7*86400; }
     if (stat1D.reliability - stat1D.weight + 1.0 < 0.05 && stat1D.count > 8) { return 1*86400; }
     return 0;
   }
-  int GetIgnoreTime() const {
-    if (IsGood()) return 0;
+  int GetIgnoreTime(const CNetParams &net) const {
+    if (IsGood(net)) return 0;
     if (stat1M.reliability - stat1M.weight + 1.0 < 0.20 && stat1M.count > 2) { return 10*86400; }
     if (stat1W.reliability - stat1W.weight + 1.0 < 0.16 && stat1W.count > 2)  { return 3*86400; }
     if (stat1D.reliability - stat1D.weight + 1.0 < 0.12 && stat1D.count > 2)  { return 8*3600; }
@@ -165,9 +227,27 @@ public:
     return 0;
   }
   
-  void Update(bool good);
+  void Update(bool good, int64 now, const CNetParams &net);
+
+  // how predictable the outcome of the next probe is, from 0 (a coin toss) to 1 (certain)
+  double GetStability() const;
+
+  // when the node is due to be revisited: a success reported by a federation peer since
+  // our own last try postpones that by up to one more interval
+  int64 GetNextTry() const {
+    int64 nInterval = std::max(nRevisit, MIN_RETRY);
+    int64 nNext = ourLastTry + nInterval;
+    if (remoteLastSuccess > ourLastTry)
+      nNext = std::min(remoteLastSuccess, ourLastTry + nInterval) + nInterval;
+    return std::max(nNext, ignoreTill);
+  }
+
+  // conversion from/to the on-disk record (see dbfile.h)
+  void ToDbNode(CDbFileNode &rec) const;
+  void FromDbNode(const CDbFileNode &rec);
   
   friend class CAddrDb;
+  friend class CAddrReportCursor;
   
   IMPLEMENT_SERIALIZE (
     unsigned char version = 4;
@@ -192,8 +272,12 @@ public:
       READWRITE(total);
       READWRITE(success);
       READWRITE(clientVersion);
-      if (version >= 2)
-          READWRITE(clientSubVersion);
+      if (version >= 2) {
+          std::string strSubVersion = GetSubVersion(clientSubVersion);
+          READWRITE(strSubVersion);
+          if (fRead)
+              *((uint32_t*)(&clientSubVersion)) = InternSubVersion(strSubVersion);
+      }
       if (version >= 3)
           READWRITE(blocks);
       if (version >= 4)
@@ -210,6 +294,41 @@ public:
   int nNew;
   int nGood;
   int nAge;
+  int nMaxNodes;     // cap on available nodes (0 if unlimited)
+  int64 nEvicted;    // nodes evicted to stay below the cap, since startup
+  int64 nMemory;     // estimated memory used by the database, in bytes
+  int nSources;      // peers we learned nodes from
+  int64 nOverQuota;  // new nodes dropped by the ingestion quotas, since startup
+  int64 nFirstTried; // nodes tried for the first time, since startup
+  int64 nFirstGood;  // of which were reachable
+  int nTimeToGood[5]; // seconds after startup until 1, 10, 100, 1000 and 10000 nodes were good (-1: not yet)
+  int nWarmTotal;    // previously good nodes to revalidate after loading
+  int nWarmDone;     // of which were tried again
+  int nWarmGood;     // of which are good again
+  int nWarmMillis[4]; // ms after the warm start until the first node was reconfirmed, and half, 90% and all were tried (-1: not yet)
+  int64 nDeferred;   // picks left to the cluster member owning the node (see CCrawlPartition)
+  int64 nTakenOver;  // nodes probed after their owner did not report on them in time
+  int nClusters;     // nodes seen under several addresses (see SetClusterKeys)
+  int64 nClusterDeferred; // probes of an address put off as another address of the node was just confirmed
+};
+
+// How the adaptive revisit intervals work out (see CAddrDb::SetRevisit)
+struct CRevisitStats {
+  double dProbeRate; // revisits per hour the schedule currently asks for
+  int nLate;         // seconds revisits are made after they became due, on average
+  int nStale;        // good nodes last tried longer ago than the staleness target
+  int64 nOldest;     // seconds since the least recently tried good node was tried
+};
+
+// How probes are spread over network groups (see CAddrDb::SetGroupFlight)
+struct CGroupStats {
+  int nGroups;        // network groups with nodes being probed
+  int nFull;          // of which are at the cap
+  int nInFlight;      // nodes being probed (not counting revalidation at startup)
+  int nParked;        // due nodes held back as their group is at the cap
+  int64 nParkedTotal; // times a due node was held back, since startup
+  int64 nSkipped;     // untried nodes passed over for the same reason, since startup
+  std::vector<std::pair<int, CService> > vTop; // nodes waiting (untried or held back) in the groups with the most, and one of them
 };
 
 struct CServiceResult {
@@ -218,10 +337,87 @@ struct CServiceResult {
     int nBanTime;
     int nHeight;
     int nClientV;
-    std::string strClientV;
+    uint32_t nClientSV; // interned
+    uint64_t nServices; // as announced in the version message
+    CProbeRtt rtt;
+    uint64_t nCluster;  // identity of the node that answered, from its nonce (see SetClusterKeys), 0 if none
+    CService addrFrom;  // the address it claims as its own
+    uint64_t nClusterFrom; // its identity from that address, 0 if not routable
     int64 ourLastSuccess;
 };
 
+// Outcome of a probe, as exchanged between federated seeders (see federation.h)
+struct CRemoteResult {
+  CService service;
+  int64 nTime;        // when the probe was made (the prober's clock)
+  bool fGood;
+  uint64_t nServices; // announced services (0 if the probe failed)
+  int nClientV;
+  int nHeight;
+  std::string strClientSV;
+
+  IMPLEMENT_SERIALIZE (
+    READWRITE(service);
+    READWRITE(nTime);
+    READWRITE(fGood);
+    READWRITE(nServices);
+    READWRITE(nClientV);
+    READWRITE(nHeight);
+    READWRITE(strClientSV);
+  )
+};
+
+// Identity of the node behind an address, from its version message: the address it claims
+// as its own, or else its nonce, together with its version, subversion and services.
+// Addresses with the same key are taken to be one node (a cluster): only one of them is
+// probed per interval, and DNS answers carry at most one of them. Anyone can claim any
+// address, so that key is only used once we reached a node with it there (see
+// CAddrDb::ClusterKey_). Nodes that pick a fresh nonce per connection get a key of their
+// own every time, so they are then simply not clustered. Fills in res.nCluster,
+// res.addrFrom and res.nClusterFrom from the version, subversion and services in res.
+void SetClusterKeys(CServiceResult &res, uint64 nNonce, const CService &addrFrom);
+
+// What the scoring function for untried nodes gets to see about a candidate
+struct CProbeCandidate {
+  int64 nAge;           // seconds since the node was last advertised
+  uint64_t services;    // advertised service flags
+  bool fDefaultPort;    // only nodes on the default port can become good
+  int nGroupNodes;      // known nodes in its network group (see GetGroupKey)
+  double sourceQuality; // see CAddrSource, 1/2 if unknown
+};
+
+// Higher scores are probed first. Must be cheap: Get_ scores several candidates per pick.
+typedef double (*ProbeScoreFunc)(const CProbeCandidate &cand);
+
+// Prefers recently advertised nodes on the default port with NODE_NETWORK, from
+// sparsely populated network groups and good sources.
+double DefaultProbeScore(const CProbeCandidate &cand);
+
+// A peer that told us about nodes (via getaddr). Its quality is the fraction of those that
+// were reachable when first tried, starting at 1/2 without evidence.
+struct CAddrSource {
+  CService ip;
+  int64 nAdded;     // new nodes accepted from this source
+  int nTried;       // of which were tried
+  int nGood;        // of which were reachable on the first try
+  int nRef;         // nodes in the database with this source
+  int64 nQuotaEpoch; // quota interval that nQuotaUsed refers to (-1 if the entry is free, see ExpireSources_)
+  int nQuotaUsed;   // new nodes accepted in that interval
+
+  CAddrSource() : nAdded(0), nTried(0), nGood(0), nRef(0), nQuotaEpoch(0), nQuotaUsed(0) {}
+  double GetQuality() const { return (nGood + 1.0) / (nTried + 2.0); }
+};
+
+// The nodes of a network group being probed, and the due ones waiting for their turn
+// (see CAddrDb::SetGroupFlight).
+struct CGroupFlight {
+  int nInFlight;           // handed to crawlers by Get_ and not reported on yet
+  int nParked;             // nodes in vParked still held back
+  std::deque<int> vParked; // ids of the held back nodes, oldest first (and of some released or dropped since)
+
+  CGroupFlight() : nInFlight(0), nParked(0) {}
+};
+
 //             seen nodes
 //            /          \
 // (a) banned nodes       available nodes--------------
@@ -233,85 +429,333 @@ struct CServiceResult {
 class CAddrDb {
 private:
   mutable CCriticalSection cs;
+  const CNetParams *pNet; // the network the nodes belong to
   int nId; // number of address id's
   std::map<int, CAddrInfo> idToInfo; // map address id to address info (b,c,d,e)
-  std::map<CService, int> ipToId; // map ip to id (b,c,d,e)
-  std::deque<int> ourId; // sequence of tried nodes, in order we have tried connecting to them (c,d)
-  std::set<int> unkId; // set of nodes not yet tried (b)
-  std::set<int> goodId; // set of good nodes  (d, good e)
-  int nDirty;
+  CAddrMap<int> ipToId; // map ip to id (b,c,d,e)
+  CTimingWheel<int> schedule; // tried nodes, by the time they are due to be revisited (c,d)
+  CTimingWheel<CService> unban; // ban expiry times (entries for bans lifted otherwise are skipped)
+  std::vector<CAddrInfo*> unkId; // nodes not yet tried (b), as a dense vector for sampling
+  std::map<uint64_t, std::vector<CAddrInfo*> > goodId; // good nodes (d, good e), as dense vectors per combination of service flags
+  int nGood; // number of good nodes
+  std::vector<CAddrInfo*> vNodes; // all nodes in idToInfo, for sampling (b,c,d,e)
+  std::unordered_map<uint64_t, int> mapGroupCount; // nodes per network group (see GetGroupKey)
+  int nMaxNodes; // evict nodes beyond this many (0 if unlimited)
+  int64 nEvicted;
+  std::vector<CAddrSource> vSources; // sources of nodes, [0] stands for unknown (seeds, manual adds)
+  CAddrMap<int> sourceToId; // map source ip to its index in vSources
+  std::vector<int> vFreeSources; // indexes of expired entries in vSources, for reuse
+  std::unordered_map<uint64_t, int> mapGroupQuota; // new nodes accepted per network group in this quota interval
+  int64 nQuotaEpoch; // current quota interval (time / ADD_QUOTA_INTERVAL)
+  int nSourceQuota; // new nodes accepted per source and interval, for a source of quality 1/2 (0 if unlimited)
+  int nGroupQuota; // new nodes accepted per network group and interval (0 if unlimited)
+  int64 nOverQuota;
+  ProbeScoreFunc pProbeScore; // ranks untried nodes (see PickUnknown_)
+  int64 nFirstTried; // first tries of nodes since startup
+  int64 nFirstGood;  // of which succeeded
+  int64 nStartTime;
+  int nTimeToGood[5]; // seconds after startup at which 1, 10, 100, 1000 and 10000 nodes were good, -1 if not yet
+  std::vector<CAddrInfo*> warmId; // nodes that were good when loaded, not yet revalidated (see BeginWarmStart)
+  int nWarmTotal; // size of warmId after loading
+  int nWarmDone;  // revalidated (or dropped) since
+  int nWarmGood;  // of which were good again
+  int64 nWarmStart; // time the warm start began, in microseconds
+  int nWarmMillis[4]; // see CAddrDbStats
+  CCrawlPartition *pPartition; // our share of the cluster's crawl (NULL: crawl everything)
+  int64 nPartitionStart; // when pPartition was set (owners get their grace period from then on)
+  int64 nDeferred;
+  int64 nTakenOver;
+  int nRttBias; // good nodes compared per DNS answer slot, the fastest winning (1: uniform)
+  std::unordered_map<uint64_t, std::vector<int> > mapCluster; // ids of nodes by nCluster (non-zero only)
+  int nClusters; // entries of mapCluster with more than one node
+  int64 nClusterDeferred;
+  int nRevisitMax; // longest revisit interval, 0 to revisit every node after MIN_RETRY
+  int nStaleMax;   // staleness target: good nodes are to be tried at least this often
+  double dLate;    // average lateness of revisits (seconds), see CRevisitStats
+  std::unordered_map<uint64_t, CGroupFlight> mapGroupFlight; // network groups with nodes in flight or held back
+  int nGroupFlight; // nodes of one network group probed at a time (0 if unlimited)
+  int nParked;      // due nodes held back in mapGroupFlight
+  int64 nParkedTotal;
+  int64 nGroupSkipped;
+  int64 nDirty; // number of changes made
+  int64 nSnapDirty; // value of nDirty at the last snapshot
+  CAddrJournal *journal; // log of changes since the last snapshot (may be NULL)
+  uint64 nSnapSeq; // journal sequence number covered by the last snapshot
+  std::atomic<int64> nMaxStall; // longest time (in microseconds) a crawler waited for the lock
   
 protected:
   // internal routines that assume proper locks are acquired
-  void Add_(const CAddress &addr, bool force);   // add an address
+  void Add_(const CAddress &addr, bool force, int64 now, int nSource = 0, bool fQuota = false);   // add an address (learned from vSources[nSource], subject to quotas if fQuota)
   bool Get_(CServiceResult &ip, int& wait);      // get an IP to test (must call Good_, Bad_, or Skipped_ on result afterwards)
   bool GetMany_(std::vector<CServiceResult> &ips, int max, int& wait);
-  void Good_(const CService &ip, int clientV, std::string clientSV, int blocks); // mark an IP as good (must have been returned by Get_)
-  void Bad_(const CService &ip, int ban);  // mark an IP as bad (and optionally ban it) (must have been returned by Get_)
+  void Good_(const CService &ip, int clientV, uint32_t clientSV, int blocks, int64 now, const CProbeRtt &rtt = CProbeRtt()); // mark an IP as good (must have been returned by Get_)
+  void Bad_(const CService &ip, int ban, int64 now);  // mark an IP as bad (and optionally ban it) (must have been returned by Get_)
   void Skipped_(const CService &ip);       // mark an IP as skipped (must have been returned by Get_)
+  bool Remote_(const CRemoteResult &res, int nSource, int64 now, int nMember = -1); // merge another seeder's probe outcome (from cluster member nMember, if >= 0); false if it told us nothing
+  bool Claim_(CAddrInfo &info, int64 now); // whether to probe a node now, or leave it to its owner in the cluster
   int Lookup_(const CService &ip);         // look up id of an IP
   void GetIPs_(std::set<CNetAddr>& ips, uint64_t requestedFlags, int max, const bool *nets); // get a random set of IPs (shared lock only)
+  void Replay_(unsigned char nType, int64 nTime, CDataStream &ssBody); // apply a journal record
+  void CutJournal_(); // start a new journal file for changes after the next snapshot
+  void Schedule_(int id); // (re)insert a tried node into the schedule at its next try time
+  void Unschedule_(int id);
+  void Ban_(const CService &ip, int64 nUntil);
+  void Expire_(int64 now); // advance the schedule, lift expired bans and ignores
+  void Index_(int id, CAddrInfo &info); // add a new node in idToInfo to ipToId, vNodes and mapGroupCount
+  void Remove_(int id); // drop a node from all indexes
+  bool GetEvictScore_(const CAddrInfo &info, int64 now, double &score); // false if not evictable
+  void Evict_(const CService &ip, int64 now);
+  void Trim_(int64 now); // evict until below nMaxNodes
+  int GetSource_(const CService &ip); // index of a source in vSources (added if new)
+  void ExpireSources_(int nKeep); // drop sources that are no longer of use (except vSources[nKeep])
+  bool TakeQuota_(int nSource, const CService &ip, int64 now); // false if a new node from this source is over quota
+  void NoteResult_(const CAddrInfo &info, bool fGood); // update first-try statistics (of its source)
+  void SetUnknown_(CAddrInfo &info);   // add to unkId (if not in it yet)
+  void UnsetUnknown_(CAddrInfo &info); // remove from unkId (if in it)
+  CAddrInfo *PickUnknown_(int64 now);  // choose an untried node to probe
+  void SetWarm_(CAddrInfo &info);      // queue a node that was good when loaded for revalidation
+  CAddrInfo *TakeWarm_();              // take the next node to revalidate (NULL if none)
+  void NoteWarm_(CAddrInfo &info, bool fGood); // a revalidation finished (or the node was dropped)
+  void TakeKeep_(std::vector<CService> &ips, int max, int64 now); // take good nodes for the keep-alive tier
+  void Release_(const CService &ip, bool fNow, int64 now); // schedule a node taken by TakeKeep_ again (due at once if fNow)
+  void SetCluster_(int id, CAddrInfo &info, uint64_t nCluster); // move a node to another cluster (0: none)
+  uint64_t ClusterKey_(const CServiceResult &res); // the key of a probed node to go by (see SetClusterKeys)
+  bool GroupFull_(const CAddrInfo &info) const; // whether the node's network group has nGroupFlight nodes in flight
+  void Dispatch_(CAddrInfo &info); // count a node handed out by Get_ against its network group
+  void Park_(int id, CAddrInfo &info); // hold back a due node until its network group has room
+  void Land_(CAddrInfo &info); // a node handed out or held back was reported on or dropped; lets the next one of its group go
+  const std::vector<int> *GetCluster_(const CAddrInfo &info) const; // the ids in its cluster, if it is a plausible one (2..CLUSTER_MAX)
+  bool Covered_(const CAddrInfo &info, int64 now) const; // whether another address of the node was confirmed since this one was tried
+  int GetRevisit_(const CAddrInfo &info) const; // seconds after its last try a node should be tried again
+  void SetGood_(CAddrInfo &info);   // add to goodId (if not in it yet)
+  void UnsetGood_(CAddrInfo &info);       // remove from goodId (if in it)
+
+  void NoteStall(int64 nStart) {
+    int64 nStall = GetTimeMicros() - nStart;
+    int64 nMax = nMaxStall;
+    while (nStall > nMax && !nMaxStall.compare_exchange_weak(nMax, nStall)) {}
+  }
 
 public:
-  std::map<CService, time_t> banned; // nodes that are banned, with their unban time (a)
+  CAddrMap<time_t> banned; // nodes that are banned, with their unban time (a)
+
+  CAddrDb() : pNet(&MainNetParams()), nId(0), nGood(0), nMaxNodes(0), nEvicted(0), vSources(1), nQuotaEpoch(0), nSourceQuota(0), nGroupQuota(0), nOverQuota(0), pProbeScore(DefaultProbeScore), nFirstTried(0), nFirstGood(0), nStartTime(time(NULL)), nWarmTotal(0), nWarmDone(0), nWarmGood(0), nWarmStart(0), pPartition(NULL), nPartitionStart(0), nDeferred(0), nTakenOver(0), nRttBias(1), nClusters(0), nClusterDeferred(0), nRevisitMax(0), nStaleMax(0), dLate(0), nGroupFlight(0), nParked(0), nParkedTotal(0), nGroupSkipped(0), schedule(time(NULL)), unban(time(NULL)), nDirty(0), nSnapDirty(0), journal(NULL), nSnapSeq(0), nMaxStall(0) {
+    std::fill(nTimeToGood, nTimeToGood + 5, -1);
+    std::fill(nWarmMillis, nWarmMillis + 4, -1);
+  }
+
+  // The network of the nodes, which decides which are good (MainNetParams by default).
+  // Only to be set before adding nodes.
+  void SetNetParams(const CNetParams &net) {
+    CRITICAL_BLOCK(cs)
+      pNet = &net;
+  }
+
+  const CNetParams &GetNetParams() const {
+    return *pNet;
+  }
+
+  // Limit the number of available nodes; beyond it, Add() evicts unknown or long-dead
+  // nodes (0 means unlimited).
+  void SetMaxNodes(int n) {
+    CRITICAL_BLOCK(cs)
+      nMaxNodes = n;
+  }
+
+  // Limit the new nodes accepted per ADD_QUOTA_INTERVAL from one source (scaled by its
+  // quality, see CAddrSource) and in one network group (0 means unlimited).
+  void SetQuotas(int nSourceQuotaIn, int nGroupQuotaIn) {
+    CRITICAL_BLOCK(cs) {
+      nSourceQuota = nSourceQuotaIn;
+      nGroupQuota = nGroupQuotaIn;
+    }
+  }
+
+  // only probe our share of the nodes (see CCrawlPartition), NULL to probe all
+  void SetPartition(CCrawlPartition *pPartitionIn) {
+    CRITICAL_BLOCK(cs) {
+      pPartition = pPartitionIn;
+      nPartitionStart = time(NULL);
+    }
+  }
+
+  // Bias DNS answers towards nodes with low, stable round trip times (see CAddrRtt): each
+  // address handed out is the best of n good nodes drawn at random (1 means no bias).
+  void SetRttBias(int n) {
+    CRITICAL_BLOCK(cs)
+      nRttBias = std::max(n, 1);
+  }
+
+  // Revisit nodes that behave predictably less often (see GetRevisit_): after up to
+  // nMax seconds, but good ones at least every nStale seconds, less the time revisits
+  // currently run late. Only applies to intervals computed from then on. 0 means every
+  // node is revisited after MIN_RETRY.
+  void SetRevisit(int nMax, int nStale) {
+    CRITICAL_BLOCK(cs) {
+      nRevisitMax = nMax;
+      nStaleMax = nStale;
+    }
+  }
+
+  // Probe at most n nodes of one network group (see GetGroupKey) at a time, so addresses
+  // arriving in bulk from one provider's range cannot take over the crawl: its other due
+  // nodes wait, and are let go one by one as its probes finish, behind the nodes of other
+  // groups due by then. Untried nodes of a group at the cap are passed over. 0 means unlimited.
+  void SetGroupFlight(int n) {
+    CRITICAL_BLOCK(cs)
+      nGroupFlight = std::max(n, 0);
+  }
+
+  // replace the ranking of untried nodes (DefaultProbeScore)
+  void SetProbeScore(ProbeScoreFunc pFunc) {
+    CRITICAL_BLOCK(cs)
+      pProbeScore = pFunc;
+  }
+
+  // quality of a source (see CAddrSource), 1/2 if unknown
+  double GetSourceQuality(const CService &source) {
+    SHARED_CRITICAL_BLOCK(cs) {
+      const int *pId = sourceToId.Find(source);
+      return pId ? vSources[*pId].GetQuality() : 0.5;
+    }
+  }
+
+  int64 GetDirty() const { return nDirty - nSnapDirty; } // changes since the last snapshot
+  int64 GetChanges() const { return nDirty; }
+  uint64 GetSnapshotSeq() const { return nSnapSeq; }
+  CAddrJournal *GetJournal() const { return journal; }
+
+  // start logging changes to journal (after the snapshot is loaded and the old journal replayed)
+  void SetJournal(CAddrJournal *journalIn) {
+    CRITICAL_BLOCK(cs)
+      journal = journalIn;
+  }
+
+  // Replay a journal file on top of the loaded snapshot, skipping records already covered
+  // by it. Returns the size of the valid prefix of the file; nSeqLast is raised to the
+  // highest sequence number seen.
+  long ReplayJournal(const std::string &strFile, int &nReplayed, uint64 &nSeqLast);
+
+  // Write a snapshot in the version 6 format (see dbfile.h), under a shared lock.
+  // This also starts a new journal file, as all changes so far are covered by the snapshot.
+  bool Save(const std::string &strFile);
+  bool Save_(const std::string &strFile); // no locking, only for a frozen copy (see ForkSnapshot)
+  int SampleIPs_(addr_t *addr, int max, uint64_t requestedFlags, const int *quota); // see SampleIPs (shared lock or frozen copy)
+
+  // Fork a child process that sees a frozen, copy-on-write image of the database, so it can
+  // be serialized and reported on without holding any lock. The lock is only held (shared)
+  // across the fork itself. If fCut, the journal is rotated at the same point, so the
+  // child's snapshot covers exactly the old journal. Returns like fork().
+  pid_t ForkSnapshot(bool fCut);
+
+  // Run f under the shared lock, so it can use the interfaces meant for a frozen copy
+  // (CAddrReportCursor, SampleIPs_) on the live database; for when fork fails.
+  template<typename F>
+  void ReadLocked(F f) const {
+    SHARED_CRITICAL_BLOCK(cs)
+      f();
+  }
+
+  // longest time a crawler had to wait for the database lock since the last call
+  int64 GetMaxStall() { return nMaxStall.exchange(0); }
+  // Load a version 5, 6 or 7 snapshot. Returns 1 on success, 0 if the file is not in that
+  // format (use the legacy deserialization instead), -1 on error (see strError).
+  int Load(const std::string &strFile, std::string &strError);
 
   void GetStats(CAddrDbStats &stats) {
     SHARED_CRITICAL_BLOCK(cs) {
       stats.nBanned = banned.size();
       stats.nAvail = idToInfo.size();
-      stats.nTracked = ourId.size();
-      stats.nGood = goodId.size();
+      stats.nTracked = schedule.size();
+      stats.nGood = nGood;
       stats.nNew = unkId.size();
-      if (idToInfo[ourId[0]].ourLastTry)
-          stats.nAge = time(NULL) - idToInfo[ourId[0]].ourLastTry;
+      stats.nMaxNodes = nMaxNodes;
+      stats.nEvicted = nEvicted;
+      stats.nSources = sourceToId.size();
+      stats.nOverQuota = nOverQuota;
+      stats.nFirstTried = nFirstTried;
+      stats.nFirstGood = nFirstGood;
+      std::copy(nTimeToGood, nTimeToGood + 5, stats.nTimeToGood);
+      stats.nWarmTotal = nWarmTotal;
+      stats.nWarmDone = nWarmDone;
+      stats.nWarmGood = nWarmGood;
+      std::copy(nWarmMillis, nWarmMillis + 4, stats.nWarmMillis);
+      stats.nDeferred = nDeferred;
+      stats.nTakenOver = nTakenOver;
+      stats.nClusters = nClusters;
+      stats.nClusterDeferred = nClusterDeferred;
+      // rough per-entry costs of the containers (tree and hash nodes plus allocator overhead)
+      stats.nMemory = idToInfo.size() * (sizeof(CAddrInfo) + 56) + ipToId.size() * 48 + unkId.size() * 8 +
+                      schedule.size() * 24 + nGood * 8 + banned.size() * 80 + mapGroupCount.size() * 48 +
+                      vSources.size() * sizeof(CAddrSource) + sourceToId.size() * 48 + mapCluster.size() * 80 +
+                      mapGroupFlight.size() * 640;
+      int h = schedule.First();
+      if (h >= 0 && idToInfo[schedule.Get(h)].ourLastTry)
+          stats.nAge = time(NULL) - idToInfo[schedule.Get(h)].ourLastTry;
       else
           stats.nAge = 0;
     }
   }
 
+  void GetRevisitStats(CRevisitStats &stats) const;
+  void GetGroupStats(CGroupStats &stats, int nTop) const; // with the nTop groups with the most nodes waiting
+
   void ResetIgnores() {
       for (std::map<int, CAddrInfo>::iterator it = idToInfo.begin(); it != idToInfo.end(); it++) {
            (*it).second.ignoreTill = 0;
+           if ((*it).second.nSchedule >= 0)
+               Schedule_((*it).first);
       }
   }
+
+  // called periodically by the sweeper thread, so crawlers rarely have to do this work in Get_;
+  // returns the number of nodes waiting to be probed
+  int Sweep() {
+    CRITICAL_BLOCK(cs) {
+      Expire_(time(NULL));
+      return unkId.size() + schedule.GetReady() + warmId.size();
+    }
+    return 0;
+  }
   
   std::vector<CAddrReport> GetAll() {
     std::vector<CAddrReport> ret;
     SHARED_CRITICAL_BLOCK(cs) {
-      for (std::deque<int>::const_iterator it = ourId.begin(); it != ourId.end(); it++) {
-        const CAddrInfo &info = idToInfo[*it];
+      for (int h = schedule.First(); h >= 0; h = schedule.Next(h)) {
+        const CAddrInfo &info = idToInfo[schedule.Get(h)];
         if (info.success > 0) {
-          ret.push_back(info.GetReport());
+          ret.push_back(info.GetReport(*pNet));
         }
       }
     }
     return ret;
   }
   
-  // serialization code
+  // legacy serialization code (read at startup and converted; snapshots are written with Save())
   // format:
-  //   nVersion (0 for now)
+  //   nVersion (1 for now)
+  //   nSnapSeq (journal sequence number covered by this snapshot, version >= 1)
   //   n (number of ips in (b,c,d))
   //   CAddrInfo[n]
   //   banned
   // acquires a shared lock (this does not suffice for read mode, but we assume that only happens at startup, single-threaded)
   // this way, dumping does not interfere with GetIPs_, which is called from the DNS thread
   IMPLEMENT_SERIALIZE (({
-    int nVersion = 0;
+    int nVersion = 1;
     READWRITE(nVersion);
     SHARED_CRITICAL_BLOCK(cs) {
+      if (nVersion >= 1)
+        READWRITE(nSnapSeq);
       if (fWrite) {
         CAddrDb *AddressDb = const_cast<CAddrDb*>(this);
-        int n = ourId.size() + unkId.size();
+        int n = schedule.size() + unkId.size();
         READWRITE(n);
-        for (std::deque<int>::const_iterator it = ourId.begin(); it != ourId.end(); it++) {
-          std::map<int, CAddrInfo>::iterator ci = AddressDb->idToInfo.find(*it);
-          READWRITE((*ci).second);
-        }
-        for (std::set<int>::const_iterator it = unkId.begin(); it != unkId.end(); it++) {
-          std::map<int, CAddrInfo>::iterator ci = AddressDb->idToInfo.find(*it);
+        for (int h = schedule.First(); h >= 0; h = schedule.Next(h)) {
+          std::map<int, CAddrInfo>::iterator ci = AddressDb->idToInfo.find(schedule.Get(h));
           READWRITE((*ci).second);
         }
+        for (std::vector<CAddrInfo*>::const_iterator it = unkId.begin(); it != unkId.end(); it++)
+          READWRITE(**it);
       } else {
         CAddrDb *AddressDb = const_cast<CAddrDb*>(this);
         AddressDb->nId = 0;
@@ -320,36 +764,65 @@ public:
         for (int i=0; i<n; i++) {
           CAddrInfo info;
           READWRITE(info);
-          if (!info.GetBanTime()) {
+          if (!info.GetBanTime(*pNet)) {
             int id = AddressDb->nId++;
             AddressDb->idToInfo[id] = info;
-            AddressDb->ipToId[info.ip] = id;
+            AddressDb->Index_(id, AddressDb->idToInfo[id]);
             if (info.ourLastTry) {
-              AddressDb->ourId.push_back(id);
-              if (info.IsGood()) AddressDb->goodId.insert(id);
+              AddressDb->Schedule_(id);
+              if (info.IsGood(*pNet)) AddressDb->SetWarm_(AddressDb->idToInfo[id]);
             } else {
-              AddressDb->unkId.insert(id);
+              AddressDb->SetUnknown_(AddressDb->idToInfo[id]);
             }
           }
         }
         AddressDb->nDirty++;
       }
-      READWRITE(banned);
+      std::map<CService, time_t> mapBanned;
+      if (fWrite)
+        banned.ForEach([&](const CService &ip, time_t nUntil) { mapBanned[ip] = nUntil; });
+      READWRITE(mapBanned);
+      if (fRead) {
+        CAddrDb *AddressDb = const_cast<CAddrDb*>(this);
+        for (std::map<CService, time_t>::const_iterator it = mapBanned.begin(); it != mapBanned.end(); it++)
+          AddressDb->Ban_((*it).first, (*it).second);
+      }
     }
   });)
 
   void Add(const CAddress &addr, bool fForce = false) {
-    CRITICAL_BLOCK(cs)
-      Add_(addr, fForce);
+    int64 now = time(NULL);
+    CRITICAL_BLOCK(cs) {
+      Add_(addr, fForce, now);
+      Trim_(now);
+    }
   }
   void Add(const std::vector<CAddress> &vAddr, bool fForce = false) {
-    CRITICAL_BLOCK(cs)
+    int64 now = time(NULL);
+    int64 nStart = GetTimeMicros();
+    CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
       for (int i=0; i<vAddr.size(); i++)
-        Add_(vAddr[i], fForce);
+        Add_(vAddr[i], fForce, now);
+      Trim_(now);
+    }
   }
-  void Good(const CService &addr, int clientVersion, std::string clientSubVersion, int blocks) {
+  // add addresses learned from a peer, subject to the ingestion quotas
+  void Add(const std::vector<CAddress> &vAddr, const CService &source) {
+    int64 now = time(NULL);
+    int64 nStart = GetTimeMicros();
+    CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
+      int nSource = GetSource_(source);
+      for (int i=0; i<vAddr.size(); i++)
+        Add_(vAddr[i], false, now, nSource, true);
+      Trim_(now);
+    }
+  }
+  void Good(const CService &addr, int clientVersion, const std::string &clientSubVersion, int blocks) {
+    uint32_t clientSV = InternSubVersion(clientSubVersion);
     CRITICAL_BLOCK(cs)
-      Good_(addr, clientVersion, clientSubVersion, blocks);
+      Good_(addr, clientVersion, clientSV, blocks, time(NULL));
   }
   void Skipped(const CService &addr) {
     CRITICAL_BLOCK(cs)
@@ -357,14 +830,75 @@ public:
   }
   void Bad(const CService &addr, int ban = 0) {
     CRITICAL_BLOCK(cs)
-      Bad_(addr, ban);
+      Bad_(addr, ban, time(NULL));
   }
   bool Get(CServiceResult &ip, int& wait) {
     CRITICAL_BLOCK(cs)
       return Get_(ip, wait);
   }
+  // Start revalidating the nodes that were good when the database was loaded, most
+  // recently good first. Until they are tried, Get_ hands them out before anything else,
+  // and DNS answers only fall back on them when there are not enough reconfirmed nodes.
+  // Returns their number.
+  int BeginWarmStart() {
+    CRITICAL_BLOCK(cs) {
+      std::sort(warmId.begin(), warmId.end(), [](const CAddrInfo *a, const CAddrInfo *b) { return a->ourLastSuccess < b->ourLastSuccess; });
+      for (int i = 0; i < warmId.size(); i++)
+        warmId[i]->nWarmPos = i;
+      nWarmStart = GetTimeMicros();
+      return warmId.size();
+    }
+    return 0;
+  }
+  // get up to max nodes awaiting revalidation (for the extra warm start crawlers)
+  void GetWarm(std::vector<CServiceResult> &ips, int max) {
+    int64 nStart = GetTimeMicros();
+    CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
+      while (max-- > 0) {
+        CAddrInfo *pInfo = TakeWarm_();
+        if (!pInfo) return;
+        CServiceResult ip = {};
+        ip.service = pInfo->ip;
+        ip.ourLastSuccess = pInfo->ourLastSuccess;
+        ips.push_back(ip);
+      }
+    }
+  }
+  // Take up to max good nodes for persistent connections (see CKeepAlive). They are not
+  // handed to crawlers until Release.
+  void TakeKeep(std::vector<CService> &ips, int max) {
+    int64 nStart = GetTimeMicros();
+    CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
+      TakeKeep_(ips, max, time(NULL));
+    }
+  }
+  // A kept node answered a ping: a successful probe, after which it stays kept. False if
+  // it is no longer good (and should be released).
+  bool KeptGood(const CServiceResult &res) {
+    int64 nStart = GetTimeMicros();
+    CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
+      Good_(res.service, res.nClientV, res.nClientSV, res.nHeight, time(NULL), res.rtt);
+      int id = Lookup_(res.service);
+      if (id == -1) return false;
+      SetCluster_(id, idToInfo[id], ClusterKey_(res));
+      Unschedule_(id);
+      return idToInfo[id].nGoodPos >= 0;
+    }
+    return false;
+  }
+  // Hand a kept node back to the crawlers: at once if its connection was lost (fNow), as
+  // it may be down, otherwise when it is due.
+  void Release(const CService &ip, bool fNow) {
+    CRITICAL_BLOCK(cs)
+      Release_(ip, fNow, time(NULL));
+  }
   void GetMany(std::vector<CServiceResult> &ips, int max, int& wait) {
+    int64 nStart = GetTimeMicros();
     CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
       while (max > 0) {
           CServiceResult ip = {};
           if (!Get_(ip, wait)) {
@@ -376,18 +910,72 @@ public:
     }
   }
   void ResultMany(const std::vector<CServiceResult> &ips) {
+    int64 now = time(NULL);
+    int64 nStart = GetTimeMicros();
     CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
       for (int i=0; i<ips.size(); i++) {
         if (ips[i].fGood) {
-          Good_(ips[i].service, ips[i].nClientV, ips[i].strClientV, ips[i].nHeight);
+          Good_(ips[i].service, ips[i].nClientV, ips[i].nClientSV, ips[i].nHeight, now, ips[i].rtt);
+          int id = Lookup_(ips[i].service);
+          if (id != -1)
+            SetCluster_(id, idToInfo[id], ClusterKey_(ips[i]));
         } else {
-          Bad_(ips[i].service, ips[i].nBanTime);
+          Bad_(ips[i].service, ips[i].nBanTime, now);
         }
       }
     }
   }
+  // Merge probe outcomes received from a federation peer (see Remote_), which is cluster
+  // member nMember if >= 0. Returns the number that changed anything.
+  int RemoteMany(const std::vector<CRemoteResult> &vRes, const CService &peer, int nMember = -1) {
+    int64 now = time(NULL);
+    int64 nStart = GetTimeMicros();
+    int nApplied = 0;
+    CRITICAL_BLOCK(cs) {
+      NoteStall(nStart);
+      int nSource = GetSource_(peer);
+      for (int i=0; i<vRes.size(); i++)
+        nApplied += Remote_(vRes[i], nSource, now, nMember);
+      Trim_(now);
+    }
+    return nApplied;
+  }
   void GetIPs(std::set<CNetAddr>& ips, uint64_t requestedFlags, int max, const bool *nets) {
     SHARED_CRITICAL_BLOCK(cs)
       GetIPs_(ips, requestedFlags, max, nets);
   }
+  // Like GetIPs, but writes the addresses straight into addr[0..max) and does not allocate
+  // (after the first calls of a thread). At most quota[NET_IPV4] IPv4 and quota[NET_IPV6]
+  // IPv6 addresses are written. Returns the number of addresses written.
+  int SampleIPs(addr_t *addr, int max, uint64_t requestedFlags, const int *quota) {
+    SHARED_CRITICAL_BLOCK(cs)
+      return SampleIPs_(addr, max, requestedFlags, quota);
+    return 0;
+  }
+
+  friend class CAddrReportCursor;
 };
+
+// Cursor over the nodes that go into reports (tried, with at least one success), roughly
+// in the order they are due to be revisited, without copying them. No locking: only for a frozen copy of
+// the database (see CAddrDb::ForkSnapshot).
+class CAddrReportCursor {
+private:
+  const CAddrDb &db;
+  int h;
+public:
+  CAddrReportCursor(const CAddrDb &dbIn) : db(dbIn), h(dbIn.schedule.First()) {}
+
+  const CAddrInfo *Next() {
+    while (h >= 0) {
+      std::map<int, CAddrInfo>::const_iterator mi = db.idToInfo.find(db.schedule.Get(h));
+      h = db.schedule.Next(h);
+      if (mi != db.idToInfo.end() && (*mi).second.success > 0)
+        return &(*mi).second;
+    }
+    return NULL;
+  }
+};
+
+#endif
@@ -0,0 +1,423 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "db.h"
+#include "dbfile.h"
+
+using namespace std;
+
+void CDbChecksum::Write(const void *pv, size_t n) {
+  const unsigned char *p = (const unsigned char*)pv;
+  nLen += n;
+  while (nBuf && n) {
+    buf[nBuf++] = *(p++);
+    n--;
+    if (nBuf == 8) {
+      uint64_t w;
+      memcpy(&w, buf, 8);
+      Block(w);
+      nBuf = 0;
+    }
+  }
+  while (n >= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    Block(w);
+    p += 8;
+    n -= 8;
+  }
+  while (n--)
+    buf[nBuf++] = *(p++);
+}
+
+uint64_t CDbChecksum::Finalize() {
+  uint64_t w = 0;
+  memcpy(&w, buf, nBuf);
+  Block(w ^ nLen);
+  uint64_t r = h;
+  r ^= r >> 33;
+  r *= 0xff51afd7ed558ccdULL;
+  r ^= r >> 33;
+  return r;
+}
+
+void WriteVarInt(string &str, uint64_t n) {
+  while (n >= 0x80) {
+    str += (char)(0x80 | (n & 0x7F));
+    n >>= 7;
+  }
+  str += (char)n;
+}
+
+bool ReadVarInt(const unsigned char *&p, const unsigned char *pend, uint64_t &n) {
+  n = 0;
+  for (int nShift = 0; nShift < 64; nShift += 7) {
+    if (p == pend) return false;
+    unsigned char c = *(p++);
+    n |= (uint64_t)(c & 0x7F) << nShift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+int CDbFileView::Open(const string &strFile, string &strError) {
+  Close();
+  fd = open(strFile.c_str(), O_RDONLY);
+  if (fd == -1) {
+    strError = strerror(errno);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    strError = strerror(errno);
+    return -1;
+  }
+  nSize = st.st_size;
+  if (nSize < sizeof(CDbFileHeader))
+    return 0;
+  void *p = mmap(NULL, nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    strError = strerror(errno);
+    return -1;
+  }
+  pData = (const unsigned char*)p;
+  madvise(p, nSize, MADV_SEQUENTIAL);
+  const CDbFileHeader &hdr = GetHeader();
+  if (memcmp(hdr.magic, DBFILE_MAGIC, sizeof(DBFILE_MAGIC)))
+    return 0;
+  if (hdr.nVersion != DBFILE_VERSION && hdr.nVersion != 5 && hdr.nVersion != 6) {
+    strError = strprintf("unsupported version %u", hdr.nVersion);
+    return -1;
+  }
+  if (hdr.nNodeSize != (hdr.nVersion == 5 ? DBFILE_NODE_SIZE_V5 : hdr.nVersion == 6 ? DBFILE_NODE_SIZE_V6 : sizeof(CDbFileNode)) ||
+      nSize != sizeof(CDbFileHeader) + (uint64_t)hdr.nNodes * hdr.nNodeSize + (uint64_t)hdr.nBanned * sizeof(CDbFileBan) +
+                (uint64_t)hdr.nSources * sizeof(CDbFileSource) + hdr.nStringsSize) {
+    strError = "truncated or malformed file";
+    return -1;
+  }
+  CDbChecksum checksum;
+  checksum.Write(pData + sizeof(CDbFileHeader), nSize - sizeof(CDbFileHeader));
+  if (checksum.Finalize() != hdr.nChecksum) {
+    strError = "checksum mismatch";
+    return -1;
+  }
+  return 1;
+}
+
+void CDbFileView::GetNode(uint32_t i, CDbFileNode &rec) const {
+  const CDbFileHeader &hdr = GetHeader();
+  memcpy(&rec, pData + sizeof(CDbFileHeader) + (size_t)i * hdr.nNodeSize, std::min((size_t)hdr.nNodeSize, sizeof(rec)));
+  if (hdr.nNodeSize <= offsetof(CDbFileNode, rtt))
+    std::fill(rec.rtt, rec.rtt + 4, -1.0f);
+  if (hdr.nNodeSize <= offsetof(CDbFileNode, lastChange))
+    rec.lastChange = 0;
+}
+
+void CDbFileView::Close() {
+  if (pData) munmap((void*)pData, nSize);
+  if (fd != -1) close(fd);
+  pData = NULL;
+  fd = -1;
+  nSize = 0;
+}
+
+bool CDbFileView::GetStrings(vector<string> &vStrings) const {
+  const CDbFileHeader &hdr = GetHeader();
+  const unsigned char *p = (const unsigned char*)(GetSources() + hdr.nSources);
+  const unsigned char *pend = p + hdr.nStringsSize;
+  vStrings.clear();
+  vStrings.reserve(hdr.nStrings);
+  string strPrev;
+  for (unsigned int i = 0; i < hdr.nStrings; i++) {
+    uint64_t nShared, nSuffix;
+    if (!ReadVarInt(p, pend, nShared) || !ReadVarInt(p, pend, nSuffix)) return false;
+    if (nShared > strPrev.size() || nSuffix > (uint64_t)(pend - p)) return false;
+    string str(strPrev, 0, nShared);
+    str.append((const char*)p, nSuffix);
+    p += nSuffix;
+    vStrings.push_back(str);
+    strPrev = str;
+  }
+  return true;
+}
+
+void CAddrDb::CutJournal_() {
+  if (journal)
+    nSnapSeq = journal->Rotate();
+  nSnapDirty = nDirty;
+}
+
+bool CAddrDb::Save(const string &strFile) {
+  bool ret;
+  SHARED_CRITICAL_BLOCK(cs) {
+    CutJournal_();
+    ret = Save_(strFile);
+  }
+  if (journal)
+    journal->FinishRotate();
+  return ret;
+}
+
+pid_t CAddrDb::ForkSnapshot(bool fCut) {
+  pid_t pid;
+  SHARED_CRITICAL_BLOCK(cs) {
+    if (fCut)
+      CutJournal_();
+    pid = fork();
+  }
+  if (pid != 0 && fCut && journal)
+    journal->FinishRotate();
+  return pid;
+}
+
+bool CAddrDb::Save_(const string &strFile) {
+  FILE *file = fopen(strFile.c_str(), "wb");
+  if (!file) {
+    printf("Error: cannot create %s: %s\n", strFile.c_str(), strerror(errno));
+    return false;
+  }
+  static char vBuf[1 << 20];
+  setvbuf(file, vBuf, _IOFBF, sizeof(vBuf));
+  CDbFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, DBFILE_MAGIC, sizeof(DBFILE_MAGIC));
+  hdr.nVersion = DBFILE_VERSION;
+  hdr.nNodeSize = sizeof(CDbFileNode);
+  hdr.nTime = time(NULL);
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  CDbChecksum checksum;
+  hdr.nSnapSeq = nSnapSeq;
+
+  // subversion dictionary of the interned strings in use, sorted for front coding
+  vector<uint32_t> vIndex(GetSubVersionCount(), 0);
+  vIndex[0] = 1;
+  for (map<int, CAddrInfo>::const_iterator it = idToInfo.begin(); it != idToInfo.end(); it++)
+    vIndex[(*it).second.clientSubVersion] = 1;
+  vector<uint32_t> vUsed;
+  for (uint32_t i = 0; i < vIndex.size(); i++)
+    if (vIndex[i]) vUsed.push_back(i);
+  sort(vUsed.begin(), vUsed.end(), [](uint32_t a, uint32_t b) { return GetSubVersion(a) < GetSubVersion(b); });
+  for (uint32_t i = 0; i < vUsed.size(); i++)
+    vIndex[vUsed[i]] = i;
+
+  // sources still referenced by a node, or that are nodes themselves, renumbered densely
+  vector<uint32_t> vSourceIndex(vSources.size(), 0);
+  for (size_t i = 1; i < vSources.size(); i++)
+    if (vSources[i].nRef > 0 || ipToId.Find(vSources[i].ip))
+      vSourceIndex[i] = ++hdr.nSources;
+
+  CDbFileNode rec;
+  auto writeNode = [&](const CAddrInfo &info, uint8_t flags) {
+    if (info.GetBanTime(*pNet)) return;
+    info.ToDbNode(rec);
+    rec.subVersion = vIndex[info.clientSubVersion];
+    rec.source = vSourceIndex[info.nSource];
+    rec.flags = flags;
+    fwrite(&rec, sizeof(rec), 1, file);
+    checksum.Write(&rec, sizeof(rec));
+    hdr.nNodes++;
+  };
+  for (int h = schedule.First(); h >= 0; h = schedule.Next(h)) {
+    const CAddrInfo &info = idToInfo[schedule.Get(h)];
+    writeNode(info, DBNODE_TRIED | (info.nGoodPos >= 0 || info.nWarmPos != -1 ? DBNODE_GOOD : 0));
+  }
+  // nodes being tried right now (or held back for their network group) are in neither the schedule nor unkId
+  for (vector<CAddrInfo*>::const_iterator it = vNodes.begin(); it != vNodes.end(); it++) {
+    const CAddrInfo &info = **it;
+    if (info.nSchedule < 0 && info.nUnkPos < 0)
+      writeNode(info, info.ourLastTry ? DBNODE_TRIED | (info.nGoodPos >= 0 || info.nWarmPos != -1 ? DBNODE_GOOD : 0) : 0);
+  }
+  for (vector<CAddrInfo*>::const_iterator it = unkId.begin(); it != unkId.end(); it++)
+    writeNode(**it, 0);
+
+  CDbFileBan ban;
+  banned.ForEach([&](const CService &ip, time_t nUntil) {
+    memset(&ban, 0, sizeof(ban));
+    struct in6_addr addr6;
+    ip.GetIn6Addr(&addr6);
+    memcpy(ban.ip, &addr6, 16);
+    ban.port = ip.GetPort();
+    ban.nUntil = nUntil;
+    fwrite(&ban, sizeof(ban), 1, file);
+    checksum.Write(&ban, sizeof(ban));
+    hdr.nBanned++;
+  });
+
+  CDbFileSource src;
+  for (size_t i = 1; i < vSources.size(); i++) {
+    if (!vSourceIndex[i]) continue;
+    memset(&src, 0, sizeof(src));
+    struct in6_addr addr6;
+    vSources[i].ip.GetIn6Addr(&addr6);
+    memcpy(src.ip, &addr6, 16);
+    src.port = vSources[i].ip.GetPort();
+    src.nAdded = vSources[i].nAdded;
+    src.nTried = vSources[i].nTried;
+    src.nGood = vSources[i].nGood;
+    fwrite(&src, sizeof(src), 1, file);
+    checksum.Write(&src, sizeof(src));
+  }
+
+  string strStrings, strPrev;
+  for (uint32_t i = 0; i < vUsed.size(); i++) {
+    const string &str = GetSubVersion(vUsed[i]);
+    size_t nShared = 0;
+    while (nShared < str.size() && nShared < strPrev.size() && str[nShared] == strPrev[nShared]) nShared++;
+    WriteVarInt(strStrings, nShared);
+    WriteVarInt(strStrings, str.size() - nShared);
+    strStrings.append(str, nShared, string::npos);
+    strPrev = str;
+  }
+  fwrite(strStrings.data(), 1, strStrings.size(), file);
+  checksum.Write(strStrings.data(), strStrings.size());
+  hdr.nStrings = vUsed.size();
+  hdr.nStringsSize = strStrings.size();
+  hdr.nChecksum = checksum.Finalize();
+  fseek(file, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  bool ret = fflush(file) == 0 && fsync(fileno(file)) == 0;
+  if (!ret)
+    printf("Error: writing %s failed: %s\n", strFile.c_str(), strerror(errno));
+  fclose(file);
+  return ret;
+}
+
+int CAddrDb::Load(const string &strFile, string &strError) {
+  CDbFileView view;
+  int ret = view.Open(strFile, strError);
+  if (ret != 1) return ret;
+  const CDbFileHeader &hdr = view.GetHeader();
+  vector<string> vStrings;
+  if (!view.GetStrings(vStrings)) {
+    strError = "malformed subversion strings";
+    return -1;
+  }
+  vector<uint32_t> vSubVersion(vStrings.size());
+  for (uint32_t i = 0; i < vStrings.size(); i++)
+    vSubVersion[i] = InternSubVersion(vStrings[i]);
+  const CDbFileBan *pBans = view.GetBans();
+  const CDbFileSource *pSources = view.GetSources();
+  CRITICAL_BLOCK(cs) {
+    nSnapSeq = hdr.nSnapSeq;
+    vector<uint32_t> vSource(hdr.nSources + 1, 0);
+    for (uint32_t i = 0; i < hdr.nSources; i++) {
+      struct in6_addr addr6;
+      memcpy(&addr6, pSources[i].ip, 16);
+      vSource[i + 1] = GetSource_(CService(addr6, pSources[i].port));
+      CAddrSource &source = vSources[vSource[i + 1]];
+      source.nAdded = pSources[i].nAdded;
+      source.nTried = pSources[i].nTried;
+      source.nGood = pSources[i].nGood;
+    }
+    nId = 0;
+    ipToId.reserve(hdr.nNodes);
+    vNodes.reserve(hdr.nNodes);
+    unkId.reserve(hdr.nNodes);
+    // ids are assigned in increasing order, so every insert goes at the end
+    CDbFileNode rec;
+    for (uint32_t i = 0; i < hdr.nNodes; i++) {
+      view.GetNode(i, rec);
+      int id = nId++;
+      std::map<int, CAddrInfo>::iterator it = idToInfo.emplace_hint(idToInfo.end(), id, CAddrInfo());
+      CAddrInfo &info = (*it).second;
+      info.FromDbNode(rec);
+      if (rec.subVersion < vStrings.size())
+        info.clientSubVersion = vSubVersion[rec.subVersion];
+      if (rec.source <= hdr.nSources)
+        info.nSource = vSource[rec.source];
+      Index_(id, info);
+      if (rec.flags & DBNODE_TRIED) {
+        info.nRevisit = GetRevisit_(info);
+        info.nSchedule = schedule.Insert(id, info.GetNextTry());
+        if (rec.flags & DBNODE_GOOD) SetWarm_(info);
+      } else {
+        SetUnknown_(info);
+      }
+    }
+    for (uint32_t i = 0; i < hdr.nBanned; i++) {
+      struct in6_addr addr6;
+      memcpy(&addr6, pBans[i].ip, 16);
+      Ban_(CService(addr6, pBans[i].port), pBans[i].nUntil);
+    }
+    nDirty++;
+  }
+  return 1;
+}
+
+void CAddrInfo::ToDbNode(CDbFileNode &rec) const {
+  memset(&rec, 0, sizeof(rec));
+  struct in6_addr addr6;
+  ip.GetIn6Addr(&addr6);
+  memcpy(rec.ip, &addr6, 16);
+  rec.port = ip.GetPort();
+  rec.services = services;
+  rec.lastTry = lastTry;
+  rec.ourLastTry = ourLastTry;
+  rec.ourLastSuccess = ourLastSuccess;
+  rec.ignoreTill = ignoreTill;
+  const CAddrStat *stats[5] = {&stat2H, &stat8H, &stat1D, &stat1W, &stat1M};
+  for (int i = 0; i < 5; i++) {
+    rec.stat[i].weight = stats[i]->weight;
+    rec.stat[i].count = stats[i]->count;
+    rec.stat[i].reliability = stats[i]->reliability;
+  }
+  rec.clientVersion = clientVersion;
+  rec.blocks = blocks;
+  rec.total = total;
+  rec.success = success;
+  rec.rtt[0] = rtt.connect;
+  rec.rtt[1] = rtt.handshake;
+  rec.rtt[2] = rtt.ping;
+  rec.rtt[3] = rtt.jitter;
+  rec.lastChange = lastChange;
+}
+
+void CAddrInfo::FromDbNode(const CDbFileNode &rec) {
+  struct in6_addr addr6;
+  memcpy(&addr6, rec.ip, 16);
+  ip = CService(addr6, rec.port);
+  services = rec.services;
+  lastTry = rec.lastTry;
+  ourLastTry = rec.ourLastTry;
+  ourLastSuccess = rec.ourLastSuccess;
+  ignoreTill = rec.ignoreTill;
+  CAddrStat *stats[5] = {&stat2H, &stat8H, &stat1D, &stat1W, &stat1M};
+  for (int i = 0; i < 5; i++) {
+    stats[i]->weight = rec.stat[i].weight;
+    stats[i]->count = rec.stat[i].count;
+    stats[i]->reliability = rec.stat[i].reliability;
+  }
+  clientVersion = rec.clientVersion;
+  blocks = rec.blocks;
+  total = rec.total;
+  success = rec.success;
+  rtt.connect = rec.rtt[0];
+  rtt.handshake = rec.rtt[1];
+  rtt.ping = rec.rtt[2];
+  rtt.jitter = rec.rtt[3];
+  lastChange = rec.lastChange;
+}
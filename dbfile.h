@@ -0,0 +1,170 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _DBFILE_H_
+#define _DBFILE_H_ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// On-disk database format, version 7
+//
+//   CDbFileHeader
+//   CDbFileNode[nNodes]   fixed stride; tried nodes in the order they were tried (then any being tried), then unknown ones
+//   CDbFileBan[nBanned]   fixed stride
+//   CDbFileSource[nSources] fixed stride; peers that told us about nodes (CDbFileNode.source)
+//   subversion strings    nStrings entries, sorted and front-coded:
+//                         varint shared prefix length, varint suffix length, suffix bytes
+//
+// Integers are stored in host (little-endian) byte order, so the file can be mmap'ed
+// and the record arrays used in place. nChecksum covers everything after the header.
+// The legacy format (a CAutoFile serialization of CAddrDb) starts with a zero int,
+// which can never match the magic.
+//
+// Versions 5 and 6 are the same with shorter node records (version 5: no round trip times,
+// nNodeSize 144; version 6: no lastChange, nNodeSize 160); such files are still read, with
+// the missing fields unknown.
+
+static const char DBFILE_MAGIC[4] = {'V', 'S', 'D', 'B'};
+static const uint32_t DBFILE_VERSION = 7;
+static const uint32_t DBFILE_NODE_SIZE_V5 = 144;
+static const uint32_t DBFILE_NODE_SIZE_V6 = 160;
+
+enum {
+  DBNODE_TRIED = 1, // node was tried (scheduled for revisits), otherwise it is unknown (unkId)
+  DBNODE_GOOD = 2,  // node was good when written (goodId)
+};
+
+struct CDbFileHeader {
+  char magic[4];
+  uint32_t nVersion;
+  uint64_t nSnapSeq;       // journal sequence number covered by this snapshot
+  int64_t nTime;           // time the snapshot was written
+  uint32_t nNodes;
+  uint32_t nBanned;
+  uint32_t nStrings;
+  uint32_t nNodeSize;      // sizeof(CDbFileNode), as a sanity check
+  uint64_t nStringsSize;   // size of the subversion string section in bytes
+  uint64_t nChecksum;
+  uint32_t nSources;
+  unsigned char reserved[4];
+};
+
+struct CDbFileStat {
+  float weight;
+  float count;
+  float reliability;
+};
+
+struct CDbFileNode {
+  unsigned char ip[16];
+  uint16_t port;
+  uint8_t flags;
+  uint8_t reserved;
+  uint32_t subVersion;     // index into the subversion strings
+  uint64_t services;
+  int64_t lastTry;
+  int64_t ourLastTry;
+  int64_t ourLastSuccess;
+  int64_t ignoreTill;
+  CDbFileStat stat[5];     // 2H, 8H, 1D, 1W, 1M
+  int32_t clientVersion;
+  int32_t blocks;
+  int32_t total;
+  int32_t success;
+  uint32_t source;         // index + 1 into the source table, 0 if unknown
+  float rtt[4];            // round trip time averages in ms: connect, handshake, ping, jitter (negative if unknown; v6)
+  int64_t lastChange;      // start of the current run of equal probe outcomes (0 if unknown; v7)
+};
+
+struct CDbFileBan {
+  unsigned char ip[16];
+  uint16_t port;
+  unsigned char reserved[6];
+  int64_t nUntil;
+};
+
+struct CDbFileSource {
+  unsigned char ip[16];
+  uint16_t port;
+  unsigned char reserved[6];
+  int64_t nAdded;          // new nodes accepted from this source
+  int32_t nTried;          // of which were tried
+  int32_t nGood;           // of which were reachable on the first try
+};
+
+static_assert(sizeof(CDbFileHeader) == 64, "unexpected CDbFileHeader size");
+static_assert(sizeof(CDbFileNode) == 168, "unexpected CDbFileNode size");
+static_assert(sizeof(CDbFileBan) == 32, "unexpected CDbFileBan size");
+static_assert(sizeof(CDbFileSource) == 40, "unexpected CDbFileSource size");
+
+// 64-bit checksum, fed incrementally (8 bytes at a time on the fast path)
+class CDbChecksum {
+private:
+  uint64_t h;
+  uint64_t nLen;
+  unsigned char buf[8];
+  int nBuf;
+
+  void Block(uint64_t w) {
+    w *= 0x87c37b91114253d5ULL;
+    w = (w << 31) | (w >> 33);
+    h ^= w * 0x4cf5ad432745937fULL;
+    h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+  }
+
+public:
+  CDbChecksum() : h(0x9e3779b97f4a7c15ULL), nLen(0), nBuf(0) {}
+  void Write(const void *pv, size_t n);
+  uint64_t Finalize();
+};
+
+// Read-only mapping of a version 5, 6 or 7 database file.
+class CDbFileView {
+private:
+  int fd;
+  const unsigned char *pData;
+  size_t nSize;
+
+public:
+  CDbFileView() : fd(-1), pData(NULL), nSize(0) {}
+  ~CDbFileView() { Close(); }
+
+  // returns 1 on success, 0 if the file is not a version 5/6/7 database (e.g. legacy format), -1 on error
+  int Open(const std::string &strFile, std::string &strError);
+  void Close();
+
+  const CDbFileHeader &GetHeader() const { return *(const CDbFileHeader*)pData; }
+  // node i, converted to the current record (the file may have shorter ones)
+  void GetNode(uint32_t i, CDbFileNode &rec) const;
+  const CDbFileBan *GetBans() const { return (const CDbFileBan*)(pData + sizeof(CDbFileHeader) + (size_t)GetHeader().nNodes * GetHeader().nNodeSize); }
+  const CDbFileSource *GetSources() const { return (const CDbFileSource*)(GetBans() + GetHeader().nBanned); }
+  bool GetStrings(std::vector<std::string> &vStrings) const;
+};
+
+void WriteVarInt(std::string &str, uint64_t n);
+bool ReadVarInt(const unsigned char *&p, const unsigned char *pend, uint64_t &n);
+
+#endif
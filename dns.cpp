@@ -316,8 +316,15 @@ ssize_t static dnshandle(dns_opt_t *opt, const unsigned char *inbuf, size_t insi
   int ret = parse_name(&inpos, inend, inbuf, name, 256);
   if (ret == -1) return set_error(outbuf, 1);
   if (ret == -2) return set_error(outbuf, 5);
-  int namel = strlen(name), hostl = strlen(opt->host);
-  if (strcasecmp(name, opt->host) && (namel<hostl+2 || name[namel-hostl-1]!='.' || strcasecmp(name+namel-hostl,opt->host))) return set_error(outbuf, 5);
+  int namel = strlen(name), zone = -1, zonel = 0;
+  for (int i = 0; i < opt->nhosts; i++) {
+    int hostl = strlen(opt->hosts[i]);
+    if (hostl <= zonel) continue;
+    if (strcasecmp(name, opt->hosts[i]) && (namel<hostl+2 || name[namel-hostl-1]!='.' || strcasecmp(name+namel-hostl,opt->hosts[i]))) continue;
+    zone = i;
+    zonel = hostl;
+  }
+  if (zone < 0) return set_error(outbuf, 5);
   if (inend - inpos < 4) return set_error(outbuf, 1);
   // copy question to output
   memcpy(outbuf+12, inbuf+12, inpos+4 - (inbuf+12));
@@ -376,7 +383,7 @@ ssize_t static dnshandle(dns_opt_t *opt, const unsigned char *inbuf, size_t insi
   // A/AAAA records
   if ((typ == TYPE_A || typ == TYPE_AAAA || typ == QTYPE_ANY) && (cls == CLASS_IN || cls == QCLASS_ANY)) {
     addr_t addr[32];
-    int naddr = opt->cb((void*)opt, name, addr, 32, typ == TYPE_A || typ == QTYPE_ANY, typ == TYPE_AAAA || typ == QTYPE_ANY);
+    int naddr = opt->cb((void*)opt, zone, name, addr, 32, typ == TYPE_A || typ == QTYPE_ANY, typ == TYPE_AAAA || typ == QTYPE_ANY);
     int n = 0;
     while (n < naddr) {
       int ret = 1;
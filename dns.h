@@ -25,22 +25,17 @@
 
 #include <stdint.h>
 
-struct addr_t {
-    int v;
-    union {
-       unsigned char v4[4];
-       unsigned char v6[16];
-    } data;
-};
+#include "addr.h"
 
 struct dns_opt_t {
   int port;
   int datattl;
   int nsttl;
-  const char *host;
+  const char **hosts; // zones served; a query goes to the one with the longest matching suffix
+  int nhosts;
   const char *ns;
   const char *mbox;
-  int (*cb)(void *opt, char *requested_hostname, addr_t *addr, int max, int ipv4, int ipv6);
+  int (*cb)(void *opt, int zone, char *requested_hostname, addr_t *addr, int max, int ipv4, int ipv6);
   // stats
   uint64_t nRequests;
 };
@@ -0,0 +1,437 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "federation.h"
+#include "netbase.h"
+#include "util.h"
+
+using namespace std;
+
+#define FEDERATION_NONCE 32
+#define FEDERATION_TAG 16
+#define FEDERATION_HANDSHAKE 10000 // ms to complete the handshake
+#define FEDERATION_MAX_INBOUND 32  // concurrent authenticated inbound sessions
+#define FEDERATION_MAX_PENDING 8   // inbound connections still in the handshake
+#define FEDERATION_PENDING_PER_IP 2 // of which from one address
+#define FEDERATION_SEND_BUFFER 0x40000 // do not queue more frames while this much is unsent
+
+// Inbound connections get one of a few handshake slots, at most a couple per address,
+// and only take a session slot once authenticated, so clients without the key cannot
+// lock peers out by holding connections open.
+static CCriticalSection csInbound;
+static map<CNetAddr, int> mapPending; // inbound connections in the handshake, per address
+static int nPending = 0;
+static int nInbound = 0; // authenticated inbound sessions
+
+static bool TakePending(const CNetAddr &ip) {
+  CRITICAL_BLOCK(csInbound) {
+    int &nFromIp = mapPending[ip];
+    if (nInbound >= FEDERATION_MAX_INBOUND || nPending >= FEDERATION_MAX_PENDING || nFromIp >= FEDERATION_PENDING_PER_IP) {
+      if (!nFromIp) mapPending.erase(ip);
+      return false;
+    }
+    nFromIp++;
+    nPending++;
+  }
+  return true;
+}
+
+// the handshake of an inbound connection is over; if fAuth, it takes a session slot if one is free
+static bool ReleasePending(const CNetAddr &ip, bool fAuth) {
+  CRITICAL_BLOCK(csInbound) {
+    nPending--;
+    if (--mapPending[ip] <= 0) mapPending.erase(ip);
+    if (!fAuth || nInbound >= FEDERATION_MAX_INBOUND) return false;
+    nInbound++;
+  }
+  return true;
+}
+
+static void ReleaseInbound() {
+  CRITICAL_BLOCK(csInbound)
+    nInbound--;
+}
+
+static void Hmac(const unsigned char *pKey, size_t nKey, const vector<unsigned char> &vData, unsigned char *pOut) {
+  unsigned int nOut = 32;
+  HMAC(EVP_sha256(), pKey, nKey, vData.empty() ? NULL : &vData[0], vData.size(), pOut, &nOut);
+}
+
+// One connection to a federation peer: buffered non-blocking I/O, and the framing and
+// authentication described in federation.h.
+class CFedSession {
+private:
+  SOCKET sock;
+  vector<char> vSend;
+  vector<char> vRecv;
+  unsigned char sessionKey[32];
+  char chRole, chPeerRole;
+  uint64 nSendSeq;
+  uint64 nRecvSeq;
+
+  void Tag(char chDir, uint64 nSeq, const char *pPayload, unsigned int nSize, unsigned char *pTag) {
+    vector<unsigned char> vData(1 + 8 + nSize);
+    vData[0] = chDir;
+    memcpy(&vData[1], &nSeq, 8);
+    if (nSize) memcpy(&vData[9], pPayload, nSize);
+    unsigned char hash[32];
+    Hmac(sessionKey, sizeof(sessionKey), vData, hash);
+    memcpy(pTag, hash, FEDERATION_TAG);
+  }
+
+public:
+  CFedSession(SOCKET sockIn, bool fInbound) : sock(sockIn), chRole(fInbound ? 'S' : 'C'), chPeerRole(fInbound ? 'C' : 'S'), nSendSeq(0), nRecvSeq(0) {}
+
+  // wait up to nTimeout ms for the socket, then send and receive what it allows;
+  // false if the connection failed or was closed
+  bool Pump(int nTimeout) {
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN | (vSend.empty() ? 0 : POLLOUT);
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, nTimeout);
+    if (ret < 0) return errno == EINTR;
+    if (ret == 0) return true;
+    if (pfd.revents & (POLLERR | POLLNVAL)) return false;
+    if ((pfd.revents & POLLOUT) && !vSend.empty()) {
+      int nBytes = send(sock, &vSend[0], vSend.size(), MSG_NOSIGNAL);
+      if (nBytes > 0)
+        vSend.erase(vSend.begin(), vSend.begin() + nBytes);
+      else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return false;
+    }
+    if (pfd.revents & (POLLIN | POLLHUP)) {
+      char pchBuf[0x10000];
+      int nBytes = recv(sock, pchBuf, sizeof(pchBuf), 0);
+      if (nBytes > 0)
+        vRecv.insert(vRecv.end(), pchBuf, pchBuf + nBytes);
+      else if (nBytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        return false;
+    }
+    return true;
+  }
+
+  // pump until n bytes are received (or sent, if fSend) or the deadline passes
+  bool Wait(size_t n, bool fSend, int64 nDeadline) {
+    while (fSend ? !vSend.empty() : vRecv.size() < n) {
+      int64 nLeft = nDeadline - GetTimeMillis();
+      if (nLeft <= 0 || !Pump(nLeft)) return false;
+    }
+    return true;
+  }
+
+  // exchange hellos and proofs, and derive the session key; false if the peer does not know the key
+  bool Handshake(const string &strKey, const string &strName, string &strPeerName) {
+    int64 nDeadline = GetTimeMillis() + FEDERATION_HANDSHAKE;
+    const unsigned char *pKey = (const unsigned char*)strKey.data();
+    unsigned char nonce[FEDERATION_NONCE];
+    if (RAND_bytes(nonce, sizeof(nonce)) != 1) return false;
+    uint32_t nVersion = FEDERATION_VERSION;
+    vSend.insert(vSend.end(), FEDERATION_MAGIC, FEDERATION_MAGIC + 4);
+    vSend.insert(vSend.end(), (char*)&nVersion, (char*)&nVersion + 4);
+    vSend.insert(vSend.end(), (char*)nonce, (char*)nonce + sizeof(nonce));
+    vSend.push_back((char)strName.size());
+    vSend.insert(vSend.end(), strName.begin(), strName.end());
+    if (!Wait(9 + FEDERATION_NONCE, false, nDeadline)) return false;
+    uint32_t nPeerVersion;
+    memcpy(&nPeerVersion, &vRecv[4], 4);
+    if (memcmp(&vRecv[0], FEDERATION_MAGIC, 4) != 0 || nPeerVersion != FEDERATION_VERSION) return false;
+    unsigned char peerNonce[FEDERATION_NONCE];
+    memcpy(peerNonce, &vRecv[8], sizeof(peerNonce));
+    size_t nNameSize = (unsigned char)vRecv[8 + FEDERATION_NONCE];
+    if (!Wait(9 + FEDERATION_NONCE + nNameSize, false, nDeadline)) return false;
+    strPeerName.assign(&vRecv[9 + FEDERATION_NONCE], nNameSize);
+    for (size_t i = 0; i < nNameSize; i++)
+      if (strPeerName[i] < 32 || strPeerName[i] > 126) return false;
+    vRecv.erase(vRecv.begin(), vRecv.begin() + 9 + FEDERATION_NONCE + nNameSize);
+    if (memcmp(nonce, peerNonce, sizeof(nonce)) == 0) return false; // talking to ourselves (or a mirror)
+
+    unsigned char proof[32], expected[32];
+    vector<unsigned char> vData(1 + 2 * FEDERATION_NONCE);
+    vData[0] = chRole;
+    memcpy(&vData[1], nonce, FEDERATION_NONCE);
+    memcpy(&vData[1 + FEDERATION_NONCE], peerNonce, FEDERATION_NONCE);
+    vData.insert(vData.end(), strName.begin(), strName.end());
+    Hmac(pKey, strKey.size(), vData, proof);
+    vData.resize(1 + 2 * FEDERATION_NONCE);
+    vData[0] = chPeerRole;
+    memcpy(&vData[1], peerNonce, FEDERATION_NONCE);
+    memcpy(&vData[1 + FEDERATION_NONCE], nonce, FEDERATION_NONCE);
+    vData.insert(vData.end(), strPeerName.begin(), strPeerName.end());
+    Hmac(pKey, strKey.size(), vData, expected);
+    vSend.insert(vSend.end(), (char*)proof, (char*)proof + sizeof(proof));
+    if (!Wait(sizeof(expected), false, nDeadline)) return false;
+    if (CRYPTO_memcmp(&vRecv[0], expected, sizeof(expected)) != 0) return false;
+    vRecv.erase(vRecv.begin(), vRecv.begin() + sizeof(expected));
+
+    vector<unsigned char> vSession(7 + 2 * FEDERATION_NONCE);
+    memcpy(&vSession[0], "session", 7);
+    memcpy(&vSession[7], chRole == 'C' ? nonce : peerNonce, FEDERATION_NONCE);
+    memcpy(&vSession[7 + FEDERATION_NONCE], chRole == 'C' ? peerNonce : nonce, FEDERATION_NONCE);
+    Hmac(pKey, strKey.size(), vSession, sessionKey);
+    return Wait(0, true, nDeadline);
+  }
+
+  size_t GetSendSize() const { return vSend.size(); }
+
+  void PushFrame(const vector<CRemoteResult> &vRes) {
+    CDataStream ss(SER_NETWORK);
+    ss << vRes;
+    unsigned int nSize = ss.size();
+    unsigned char tag[FEDERATION_TAG];
+    Tag(chRole, nSendSeq++, nSize ? &ss[0] : NULL, nSize, tag);
+    vSend.insert(vSend.end(), (char*)&nSize, (char*)&nSize + 4);
+    vSend.insert(vSend.end(), ss.begin(), ss.end());
+    vSend.insert(vSend.end(), (char*)tag, (char*)tag + sizeof(tag));
+  }
+
+  // Take the next complete frame off the receive buffer. Returns 1 if vRes was filled,
+  // 0 if no complete frame is buffered, -1 if the peer broke the protocol.
+  int PopFrame(vector<CRemoteResult> &vRes) {
+    if (vRecv.size() < 4) return 0;
+    unsigned int nSize;
+    memcpy(&nSize, &vRecv[0], 4);
+    if (nSize > FEDERATION_MAX_FRAME) return -1;
+    if (vRecv.size() < 4 + nSize + FEDERATION_TAG) return 0;
+    unsigned char tag[FEDERATION_TAG];
+    Tag(chPeerRole, nRecvSeq++, &vRecv[4], nSize, tag);
+    if (CRYPTO_memcmp(tag, &vRecv[4 + nSize], FEDERATION_TAG) != 0) return -1;
+    try {
+      CDataStream ss(&vRecv[4], &vRecv[4] + nSize, SER_NETWORK);
+      ss >> vRes;
+    } catch (std::ios_base::failure &e) {
+      return -1;
+    }
+    vRecv.erase(vRecv.begin(), vRecv.begin() + 4 + nSize + FEDERATION_TAG);
+    return 1;
+  }
+};
+
+void CFederation::Publish(const vector<CServiceResult> &ips, int64 now) {
+  CRITICAL_BLOCK(cs) {
+    for (int i=0; i<ips.size(); i++) {
+      const CServiceResult &ip = ips[i];
+      CRemoteResult res;
+      res.service = ip.service;
+      res.nTime = now;
+      res.fGood = ip.fGood;
+      res.nServices = ip.fGood ? ip.nServices : 0;
+      res.nClientV = ip.nClientV;
+      res.nHeight = ip.nHeight;
+      res.strClientSV = GetSubVersion(ip.nClientSV);
+      outbox.push_back(res);
+    }
+    while (outbox.size() > FEDERATION_OUTBOX) {
+      outbox.pop_front();
+      nOutboxSeq++;
+    }
+  }
+}
+
+void CFederation::Take(uint64 &nSeq, vector<CRemoteResult> &vRes, int max) {
+  CRITICAL_BLOCK(cs) {
+    if (nSeq < nOutboxSeq) {
+      nSkipped += nOutboxSeq - nSeq;
+      nSeq = nOutboxSeq;
+    }
+    for (uint64 i = nSeq - nOutboxSeq; i < outbox.size() && vRes.size() < max; i++)
+      vRes.push_back(outbox[i]);
+    nSeq += vRes.size();
+  }
+}
+
+void CFederation::RunSession(SOCKET sock, const CService &peer, bool fInbound) {
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+  CFedSession session(sock, fInbound);
+  string strPeerName;
+  bool fAuth = session.Handshake(strKey, strName, strPeerName);
+  if (!fAuth) {
+    printf("federation: %s failed the handshake\n", peer.ToString().c_str());
+    nAuthFailed++;
+  }
+  if (fInbound && !ReleasePending(peer, fAuth) && fAuth) {
+    printf("federation: %s refused, %i inbound sessions already\n", peer.ToString().c_str(), FEDERATION_MAX_INBOUND);
+    fAuth = false;
+  }
+  if (!fAuth) {
+    closesocket(sock);
+    return;
+  }
+  int nMember = pPartition ? pPartition->GetMember(strPeerName) : -1;
+  if (pPartition && nMember == pPartition->GetSelf()) nMember = -1; // a misconfigured twin
+  printf("federation: session with %s (%s%s) established\n", peer.ToString().c_str(), strPeerName.c_str(), nMember >= 0 ? ", cluster member" : "");
+  nPeers++;
+  if (nMember >= 0)
+    pPartition->AddSession(nMember, 1);
+  // remote outcomes are attributed to the peer's host, whatever port it used
+  CService source(peer, 0);
+  uint64 nOut;
+  CRITICAL_BLOCK(cs)
+    nOut = nOutboxSeq; // only what is still in the outbox
+  int64 nLastRecv = GetTimeMillis(), nLastSend = 0;
+  while (true) {
+    int64 nNow = GetTimeMillis();
+    if (session.GetSendSize() < FEDERATION_SEND_BUFFER) {
+      vector<CRemoteResult> vRes;
+      Take(nOut, vRes, FEDERATION_BATCH);
+      if (!vRes.empty() || nNow - nLastSend >= FEDERATION_KEEPALIVE * 1000) {
+        session.PushFrame(vRes);
+        nSent += vRes.size();
+        nLastSend = nNow;
+      }
+    }
+    if (!session.Pump(500)) break;
+    vector<CRemoteResult> vRes;
+    int ret;
+    while ((ret = session.PopFrame(vRes)) > 0) {
+      nLastRecv = GetTimeMillis();
+      if (!vRes.empty()) {
+        nReceived += vRes.size();
+        nApplied += db.RemoteMany(vRes, source, nMember);
+      }
+      vRes.clear();
+    }
+    if (ret < 0) {
+      printf("federation: %s sent an invalid frame\n", peer.ToString().c_str());
+      break;
+    }
+    if (GetTimeMillis() - nLastRecv > FEDERATION_TIMEOUT * 1000) {
+      printf("federation: %s timed out\n", peer.ToString().c_str());
+      break;
+    }
+  }
+  printf("federation: session with %s closed\n", peer.ToString().c_str());
+  nPeers--;
+  if (nMember >= 0)
+    pPartition->AddSession(nMember, -1);
+  if (fInbound)
+    ReleaseInbound();
+  closesocket(sock);
+}
+
+struct CFedThreadArg {
+  CFederation *pFed;
+  SOCKET sock;
+  CService peer;
+  string strPeer;
+};
+
+extern "C" void* ThreadFedInbound(void* arg) {
+  CFedThreadArg *pArg = (CFedThreadArg*)arg;
+  pArg->pFed->RunSession(pArg->sock, pArg->peer, true);
+  delete pArg;
+  return nullptr;
+}
+
+extern "C" void* ThreadFedListen(void* arg) {
+  CFedThreadArg *pArg = (CFedThreadArg*)arg;
+  while (true) {
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET sock = accept(pArg->sock, (struct sockaddr*)&sockaddr, &len);
+    if (sock == INVALID_SOCKET) {
+      if (errno != EINTR && errno != ECONNABORTED)
+        Sleep(1000);
+      continue;
+    }
+    CService peer;
+    if (!peer.SetSockAddr((struct sockaddr*)&sockaddr) || !TakePending(peer)) {
+      closesocket(sock);
+      continue;
+    }
+    CFedThreadArg *pSession = new CFedThreadArg;
+    pSession->pFed = pArg->pFed;
+    pSession->sock = sock;
+    pSession->peer = peer;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, ThreadFedInbound, pSession) != 0) {
+      ReleasePending(peer, false);
+      closesocket(pSession->sock);
+      delete pSession;
+    }
+    pthread_attr_destroy(&attr);
+  }
+  return nullptr;
+}
+
+extern "C" void* ThreadFedConnect(void* arg) {
+  CFedThreadArg *pArg = (CFedThreadArg*)arg;
+  while (true) {
+    CService peer;
+    SOCKET sock;
+    if (Lookup(pArg->strPeer.c_str(), peer, 0, true) && peer.GetPort() != 0 && ConnectSocket(peer, sock))
+      pArg->pFed->RunSession(sock, peer, false);
+    Sleep(FEDERATION_RETRY * 1000);
+  }
+  return nullptr;
+}
+
+bool CFederation::Listen(const string &strBind) {
+  string str = strBind.find(':') == string::npos ? "0.0.0.0:" + strBind : strBind;
+  CService bind;
+  if (!Lookup(str.c_str(), bind, 0, false) || bind.GetPort() == 0) {
+    printf("federation: invalid listen address %s\n", strBind.c_str());
+    return false;
+  }
+  struct sockaddr_storage sockaddr;
+  socklen_t len = sizeof(sockaddr);
+  bind.GetSockAddr((struct sockaddr*)&sockaddr, &len);
+  SOCKET sock = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
+  int nOne = 1;
+  if (sock == INVALID_SOCKET || setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &nOne, sizeof(nOne)) != 0 ||
+      ::bind(sock, (struct sockaddr*)&sockaddr, len) != 0 || listen(sock, 16) != 0) {
+    printf("federation: cannot listen on %s: %s\n", bind.ToString().c_str(), strerror(errno));
+    if (sock != INVALID_SOCKET) closesocket(sock);
+    return false;
+  }
+  CFedThreadArg *pArg = new CFedThreadArg;
+  pArg->pFed = this;
+  pArg->sock = sock;
+  pthread_t thread;
+  pthread_create(&thread, NULL, ThreadFedListen, pArg);
+  return true;
+}
+
+void CFederation::Connect(const string &strPeer) {
+  CFedThreadArg *pArg = new CFedThreadArg;
+  pArg->pFed = this;
+  pArg->sock = INVALID_SOCKET;
+  pArg->strPeer = strPeer;
+  pthread_t thread;
+  pthread_create(&thread, NULL, ThreadFedConnect, pArg);
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _FEDERATION_H_
+#define _FEDERATION_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "db.h"
+
+// Crawl federation: seeders exchange the outcomes of their probes over TCP.
+//
+// Every instance streams the results of its own crawlers to all of its federation
+// peers; outcomes received from a peer are merged into the database as secondary
+// evidence (see CAddrDb::Remote_) and never forwarded, so they do not loop. Sessions
+// are symmetric once established, whichever side connected. In a cluster (see
+// CCrawlPartition), members are known by the names they announce, and the outcomes a
+// member reports for the nodes it owns are applied like our own.
+//
+// protocol (integers as written by CDataStream):
+//   hello: magic "VSFD", nVersion (4 bytes), nonce (32 random bytes), name length
+//          (1 byte), name, in both directions
+//   auth:  HMAC-SHA256(key, role, own nonce, peer's nonce, own name), role 'C' for the
+//          connecting side and 'S' for the accepting one; a wrong proof ends the session
+//   then frames: nSize (4 bytes), payload, tag (16 bytes)
+//     payload: std::vector<CRemoteResult>, SER_NETWORK; empty frames are keepalives
+//     tag: HMAC-SHA256(session key, direction, nSeq (8 bytes), payload), truncated;
+//          nSeq counts the frames sent in that direction, from 0
+//   session key: HMAC-SHA256(key, "session", connecting side's nonce, accepting side's nonce)
+//
+// A frame that is altered, replayed or reordered fails its tag and ends the session.
+
+static const char FEDERATION_MAGIC[4] = {'V', 'S', 'F', 'D'};
+static const uint32_t FEDERATION_VERSION = 2;
+
+#define FEDERATION_OUTBOX 100000   // own outcomes kept for sessions that fall behind
+#define FEDERATION_BATCH 1000      // outcomes per frame
+#define FEDERATION_MAX_FRAME 0x200000
+#define FEDERATION_KEEPALIVE 30    // seconds without a frame before sending an empty one
+#define FEDERATION_TIMEOUT 120     // seconds without a frame before giving up on a peer
+#define FEDERATION_RETRY 30        // seconds between attempts to reach a peer
+
+class CFederationStats {
+public:
+  int nPeers;         // authenticated sessions
+  int64 nSent;        // outcomes sent, summed over sessions
+  int64 nReceived;    // outcomes received
+  int64 nApplied;     // of which changed the database
+  int64 nSkipped;     // outcomes not sent to a session that fell too far behind
+  int64 nAuthFailed;  // sessions that failed the handshake
+};
+
+class CFederation {
+private:
+  CAddrDb &db;
+  std::string strKey;
+  std::string strName;                // announced to peers
+  CCrawlPartition *pPartition;        // cluster members, NULL if not partitioning
+  CCriticalSection cs;                // protects outbox and nOutboxSeq
+  std::deque<CRemoteResult> outbox;   // recent own outcomes, for the sessions to send
+  uint64 nOutboxSeq;                  // sequence number of outbox.front()
+  std::atomic<int> nPeers;
+  std::atomic<int64> nSent, nReceived, nApplied, nSkipped, nAuthFailed;
+
+  // copy outcomes from nSeq on (at most max), advancing nSeq
+  void Take(uint64 &nSeq, std::vector<CRemoteResult> &vRes, int max);
+
+public:
+  CFederation(CAddrDb &dbIn, const std::string &strKeyIn, const std::string &strNameIn, CCrawlPartition *pPartitionIn = NULL) : db(dbIn), strKey(strKeyIn), strName(strNameIn), pPartition(pPartitionIn), nOutboxSeq(0), nPeers(0), nSent(0), nReceived(0), nApplied(0), nSkipped(0), nAuthFailed(0) {}
+
+  // queue the outcomes of our own probes for all sessions
+  void Publish(const std::vector<CServiceResult> &ips, int64 now);
+
+  // Accept peers on strBind ("port" or "host:port"), in a new thread. False if the
+  // socket cannot be set up.
+  bool Listen(const std::string &strBind);
+  // keep a session to a peer ("host:port") up, in a new thread
+  void Connect(const std::string &strPeer);
+
+  // run one session on a connected socket until it fails (closes the socket)
+  void RunSession(SOCKET sock, const CService &peer, bool fInbound);
+
+  void GetStats(CFederationStats &stats) const {
+    stats.nPeers = nPeers;
+    stats.nSent = nSent;
+    stats.nReceived = nReceived;
+    stats.nApplied = nApplied;
+    stats.nSkipped = nSkipped;
+    stats.nAuthFailed = nAuthFailed;
+  }
+};
+
+#endif
@@ -0,0 +1,61 @@
+#!/bin/bash
+# Starts three federated seeders on loopback, each in its own directory, and
+# checks that every one of them establishes sessions with the other two, and
+# that a connection without the key is turned away.
+#
+# usage: ./fedtest.sh [seconds to wait, default 40] [--fedmembers]
+# Seeders retry an unreachable peer every 30 seconds (FEDERATION_RETRY), so the
+# ones started first only reach the later ones on their second attempt.
+# With --fedmembers the three also split the crawl between them.
+
+DNSSEED="$(cd "$(dirname "$0")" && pwd)/dnsseed"
+WAIT=${1:-40}
+BASE=${FEDTEST_PORT:-27400}
+KEY=fedtest-$$
+DIR=$(mktemp -d /tmp/fedtest.XXXXXX)
+
+[ -x "$DNSSEED" ] || { echo "build dnsseed first (make)"; exit 1; }
+
+MEMBERS=
+[ "$2" = "--fedmembers" ] && MEMBERS="--fedmembers seed0,seed1,seed2"
+
+PIDS=
+trap 'kill $PIDS 2>/dev/null; wait 2>/dev/null' EXIT INT TERM
+
+for i in 0 1 2; do
+  PEERS=
+  for j in 0 1 2; do
+    [ $j -ne $i ] && PEERS="$PEERS --fedpeer 127.0.0.1:$((BASE + 10 + j))"
+  done
+  mkdir "$DIR/seed$i"
+  (cd "$DIR/seed$i" && exec "$DNSSEED" -m fedtest.example.com -p $((BASE + i)) \
+     --fedlisten 127.0.0.1:$((BASE + 10 + i)) $PEERS --fedkey $KEY --fedname seed$i $MEMBERS \
+     >seed$i.log 2>&1) &
+  PIDS="$PIDS $!"
+done
+
+sleep 2
+# a client without the key; it must fail the handshake, not hold a session
+exec 3<>/dev/tcp/127.0.0.1/$((BASE + 10)) 2>/dev/null && printf 'GET / HTTP/1.0\r\n\r\n' >&3
+sleep "$WAIT"
+exec 3>&-
+
+FAIL=0
+for i in 0 1 2; do
+  N=$(grep -o "federation: session with [^ ]* ([^)]*) established" "$DIR/seed$i/seed$i.log" | wc -l)
+  echo "seed$i: $N sessions established"
+  [ "$N" -ge 4 ] || FAIL=1  # an inbound and an outbound session with each of the other two
+done
+if grep -q "federation: 127.0.0.1:[0-9]* failed the handshake" "$DIR/seed0/seed0.log"; then
+  echo "seed0: rejected the client without the key"
+else
+  echo "seed0: did not reject the client without the key"; FAIL=1
+fi
+
+if [ $FAIL -eq 0 ]; then
+  echo "ok"
+  rm -rf "$DIR"
+else
+  echo "FAILED, logs are in $DIR"
+fi
+exit $FAIL
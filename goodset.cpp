@@ -0,0 +1,109 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "goodset.h"
+#include "dbfile.h"
+#include "util.h"
+
+using namespace std;
+
+bool CGoodSet::Load(const string &strFile, string &strError) {
+  mapBuckets.clear();
+  FILE *file = fopen(strFile.c_str(), "rb");
+  if (!file) {
+    strError = strerror(errno);
+    return false;
+  }
+  CGoodSetHeader hdr;
+  CDbChecksum checksum;
+  bool fOk = fread(&hdr, sizeof(hdr), 1, file) == 1 && memcmp(hdr.magic, GOODSET_MAGIC, sizeof(GOODSET_MAGIC)) == 0 &&
+             hdr.nVersion == GOODSET_VERSION && hdr.nAddrSize == sizeof(addr_t);
+  for (uint32_t i = 0; fOk && i < hdr.nBuckets; i++) {
+    CGoodSetBucket bucket;
+    if (fread(&bucket, sizeof(bucket), 1, file) != 1 || bucket.nAddrs > 65536) {
+      fOk = false;
+      break;
+    }
+    checksum.Write(&bucket, sizeof(bucket));
+    vector<addr_t> &vAddr = mapBuckets[bucket.nFlags];
+    vAddr.resize(bucket.nAddrs);
+    if (bucket.nAddrs && fread(&vAddr[0], sizeof(addr_t), bucket.nAddrs, file) != bucket.nAddrs) {
+      fOk = false;
+      break;
+    }
+    checksum.Write(&vAddr[0], sizeof(addr_t) * bucket.nAddrs);
+  }
+  fclose(file);
+  if (!fOk || checksum.Finalize() != hdr.nChecksum) {
+    strError = "truncated or malformed file";
+    mapBuckets.clear();
+    return false;
+  }
+  nTime = hdr.nTime;
+  return true;
+}
+
+bool CGoodSet::Write(const string &strFile, const map<uint64_t, vector<addr_t> > &mapBuckets) {
+  string strTemp = strFile + ".new";
+  FILE *file = fopen(strTemp.c_str(), "wb");
+  if (!file) {
+    printf("Error: cannot create %s: %s\n", strTemp.c_str(), strerror(errno));
+    return false;
+  }
+  CGoodSetHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, GOODSET_MAGIC, sizeof(GOODSET_MAGIC));
+  hdr.nVersion = GOODSET_VERSION;
+  hdr.nTime = time(NULL);
+  hdr.nBuckets = mapBuckets.size();
+  hdr.nAddrSize = sizeof(addr_t);
+  CDbChecksum checksum;
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  for (map<uint64_t, vector<addr_t> >::const_iterator it = mapBuckets.begin(); it != mapBuckets.end(); it++) {
+    CGoodSetBucket bucket;
+    memset(&bucket, 0, sizeof(bucket));
+    bucket.nFlags = (*it).first;
+    bucket.nAddrs = (*it).second.size();
+    fwrite(&bucket, sizeof(bucket), 1, file);
+    checksum.Write(&bucket, sizeof(bucket));
+    if (bucket.nAddrs) {
+      fwrite(&(*it).second[0], sizeof(addr_t), bucket.nAddrs, file);
+      checksum.Write(&(*it).second[0], sizeof(addr_t) * bucket.nAddrs);
+    }
+  }
+  hdr.nChecksum = checksum.Finalize();
+  fseek(file, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  bool ret = fflush(file) == 0 && fsync(fileno(file)) == 0;
+  fclose(file);
+  if (!ret || rename(strTemp.c_str(), strFile.c_str()) != 0) {
+    printf("Error: writing %s failed: %s\n", strFile.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _GOODSET_H_
+#define _GOODSET_H_ 1
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "addr.h"
+
+// Good-set sidecar file (dnsseed.good), version 1
+//
+//   CGoodSetHeader
+//   nBuckets times: CGoodSetBucket, then addr_t[nAddrs]
+//
+// A bucket holds a ready-made DNS answer pool (as cached by the DNS threads) for one
+// service filter. It is written next to every snapshot, so that after a restart the DNS
+// threads can answer from it while the full database is still loading. Like the
+// database file, it is stored in host byte order; nChecksum covers everything after
+// the header.
+
+static const char GOODSET_MAGIC[4] = {'V', 'S', 'G', 'S'};
+static const uint32_t GOODSET_VERSION = 1;
+
+struct CGoodSetHeader {
+  char magic[4];
+  uint32_t nVersion;
+  int64_t nTime;           // time the file was written
+  uint32_t nBuckets;
+  uint32_t nAddrSize;      // sizeof(addr_t), as a sanity check
+  uint64_t nChecksum;
+};
+
+struct CGoodSetBucket {
+  uint64_t nFlags;         // requested service flags the addresses were sampled for
+  uint32_t nAddrs;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(CGoodSetHeader) == 32, "unexpected CGoodSetHeader size");
+static_assert(sizeof(CGoodSetBucket) == 16, "unexpected CGoodSetBucket size");
+
+class CGoodSet {
+private:
+  std::map<uint64_t, std::vector<addr_t> > mapBuckets;
+  int64_t nTime;
+
+public:
+  CGoodSet() : nTime(0) {}
+
+  bool Load(const std::string &strFile, std::string &strError);
+  // written as strFile.new and renamed over strFile
+  static bool Write(const std::string &strFile, const std::map<uint64_t, std::vector<addr_t> > &mapBuckets);
+
+  bool IsEmpty() const { return mapBuckets.empty(); }
+  int64_t GetTime() const { return nTime; }
+  // the answer pool for a service filter (NULL if there is none)
+  const std::vector<addr_t> *Get(uint64_t nFlags) const {
+    std::map<uint64_t, std::vector<addr_t> >::const_iterator it = mapBuckets.find(nFlags);
+    return it != mapBuckets.end() ? &(*it).second : NULL;
+  }
+};
+
+#endif
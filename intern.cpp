@@ -0,0 +1,93 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <pthread.h>
+
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+#include "intern.h"
+
+using namespace std;
+
+// Open addressing table of ids (+1, 0 means empty), twice the size of the id space.
+// Writers hold csIntern; they publish a string before the slot that refers to it,
+// so a reader that finds a slot can always read its string.
+static const uint32_t nSlots = 2 * MAX_SUBVERSIONS;
+static atomic<uint32_t> vSlot[nSlots];
+static atomic<const string*> vString[MAX_SUBVERSIONS];
+static atomic<uint32_t> nStrings(1);
+static pthread_mutex_t csIntern = PTHREAD_MUTEX_INITIALIZER;
+static const string strEmpty;
+static unordered_map<uint64_t, int> mapGroupAdded; // strings added per network group (InternPeerSubVersion)
+
+// returns the id of str, or 0 with nSlot set to the empty slot where it would go
+static uint32_t Find(const string &str, uint32_t &nSlot) {
+  nSlot = hash<string>()(str) & (nSlots - 1);
+  while (true) {
+    uint32_t n = vSlot[nSlot].load(memory_order_acquire);
+    if (n == 0) return 0;
+    if (*vString[n - 1].load(memory_order_relaxed) == str) return n - 1;
+    nSlot = (nSlot + 1) & (nSlots - 1);
+  }
+}
+
+// pGroup: the network group to charge a new string to (NULL if trusted)
+static uint32_t Intern(const string &str, const uint64_t *pGroup) {
+  if (str.empty()) return 0;
+  uint32_t nSlot;
+  uint32_t nId = Find(str, nSlot);
+  if (nId) return nId;
+  pthread_mutex_lock(&csIntern);
+  // another thread may have added it in the meantime
+  nId = Find(str, nSlot);
+  if (!nId && nStrings < MAX_SUBVERSIONS && (!pGroup || mapGroupAdded[*pGroup] < SUBVERSIONS_PER_GROUP)) {
+    if (pGroup) mapGroupAdded[*pGroup]++;
+    nId = nStrings;
+    vString[nId].store(new string(str), memory_order_release);
+    vSlot[nSlot].store(nId + 1, memory_order_release);
+    nStrings.store(nId + 1, memory_order_release);
+  }
+  pthread_mutex_unlock(&csIntern);
+  return nId;
+}
+
+uint32_t InternSubVersion(const string &str) {
+  return Intern(str, NULL);
+}
+
+uint32_t InternPeerSubVersion(const string &str, uint64_t nGroup) {
+  if (str.size() > MAX_SUBVERSION_LENGTH) return 0;
+  for (string::const_iterator it = str.begin(); it != str.end(); it++)
+    if (*it < 0x20 || *it > 0x7e) return 0;
+  return Intern(str, &nGroup);
+}
+
+const string &GetSubVersion(uint32_t nId) {
+  if (nId == 0 || nId >= nStrings.load(memory_order_acquire)) return strEmpty;
+  return *vString[nId].load(memory_order_acquire);
+}
+
+uint32_t GetSubVersionCount() {
+  return nStrings.load(memory_order_acquire);
+}
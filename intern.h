@@ -0,0 +1,52 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _INTERN_H_
+#define _INTERN_H_ 1
+
+#include <stdint.h>
+
+#include <string>
+
+// Interned client subversion strings.
+//
+// There are only a few dozen distinct subversions on a network, so nodes store a
+// small id instead of their own copy of the string. Ids and the strings they refer
+// to stay valid for the lifetime of the process, but are not stable across restarts:
+// files store the strings themselves. Looking up a string that is already interned
+// takes no lock. The table holds at most MAX_SUBVERSIONS strings; once it is full,
+// new strings are interned as the empty string (id 0).
+
+#define MAX_SUBVERSIONS 16384
+#define MAX_SUBVERSION_LENGTH 128 // longer subversions announced by nodes are not kept
+#define SUBVERSIONS_PER_GROUP 16  // new strings the nodes of one network group may add
+
+uint32_t InternSubVersion(const std::string &str);
+// Intern a subversion a node in network group nGroup (see GetGroupKey) announced. Nodes
+// choose it freely, so it is only kept if it is printable and not overly long, and only
+// added if that group's nodes added fewer than SUBVERSIONS_PER_GROUP strings before;
+// otherwise it becomes the empty string. This keeps a few nodes from filling the table.
+uint32_t InternPeerSubVersion(const std::string &str, uint64_t nGroup);
+const std::string &GetSubVersion(uint32_t nId);
+uint32_t GetSubVersionCount(); // ids are 0 .. GetSubVersionCount() - 1
+
+#endif
@@ -0,0 +1,159 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+using namespace std;
+
+CAddrJournal::CAddrJournal(const string &strPathIn, int nSyncIntervalIn) : strPath(strPathIn), fd(-1), fdOld(-1), vRecord(SER_DISK), nSeq(0), nLastSync(0), nSyncInterval(nSyncIntervalIn), nRecords(0), nBytes(0) {}
+
+CAddrJournal::~CAddrJournal() {
+  if (fd != -1) close(fd);
+}
+
+bool CAddrJournal::Open(uint64 nSeqIn, long nValidSize) {
+  CRITICAL_BLOCK(csFile) {
+    fd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1) {
+      printf("Error: cannot open %s: %s\n", strPath.c_str(), strerror(errno));
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > nValidSize)
+      ftruncate(fd, nValidSize);
+    nSeq = nSeqIn;
+    nLastSync = time(NULL);
+  }
+  return true;
+}
+
+CDataStream& CAddrJournal::BeginRecord(unsigned char nType, int64 nTime) {
+  cs.Enter();
+  vRecord.clear();
+  vRecord << nType << ++nSeq << nTime;
+  return vRecord;
+}
+
+void CAddrJournal::EndRecord() {
+  unsigned int nSize = vRecord.size();
+  uint256 hash = Hash(vRecord.begin(), vRecord.end());
+  unsigned int nChecksum = 0;
+  memcpy(&nChecksum, &hash, sizeof(nChecksum));
+  vBuffer.insert(vBuffer.end(), BEGIN(nSize), END(nSize));
+  vBuffer.insert(vBuffer.end(), BEGIN(nChecksum), END(nChecksum));
+  vBuffer.insert(vBuffer.end(), vRecord.begin(), vRecord.end());
+  nRecords++;
+  cs.Leave();
+}
+
+// csFile must be held
+void CAddrJournal::Write_() {
+  CRITICAL_BLOCK(cs)
+    vWrite.swap(vBuffer);
+  if (vWrite.empty() || fd == -1) {
+    vWrite.clear();
+    return;
+  }
+  size_t nPos = 0;
+  while (nPos < vWrite.size()) {
+    ssize_t ret = write(fd, &vWrite[nPos], vWrite.size() - nPos);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      printf("Error: writing %s failed: %s\n", strPath.c_str(), strerror(errno));
+      break;
+    }
+    nPos += ret;
+  }
+  nBytes += nPos;
+  vWrite.clear();
+}
+
+// csFile must be held
+void CAddrJournal::Sync_() {
+  if (fd != -1) fdatasync(fd);
+  nLastSync = time(NULL);
+}
+
+void CAddrJournal::Flush(bool fSync) {
+  CRITICAL_BLOCK(csFile) {
+    Write_();
+    if (fSync || time(NULL) - nLastSync >= nSyncInterval)
+      Sync_();
+  }
+}
+
+uint64 CAddrJournal::Rotate() {
+  uint64 nSeqRet = 0;
+  CRITICAL_BLOCK(csFile) {
+    CRITICAL_BLOCK(cs) {
+      nSeqRet = nSeq;
+      // if a previous snapshot did not make it to disk, its journal is still needed; keep appending here
+      if (access(GetOldPath().c_str(), F_OK) != 0 && rename(strPath.c_str(), GetOldPath().c_str()) == 0) {
+        vRotate.swap(vBuffer);
+        fdOld = fd;
+        fd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1)
+          printf("Error: cannot open %s: %s\n", strPath.c_str(), strerror(errno));
+      }
+    }
+  }
+  return nSeqRet;
+}
+
+void CAddrJournal::FinishRotate() {
+  CRITICAL_BLOCK(csFile) {
+    if (fdOld != -1) {
+      if (!vRotate.empty() && write(fdOld, &vRotate[0], vRotate.size()) == (ssize_t)vRotate.size())
+        nBytes += vRotate.size();
+      fdatasync(fdOld);
+      close(fdOld);
+      fdOld = -1;
+    }
+    vRotate.clear();
+  }
+}
+
+void CAddrJournal::RemoveOld() {
+  CRITICAL_BLOCK(csFile)
+    unlink(GetOldPath().c_str());
+}
+
+bool ReadJournalRecord(FILE *file, unsigned char &nType, uint64 &nSeq, int64 &nTime, CDataStream &ssBody) {
+  unsigned int nSize, nChecksum;
+  if (fread(&nSize, sizeof(nSize), 1, file) != 1) return false;
+  if (fread(&nChecksum, sizeof(nChecksum), 1, file) != 1) return false;
+  if (nSize < 17 || nSize > MAX_SIZE) return false;
+  vector<char> vch(nSize);
+  if (fread(&vch[0], 1, nSize, file) != nSize) return false;
+  uint256 hash = Hash(vch.begin(), vch.end());
+  unsigned int nCheck = 0;
+  memcpy(&nCheck, &hash, sizeof(nCheck));
+  if (nCheck != nChecksum) return false;
+  ssBody.clear();
+  ssBody.write(&vch[0], vch.size());
+  ssBody >> nType >> nSeq >> nTime;
+  return true;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_ 1
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "serialize.h"
+#include "util.h"
+
+// state transitions recorded in the journal
+enum {
+  JOURNAL_ADD = 1,  // CAddress addr, bool force
+  JOURNAL_GOOD = 2, // CService ip, int clientV, string clientSV, int blocks
+  JOURNAL_BAD = 3,  // CService ip, int ban (bans are derived from this on replay)
+  JOURNAL_SKIP = 4, // CService ip
+  JOURNAL_EVICT = 5, // CService ip
+  JOURNAL_REMOTE = 6, // CRemoteResult res (only those that postponed a revisit, see CAddrDb::Remote_)
+};
+
+// Append-only log of CAddrDb state transitions, replayed on top of the last
+// snapshot after a restart.
+//
+// record format:
+//   nSize (4 bytes, size of the payload)
+//   nChecksum (4 bytes, first 4 bytes of Hash(payload))
+//   payload: nType (1 byte), nSeq (8 bytes), nTime (8 bytes), body
+//
+// Records are buffered in memory and written by Flush(), which is called
+// about once per second by the journal thread; fsync is done at most once
+// every nSyncInterval seconds (group commit). A snapshot records the sequence
+// number returned by Rotate(); replay skips everything up to it.
+class CAddrJournal {
+private:
+  CCriticalSection cs;       // protects vBuffer, nSeq and vRecord
+  CCriticalSection csFile;   // protects fd and the files on disk (taken before cs)
+  std::string strPath;
+  int fd;
+  int fdOld;                 // previous file, until FinishRotate() has completed it
+  std::vector<char> vBuffer; // records not yet written to disk
+  std::vector<char> vWrite;  // records being written (only touched with csFile held)
+  std::vector<char> vRotate; // records that still belong in the previous file
+  CDataStream vRecord;       // record under construction
+  uint64 nSeq;               // sequence number of the last appended record
+  int64 nLastSync;
+  int nSyncInterval;
+  uint64 nRecords;           // records appended since startup
+  uint64 nBytes;             // bytes written since startup
+
+  void Write_();
+  void Sync_();
+
+public:
+  CAddrJournal(const std::string &strPathIn, int nSyncIntervalIn = 2);
+  ~CAddrJournal();
+
+  std::string GetPath() const { return strPath; }
+  std::string GetOldPath() const { return strPath + ".old"; }
+
+  // open the journal for appending, discarding anything after nValidSize (a torn tail found by replay)
+  bool Open(uint64 nSeqIn, long nValidSize);
+
+  // start and finish a record; the body is serialized into the returned stream in between
+  CDataStream& BeginRecord(unsigned char nType, int64 nTime);
+  void EndRecord();
+
+  // write buffered records; fsync if forced or if the sync interval has passed
+  void Flush(bool fSync = false);
+
+  // Start a new journal file and return the sequence number of the last record in the
+  // old one. Must be called while the database cannot change, i.e. with (at least) a
+  // shared lock on it; it only renames files, the old one is completed (written and
+  // synced) by FinishRotate() once that lock is released. The old file is kept until
+  // RemoveOld() is called after the corresponding snapshot is safely on disk.
+  uint64 Rotate();
+  void FinishRotate();
+  void RemoveOld();
+
+  uint64 GetRecords() const { return nRecords; }
+  uint64 GetBytes() const { return nBytes; }
+};
+
+// Read the next record from a journal file. Returns false at the end of the file,
+// and on a torn or corrupt record (everything after it is ignored).
+bool ReadJournalRecord(FILE *file, unsigned char &nType, uint64 &nSeq, int64 &nTime, CDataStream &ssBody);
+
+#endif
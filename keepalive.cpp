@@ -0,0 +1,225 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <poll.h>
+#include <pthread.h>
+
+#include "intern.h"
+#include "keepalive.h"
+#include "util.h"
+
+using namespace std;
+
+void CKeepAlive::Drop(CLink &link, bool fDue) {
+  delete link.pLink;
+  link.pLink = NULL;
+  db.Release(link.ip, fDue);
+  nTaken--;
+}
+
+void CKeepAlive::Harvest(CLink &link, int64 now) {
+  vector<CAddress> vAddr;
+  link.pLink->TakeAddr(vAddr);
+  if (vAddr.empty()) return;
+  nGossip += vAddr.size();
+  if (now - nSeenSince > HARVEST_FILTER_TIME || setSeen[0].size() > HARVEST_FILTER_SIZE) {
+    setSeen[1].swap(setSeen[0]);
+    setSeen[0].clear();
+    nSeenSince = now;
+  }
+  vector<CAddress> vNew;
+  for (int i = 0; i < vAddr.size(); i++) {
+    const CService &ip = vAddr[i];
+    if (setSeen[1].count(ip) || !setSeen[0].insert(ip).second)
+      continue;
+    vNew.push_back(vAddr[i]);
+  }
+  if (vNew.empty()) return;
+  nHarvestQueued += vNew.size();
+  vHarvest.push_back(make_pair(link.ip, vector<CAddress>()));
+  vHarvest.back().second.swap(vNew);
+}
+
+void CKeepAlive::Flush(int64 now) {
+  if (nHarvestQueued < HARVEST_BATCH && now - nLastFlush < HARVEST_FLUSH) return;
+  nLastFlush = now;
+  for (int i = 0; i < vHarvest.size(); i++)
+    db.Add(vHarvest[i].second, vHarvest[i].first);
+  nHarvested += nHarvestQueued;
+  vHarvest.clear();
+  nHarvestQueued = 0;
+}
+
+void CKeepAlive::Dial() {
+  do {
+    int nWant = std::min(nMax - (int)nTaken, KEEPALIVE_BATCH);
+    vector<CService> ips;
+    if (nWant > 0)
+      db.TakeKeep(ips, nWant);
+    if (ips.empty()) {
+      Sleep(10000);
+      continue;
+    }
+    nTaken += ips.size();
+    int nOk = 0;
+    for (int i = 0; i < ips.size(); i++) {
+      CLink link;
+      link.ip = ips[i];
+      link.pLink = new CNodeLink(net, ips[i], fHarvest);
+      link.nOpened = time(NULL);
+      link.nPingSent = 0;
+      link.nLastPing = link.nOpened;
+      link.nLastCredit = 0;
+      if (!link.pLink->Open()) {
+        nFailed++;
+        Drop(link, true);
+        continue;
+      }
+      nOpened++;
+      nOk++;
+      CRITICAL_BLOCK(cs)
+        vNew.push_back(link);
+    }
+    // a whole batch failing usually means a local problem (no fds, no route): back off
+    if (nOk == 0)
+      Sleep(1000);
+  } while(1);
+}
+
+void CKeepAlive::Poll() {
+  vector<CLink> vLink;
+  vector<struct pollfd> vPoll;
+  do {
+    CRITICAL_BLOCK(cs) {
+      vLink.insert(vLink.end(), vNew.begin(), vNew.end());
+      vNew.clear();
+    }
+    if (vLink.empty()) {
+      if (fHarvest)
+        Flush(time(NULL));
+      Sleep(1000);
+      continue;
+    }
+    vPoll.resize(vLink.size());
+    for (int i = 0; i < vLink.size(); i++) {
+      vPoll[i].fd = vLink[i].pLink->GetSocket();
+      vPoll[i].events = POLLIN | (vLink[i].pLink->WantsWrite() ? POLLOUT : 0);
+      vPoll[i].revents = 0;
+    }
+    if (poll(&vPoll[0], vPoll.size(), 1000) < 0 && errno != EINTR) {
+      Sleep(1000);
+      continue;
+    }
+    int64 now = time(NULL);
+    int nReady = 0;
+    for (int i = 0; i < vLink.size(); i++) {
+      CLink &link = vLink[i];
+      bool fWasReady = link.pLink->IsReady();
+      bool fAlive = !vPoll[i].revents || link.pLink->Pump();
+      if (fHarvest)
+        Harvest(link, now);
+      if (!fAlive) {
+        if (fWasReady) nDropped++; else nFailed++;
+        Drop(link, true);
+        continue;
+      }
+      if (!link.pLink->IsReady()) {
+        if (now - link.nOpened > KEEPALIVE_TIMEOUT) {
+          nFailed++;
+          Drop(link, true);
+        }
+        continue;
+      }
+      bool fAnswered = !link.nLastCredit;
+      if (link.nPingSent && link.pLink->GetLastPong() >= link.nPingSent) {
+        nPongs++;
+        link.nPingSent = 0;
+        fAnswered = true;
+      }
+      if (link.nPingSent && now - link.nPingSent > KEEPALIVE_TIMEOUT) {
+        nDropped++;
+        Drop(link, true);
+        continue;
+      }
+      if (fAnswered && now - link.nLastCredit >= MIN_RETRY) {
+        CServiceResult res = {};
+        res.service = link.ip;
+        res.fGood = true;
+        res.nClientV = link.pLink->GetClientVersion();
+        res.nClientSV = InternPeerSubVersion(link.pLink->GetClientSubVersion(), GetGroupKey(link.ip));
+        res.nHeight = link.pLink->GetStartingHeight();
+        res.nServices = link.pLink->GetServices();
+        uint64 nNonce;
+        CService addrFrom;
+        link.pLink->GetIdentity(nNonce, addrFrom);
+        SetClusterKeys(res, nNonce, addrFrom);
+        // the handshake times with the first credit, the latest ping after that
+        int nConnect, nHandshake, nPing;
+        link.pLink->GetRtt(nConnect, nHandshake, nPing);
+        if (!link.nLastCredit) {
+          res.rtt.nConnect = nConnect;
+          res.rtt.nHandshake = nHandshake;
+        } else {
+          res.rtt.nPing = nPing;
+        }
+        link.nLastCredit = now;
+        nProbes++;
+        if (!db.KeptGood(res)) {
+          // no longer good (say, an old version): back to normal probing
+          Drop(link, false);
+          continue;
+        }
+      }
+      if (!link.nPingSent && now - link.nLastPing >= KEEPALIVE_PING) {
+        link.pLink->Ping(((uint64)rand() << 32) | (uint64)rand() | 1);
+        link.nPingSent = link.nLastPing = now;
+      }
+      nReady++;
+    }
+    // compact away the dropped links
+    int j = 0;
+    for (int i = 0; i < vLink.size(); i++)
+      if (vLink[i].pLink)
+        vLink[j++] = vLink[i];
+    vLink.resize(j);
+    nLinks = nReady;
+    if (fHarvest)
+      Flush(now);
+  } while(1);
+}
+
+extern "C" void* ThreadKeepAliveDial(void* arg) {
+  ((CKeepAlive*)arg)->Dial();
+  return nullptr;
+}
+
+extern "C" void* ThreadKeepAlivePoll(void* arg) {
+  ((CKeepAlive*)arg)->Poll();
+  return nullptr;
+}
+
+void CKeepAlive::Start() {
+  pthread_t thread;
+  pthread_create(&thread, NULL, ThreadKeepAlivePoll, this);
+  for (int i = 0; i < KEEPALIVE_DIALERS; i++)
+    pthread_create(&thread, NULL, ThreadKeepAliveDial, this);
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _KEEPALIVE_H_
+#define _KEEPALIVE_H_ 1
+
+#include <atomic>
+#include <set>
+#include <vector>
+
+#include "bitcoin.h"
+#include "db.h"
+
+// Keep-alive tier: persistent connections to a bounded set of good nodes.
+//
+// Revalidating a good node normally costs a new connection, the version handshake and a
+// teardown every MIN_RETRY seconds or so. Instead, dialer threads take good nodes off the
+// crawl schedule (see CAddrDb::TakeKeep) and open connections to them, which one thread
+// polls. Every link is pinged each KEEPALIVE_PING seconds; a completed handshake, and after
+// that an answered ping at most once per MIN_RETRY seconds, is recorded as a successful
+// probe (CAddrDb::KeptGood), so reliability statistics accrue as with normal probing. A
+// link that fails or misses a pong is closed and its node handed back to the crawlers, due
+// at once (CAddrDb::Release), so a node that went down is noticed within about
+// KEEPALIVE_PING + KEEPALIVE_TIMEOUT seconds rather than at its next revisit.
+//
+// With harvesting on, the links also serve as listeners: the addr messages nodes relay to
+// their peers unasked are collected (no getaddr is sent), run through a short-lived filter
+// that drops addresses seen on any link in the last HARVEST_FILTER_TIME seconds or so, and
+// fed to the database in batches every HARVEST_FLUSH seconds, attributed to the node that
+// relayed them so the usual ingestion quotas apply.
+
+#define KEEPALIVE_PING 60      // seconds between pings on a link
+#define KEEPALIVE_TIMEOUT 60   // seconds for the handshake, and for a ping to be answered
+#define KEEPALIVE_DIALERS 4    // threads opening links (connecting blocks)
+#define KEEPALIVE_BATCH 16     // nodes a dialer takes at a time
+#define HARVEST_FLUSH 5        // seconds between batches of gossiped addresses
+#define HARVEST_BATCH 1000     // or sooner, once this many are queued
+#define HARVEST_FILTER_TIME 600   // seconds an address stays in the filter (up to twice that)
+#define HARVEST_FILTER_SIZE 100000 // addresses per filter generation
+
+class CKeepAliveStats {
+public:
+  int nLinks;      // links with a completed handshake
+  int64 nOpened;   // connections made
+  int64 nFailed;   // nodes that could not be reached, or did not complete the handshake
+  int64 nDropped;  // links lost after the handshake (or that missed a pong)
+  int64 nPongs;    // answered pings
+  int64 nProbes;   // successful probes recorded from links
+  int64 nGossip;   // addresses gossiped on links (if harvesting)
+  int64 nHarvested; // of which passed the filter and went to the database
+};
+
+class CKeepAlive {
+private:
+  struct CLink {
+    CService ip;
+    CNodeLink *pLink;
+    int64 nOpened;
+    int64 nPingSent;   // when the unanswered ping was sent, 0 if none is
+    int64 nLastPing;   // when the last ping was sent
+    int64 nLastCredit; // when the last probe was recorded, 0 before the handshake
+  };
+
+  CAddrDb &db;
+  const CNetParams &net;
+  int nMax;
+  bool fHarvest;
+  CCriticalSection cs;       // protects vNew
+  std::vector<CLink> vNew;   // opened by the dialers, not yet polled
+  std::atomic<int> nTaken;   // nodes taken from the database and not released
+  std::atomic<int> nLinks;
+  std::atomic<int64> nOpened, nFailed, nDropped, nPongs, nProbes, nGossip, nHarvested;
+
+  // harvesting (poller thread only)
+  std::set<CService> setSeen[2];  // filter: current and previous generation
+  int64 nSeenSince;               // when the current generation was started
+  std::vector<std::pair<CService, std::vector<CAddress> > > vHarvest; // queued, by relaying node
+  int nHarvestQueued;
+  int64 nLastFlush;
+
+  // collect the addresses a link received, and queue those not seen lately
+  void Harvest(CLink &link, int64 now);
+  // hand the queued addresses to the database
+  void Flush(int64 now);
+
+  // close a link and hand its node back to the crawlers (due at once if fDue)
+  void Drop(CLink &link, bool fDue);
+
+public:
+  CKeepAlive(CAddrDb &dbIn, const CNetParams &netIn, int nMaxIn, bool fHarvestIn = false) : db(dbIn), net(netIn), nMax(nMaxIn), fHarvest(fHarvestIn), nTaken(0), nLinks(0), nOpened(0), nFailed(0), nDropped(0), nPongs(0), nProbes(0), nGossip(0), nHarvested(0), nSeenSince(0), nHarvestQueued(0), nLastFlush(0) {}
+
+  // start the dialer and poller threads
+  void Start();
+
+  void Dial(); // thread bodies
+  void Poll();
+
+  bool IsHarvesting() const { return fHarvest; }
+
+  void GetStats(CKeepAliveStats &stats) const {
+    stats.nLinks = nLinks;
+    stats.nOpened = nOpened;
+    stats.nFailed = nFailed;
+    stats.nDropped = nDropped;
+    stats.nPongs = nPongs;
+    stats.nProbes = nProbes;
+    stats.nGossip = nGossip;
+    stats.nHarvested = nHarvested;
+  }
+};
+
+#endif
@@ -27,17 +27,48 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <atomic>
 #include <iostream>
 
 #include "bitcoin.h"
+#include "crawlctl.h"
 #include "db.h"
+#include "dbfile.h"
+#include "report.h"
+#include "goodset.h"
+#include "federation.h"
+#include "keepalive.h"
+#include "shmtable.h"
 
 using namespace std;
 
-bool fMainNet = true;
+// long options without a short equivalent
+enum {
+  OPT_DUMPFORMAT = 256,
+  OPT_DUMPTOP,
+  OPT_MAXNODES,
+  OPT_SRCQUOTA,
+  OPT_GROUPQUOTA,
+  OPT_WARMTHREADS,
+  OPT_FEDLISTEN,
+  OPT_FEDPEER,
+  OPT_FEDKEY,
+  OPT_FEDNAME,
+  OPT_FEDMEMBERS,
+  OPT_FEDSAMPLE,
+  OPT_SHM,
+  OPT_FRONTEND,
+  OPT_ZONE,
+  OPT_KEEPALIVE,
+  OPT_RTTBIAS,
+  OPT_REVISITMAX,
+  OPT_STALENESS,
+  OPT_CRAWLMIN,
+  OPT_GROUPFLIGHT,
+};
 
 class CDnsSeedOpts {
 public:
@@ -47,12 +78,37 @@ public:
   int fUseTestNet;
   int fWipeBan;
   int fWipeIgnore;
+  int fNoJournal;
+  int nCompactDirty;
+  int fConvertDb;
+  int nReportFormats;
+  int nReportTop;
+  int nMaxNodes;
+  int nSourceQuota;
+  int nGroupQuota;
+  int nWarmThreads;
+  int nCrawlMin;
+  int nGroupFlight;
+  int nKeepAlive;
+  int fHarvest;
+  int nRttBias;
+  int nRevisitMax;
+  int nStaleness;
   const char *mbox;
   const char *ns;
   const char *host;
   const char *tor;
   const char *ipv4_proxy;
   const char *ipv6_proxy;
+  const char *fedListen;
+  const char *fedKey;
+  std::string strFedName;
+  std::vector<std::string> vFedPeers;
+  std::vector<std::string> vFedMembers;
+  int nFedSample;
+  const char *shm;
+  const char *frontend;
+  std::vector<std::pair<std::string, std::string> > vZones; // more networks to crawl, with their DNS host names
   std::set<uint64_t> filter_whitelist;
 
   CDnsSeedOpts() : 
@@ -66,8 +122,29 @@ public:
       fUseTestNet(false),
       fWipeBan(false),
       fWipeIgnore(false),
+      fNoJournal(false),
+      nCompactDirty(50000),
+      fConvertDb(false),
+      nReportFormats(REPORT_TEXT),
+      nReportTop(0),
+      nMaxNodes(0),
+      nSourceQuota(0),
+      nGroupQuota(0),
+      nWarmThreads(-1),
+      nCrawlMin(-1),
+      nGroupFlight(32),
+      nKeepAlive(0),
+      fHarvest(false),
+      nRttBias(1),
+      nRevisitMax(0),
+      nStaleness(7200),
       ipv4_proxy(NULL),
-      ipv6_proxy(NULL)
+      ipv6_proxy(NULL),
+      fedListen(NULL),
+      fedKey(NULL),
+      nFedSample(5),
+      shm(NULL),
+      frontend(NULL)
   {}
 
   void ParseCommandLine(int argc, char **argv) {
@@ -85,9 +162,34 @@ public:
                               "-i <ip:port>    IPV4 SOCKS5 proxy IP/Port\n"
                               "-k <ip:port>    IPV6 SOCKS5 proxy IP/Port\n"
                               "-w f1,f2,...    Allow these flag combinations as filters\n"
+                              "-c <changes>    Snapshot the database after this many journaled changes (default 50000)\n"
                               "--testnet       Use testnet\n"
                               "--wipeban       Wipe list of banned nodes\n"
                               "--wipeignore    Wipe list of ignored nodes\n"
+                              "--nojournal     Do not keep a journal, write full snapshots every 5 minutes\n"
+                              "--convertdb     Convert dnsseed.dat to the current format and exit\n"
+                              "--dumpformat f1,f2,...  Report formats to write: text (dnsseed.dump), csv, json (default text)\n"
+                              "--dumptop <n>   Only report the best n nodes (default all)\n"
+                              "--maxnodes <n>  Track at most n nodes, evicting stale unknown ones (default 0, unlimited)\n"
+                              "--srcquota <n>  New nodes accepted per hour from one peer, scaled by its quality (default 0, unlimited)\n"
+                              "--groupquota <n>  New nodes accepted per hour in one network group (default 0, unlimited)\n"
+                              "--warmthreads <n>  Extra crawler threads revalidating previously good nodes at startup (default as -t)\n"
+                              "--crawlmin <n>  Let the probes in flight drop to n on timeouts, slow connects or local resource shortage (default -t/8; -t for none)\n"
+                              "--groupflight <n>  Probe at most n nodes of one network group at a time, holding back the others (default 32, 0 = unlimited)\n"
+                              "--keepalive <n>  Keep connections to up to n good nodes open, and revalidate them with pings (default 0)\n"
+                              "--harvest       Collect the addresses nodes gossip on keep-alive connections (needs --keepalive)\n"
+                              "--rttbias <n>   Answer with the fastest (lowest, steadiest round trip time) of n random good nodes per address (default 1, no bias)\n"
+                              "--revisitmax <s>  Revisit predictable nodes less often, after up to s seconds (default 0, every node after 1000s)\n"
+                              "--staleness <s>  With --revisitmax, still try every good node at least every s seconds (default 7200)\n"
+                              "--fedlisten <[host:]port>  Accept federation peers (other seeders exchanging probe outcomes) on this address\n"
+                              "--fedpeer <host:port>  Exchange probe outcomes with this federation peer (can be repeated)\n"
+                              "--fedkey <secret>  Shared secret authenticating federation peers (required with --fedlisten/--fedpeer)\n"
+                              "--fedname <name>  Name announced to federation peers (default the host name)\n"
+                              "--fedmembers n1,n2,...  Split crawling with these federation peers (by name, including this one)\n"
+                              "--fedsample <percent>  Share of the nodes every cluster member probes, to cross-check results (default 5)\n"
+                              "--shm <name>    Publish good nodes in a shared memory table for other local processes\n"
+                              "--frontend <name>  Only serve DNS, from the shared memory table another instance publishes (see --shm)\n"
+                              "--zone <net>:<host>  Also crawl network <net> (main or test), and answer for it as <host> (can be repeated)\n"
                               "-?, --help      Show this text\n"
                               "\n";
     bool showHelp = false;
@@ -104,14 +206,39 @@ public:
         {"proxyipv4", required_argument, 0, 'i'},
         {"proxyipv6", required_argument, 0, 'k'},
         {"filter", required_argument, 0, 'w'},
+        {"compact", required_argument, 0, 'c'},
         {"testnet", no_argument, &fUseTestNet, 1},
         {"wipeban", no_argument, &fWipeBan, 1},
         {"wipeignore", no_argument, &fWipeBan, 1},
+        {"nojournal", no_argument, &fNoJournal, 1},
+        {"convertdb", no_argument, &fConvertDb, 1},
+        {"dumpformat", required_argument, 0, OPT_DUMPFORMAT},
+        {"dumptop", required_argument, 0, OPT_DUMPTOP},
+        {"maxnodes", required_argument, 0, OPT_MAXNODES},
+        {"srcquota", required_argument, 0, OPT_SRCQUOTA},
+        {"groupquota", required_argument, 0, OPT_GROUPQUOTA},
+        {"warmthreads", required_argument, 0, OPT_WARMTHREADS},
+        {"crawlmin", required_argument, 0, OPT_CRAWLMIN},
+        {"groupflight", required_argument, 0, OPT_GROUPFLIGHT},
+        {"keepalive", required_argument, 0, OPT_KEEPALIVE},
+        {"harvest", no_argument, &fHarvest, 1},
+        {"rttbias", required_argument, 0, OPT_RTTBIAS},
+        {"revisitmax", required_argument, 0, OPT_REVISITMAX},
+        {"staleness", required_argument, 0, OPT_STALENESS},
+        {"fedlisten", required_argument, 0, OPT_FEDLISTEN},
+        {"fedpeer", required_argument, 0, OPT_FEDPEER},
+        {"fedkey", required_argument, 0, OPT_FEDKEY},
+        {"fedname", required_argument, 0, OPT_FEDNAME},
+        {"fedmembers", required_argument, 0, OPT_FEDMEMBERS},
+        {"fedsample", required_argument, 0, OPT_FEDSAMPLE},
+        {"shm", required_argument, 0, OPT_SHM},
+        {"frontend", required_argument, 0, OPT_FRONTEND},
+        {"zone", required_argument, 0, OPT_ZONE},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
       };
       int option_index = 0;
-      int c = getopt_long(argc, argv, "h:n:m:t:p:d:o:i:k:w:", long_options, &option_index);
+      int c = getopt_long(argc, argv, "h:n:m:t:p:d:o:i:k:w:c:", long_options, &option_index);
       if (c == -1) break;
       switch (c) {
         case 'h': {
@@ -162,6 +289,141 @@ public:
           break;
         }
 
+        case 'c': {
+          int n = strtol(optarg, NULL, 10);
+          if (n > 0) nCompactDirty = n;
+          break;
+        }
+
+        case OPT_DUMPFORMAT: {
+          int n = ParseReportFormats(optarg);
+          if (n > 0) nReportFormats = n;
+          break;
+        }
+
+        case OPT_DUMPTOP: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0) nReportTop = n;
+          break;
+        }
+
+        case OPT_MAXNODES: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0) nMaxNodes = n;
+          break;
+        }
+
+        case OPT_SRCQUOTA: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0) nSourceQuota = n;
+          break;
+        }
+
+        case OPT_GROUPQUOTA: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0) nGroupQuota = n;
+          break;
+        }
+
+        case OPT_WARMTHREADS: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0 && n < 1000) nWarmThreads = n;
+          break;
+        }
+
+        case OPT_CRAWLMIN: {
+          int n = strtol(optarg, NULL, 10);
+          if (n > 0 && n < 1000) nCrawlMin = n;
+          break;
+        }
+
+        case OPT_GROUPFLIGHT: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0 && n <= 100000) nGroupFlight = n;
+          break;
+        }
+
+        case OPT_KEEPALIVE: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0 && n <= 100000) nKeepAlive = n;
+          break;
+        }
+
+        case OPT_RTTBIAS: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 1 && n <= 64) nRttBias = n;
+          break;
+        }
+
+        case OPT_REVISITMAX: {
+          int n = strtol(optarg, NULL, 10);
+          if (n == 0 || (n >= MIN_RETRY && n <= 30*86400)) nRevisitMax = n;
+          break;
+        }
+
+        case OPT_STALENESS: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 2*MIN_RETRY && n <= 86400) nStaleness = n;
+          break;
+        }
+
+        case OPT_FEDLISTEN: {
+          fedListen = optarg;
+          break;
+        }
+
+        case OPT_FEDPEER: {
+          vFedPeers.push_back(optarg);
+          break;
+        }
+
+        case OPT_FEDKEY: {
+          fedKey = optarg;
+          break;
+        }
+
+        case OPT_FEDNAME: {
+          strFedName = optarg;
+          break;
+        }
+
+        case OPT_FEDMEMBERS: {
+          char* ptr = optarg;
+          while (*ptr != 0) {
+            char* end = strchr(ptr, ',');
+            string strMember = end ? string(ptr, end) : string(ptr);
+            if (!strMember.empty()) vFedMembers.push_back(strMember);
+            if (!end) break;
+            ptr = end + 1;
+          }
+          break;
+        }
+
+        case OPT_FEDSAMPLE: {
+          int n = strtol(optarg, NULL, 10);
+          if (n >= 0 && n <= 100) nFedSample = n;
+          break;
+        }
+
+        case OPT_SHM: {
+          shm = optarg;
+          break;
+        }
+
+        case OPT_FRONTEND: {
+          frontend = optarg;
+          break;
+        }
+
+        case OPT_ZONE: {
+          const char *sep = strchr(optarg, ':');
+          if (sep && sep > optarg && sep[1])
+            vZones.push_back(std::make_pair(string(optarg, sep - optarg), string(sep + 1)));
+          else
+            showHelp = true;
+          break;
+        }
+
         case 'w': {
           char* ptr = optarg;
           while (*ptr != 0) {
@@ -195,44 +457,195 @@ public:
         filter_whitelist.insert(NODE_NETWORK_LIMITED | NODE_WITNESS | NODE_BLOOM);
     }
     if (host != NULL && ns == NULL) showHelp = true;
+    if ((fedListen || !vFedPeers.empty()) && (!fedKey || !*fedKey)) {
+      fprintf(stderr, "--fedlisten and --fedpeer need a non-empty --fedkey\n");
+      fprintf(stderr, help, argv[0]);
+      exit(1);
+    }
+    if (strFedName.empty()) {
+      char pszHost[256] = {};
+      gethostname(pszHost, sizeof(pszHost) - 1);
+      strFedName = pszHost;
+    }
+    if (strFedName.size() > 255) {
+      fprintf(stderr, "--fedname must be at most 255 characters\n");
+      fprintf(stderr, help, argv[0]);
+      exit(1);
+    }
+    if (!vFedMembers.empty()) {
+      if (vFedMembers.size() > PARTITION_MAX_MEMBERS || std::find(vFedMembers.begin(), vFedMembers.end(), strFedName) == vFedMembers.end()) {
+        fprintf(stderr, "--fedmembers must name at most %i members, including this one (%s)\n", PARTITION_MAX_MEMBERS, strFedName.c_str());
+        fprintf(stderr, help, argv[0]);
+        exit(1);
+      }
+      if (!fedListen && vFedPeers.empty()) {
+        fprintf(stderr, "--fedmembers needs --fedlisten or --fedpeer\n");
+        fprintf(stderr, help, argv[0]);
+        exit(1);
+      }
+    }
+    std::set<string> setNets;
+    setNets.insert(fUseTestNet ? "test" : "main");
+    for (int i=0; i<vZones.size(); i++) {
+      if (!FindNetParams(vZones[i].first) || !setNets.insert(vZones[i].first).second) {
+        fprintf(stderr, "--zone %s:%s: unknown network, or one crawled already\n", vZones[i].first.c_str(), vZones[i].second.c_str());
+        showHelp = true;
+      }
+    }
+    if (frontend && !vZones.empty()) {
+      fprintf(stderr, "--frontend only serves the network of the shared table, not --zone\n");
+      fprintf(stderr, help, argv[0]);
+      exit(1);
+    }
+    if (fHarvest && !nKeepAlive) {
+      fprintf(stderr, "--harvest needs --keepalive\n");
+      fprintf(stderr, help, argv[0]);
+      exit(1);
+    }
     if (showHelp) fprintf(stderr, help, argv[0]);
   }
 };
 
 #include "dns.h"
 
-CAddrDb AddressDb;
+CAddrDb AddressDb; // of the primary network
+
+// A network this process crawls and answers for, with its own database, data files and
+// DNS zone; the crawler and DNS threads are shared. vNets[0] is the primary network (-h,
+// --testnet), which keeps the traditional file names and is the one the sidecar, the
+// shared memory table and the federation are for. The others come from --zone.
+class CNetContext {
+public:
+  const CNetParams &params;
+  CAddrDb &db;
+  string strHost;   // DNS zone (empty if not served)
+  string strSuffix; // of the data file names: empty for the primary network, "-<name>" otherwise
+  CAddrJournal *journal;
+  CKeepAlive *pKeepAlive; // persistent connections to good nodes (if enabled)
+  bool fDumping;    // DumpDb is running
+  int64 nLastReportChanges; // database changes at the last reports
+  CReportResult lastResult;
+  bool fWarmReported;
+
+  CNetContext(const CNetParams &paramsIn, CAddrDb &dbIn, const string &strHostIn, const string &strSuffixIn) :
+      params(paramsIn), db(dbIn), strHost(strHostIn), strSuffix(strSuffixIn), journal(NULL), pKeepAlive(NULL), fDumping(false),
+      nLastReportChanges(-1), fWarmReported(false) {
+    db.SetNetParams(params);
+  }
+
+  // e.g. GetPath("dnsseed", ".dat") is dnsseed.dat or dnsseed-test.dat
+  string GetPath(const char *pszBase, const char *pszExt) const {
+    return pszBase + strSuffix + pszExt;
+  }
+};
+
+vector<CNetContext*> vNets;
+
+CFederation *pFederation = NULL; // exchanges probe outcomes with other seeders (if configured)
+CCrawlPartition *pPartition = NULL; // our share of the crawl in a cluster (if configured)
+CCrawlControl *pCrawlControl = NULL; // probes in flight, for the crawler threads
+
+CGoodSet goodSet;                  // DNS answers from the sidecar file, until fDbReady
+std::atomic<bool> fDbReady(false); // AddressDb is loaded and answers come from it
+int64 nStartMillis = 0;            // process start, for the time-to-first-answer metric
+std::set<uint64_t> setAnswerFlags; // service filters the DNS threads answer for (sidecar buckets)
+std::atomic<CGoodTableReader*> pFrontendTable(NULL); // in a DNS frontend, where answers come from
+
+// log a startup milestone, with the time since the process started
+void LogStartup(const string &strEvent) {
+  char timeString[256];
+  time_t tim = time(NULL);
+  strftime(timeString, 256, "[%y-%m-%d %H:%M:%S]", localtime(&tim));
+  int nMillis = GetTimeMillis() - nStartMillis;
+  printf("%s after %i ms\n", strEvent.c_str(), nMillis);
+  FILE *statsfp = fopen("addrstats.log", "a");
+  if (statsfp) {
+    fprintf(statsfp, "%s %s after %i ms\n", timeString, strEvent.c_str(), nMillis);
+    fclose(statsfp);
+  }
+}
 
-extern "C" void* ThreadCrawler(void* data) {
-  int *nThreads=(int*)data;
+extern "C" void* ThreadCrawler(void*) {
+  unsigned int nNext = rand();
   do {
+    // take work from the networks in turn
     std::vector<CServiceResult> ips;
+    CNetContext *pNet = NULL;
     int wait = 5;
-    AddressDb.GetMany(ips, 16, wait);
+    for (int i=0; i<vNets.size() && ips.empty(); i++) {
+      pNet = vNets[nNext++ % vNets.size()];
+      int waitNet = 5;
+      pNet->db.GetMany(ips, 16, waitNet);
+      wait = std::min(wait, waitNet);
+    }
     int64 now = time(NULL);
     if (ips.empty()) {
-      wait *= 1000;
-      wait += rand() % (500 * *nThreads);
-      Sleep(wait);
+      // woken by the sweeper once there is work again
+      pCrawlControl->Idle(wait * 1000 + rand() % 1000);
       continue;
     }
-    vector<CAddress> addr;
+    vector<vector<CAddress> > addr(ips.size());
     for (int i=0; i<ips.size(); i++) {
       CServiceResult &res = ips[i];
       res.nBanTime = 0;
       res.nClientV = 0;
       res.nHeight = 0;
-      res.strClientV = "";
+      string strClientV;
+      uint64 nonce;
+      CService addrFrom;
+      int error;
       bool getaddr = res.ourLastSuccess + 86400 < now;
-      res.fGood = TestNode(res.service,res.nBanTime,res.nClientV,res.strClientV,res.nHeight,getaddr ? &addr : NULL);
+      pCrawlControl->Acquire();
+      res.fGood = TestNode(pNet->params,res.service,res.nBanTime,res.nClientV,strClientV,res.nHeight,res.nServices,res.rtt.nConnect,res.rtt.nHandshake,nonce,addrFrom,error,getaddr ? &addr[i] : NULL);
+      pCrawlControl->Release(ClassifyProbe(res.fGood, error), error, res.rtt.nConnect);
+      res.nClientSV = InternPeerSubVersion(strClientV, GetGroupKey(res.service));
+      SetClusterKeys(res, nonce, addrFrom);
+    }
+    pNet->db.ResultMany(ips);
+    if (pFederation && pNet == vNets[0])
+      pFederation->Publish(ips, time(NULL));
+    for (int i=0; i<ips.size(); i++) {
+      if (!addr[i].empty())
+        pNet->db.Add(addr[i], ips[i].service);
     }
-    AddressDb.ResultMany(ips);
-    AddressDb.Add(addr);
   } while(1);
   return nullptr;
 }
 
-extern "C" int GetIPList(void *thread, char *requestedHostname, addr_t *addr, int max, int ipv4, int ipv6);
+// Extra crawler for the warm start: only revalidates the nodes that were good before the
+// restart (without asking for addresses), and exits once they have all been handed out.
+extern "C" void* ThreadWarmCrawler(void*) {
+  unsigned int nNext = rand();
+  do {
+    std::vector<CServiceResult> ips;
+    CNetContext *pNet = NULL;
+    for (int i=0; i<vNets.size() && ips.empty(); i++) {
+      pNet = vNets[nNext++ % vNets.size()];
+      pNet->db.GetWarm(ips, 16);
+    }
+    if (ips.empty()) break;
+    for (int i=0; i<ips.size(); i++) {
+      CServiceResult &res = ips[i];
+      res.nBanTime = 0;
+      res.nClientV = 0;
+      res.nHeight = 0;
+      string strClientV;
+      uint64 nonce;
+      CService addrFrom;
+      int error;
+      res.fGood = TestNode(pNet->params,res.service,res.nBanTime,res.nClientV,strClientV,res.nHeight,res.nServices,res.rtt.nConnect,res.rtt.nHandshake,nonce,addrFrom,error,NULL);
+      pCrawlControl->Note(ClassifyProbe(res.fGood, error), error, res.rtt.nConnect);
+      res.nClientSV = InternPeerSubVersion(strClientV, GetGroupKey(res.service));
+      SetClusterKeys(res, nonce, addrFrom);
+    }
+    pNet->db.ResultMany(ips);
+    if (pFederation && pNet == vNets[0])
+      pFederation->Publish(ips, time(NULL));
+  } while(1);
+  return nullptr;
+}
+
+extern "C" int GetIPList(void *thread, int zone, char *requestedHostname, addr_t *addr, int max, int ipv4, int ipv6);
 
 class CDnsThread {
 public:
@@ -241,56 +654,87 @@ public:
       std::vector<addr_t> cache;
       time_t cacheTime;
       unsigned int cacheHits;
-      FlagSpecificData() : nIPv4(0), nIPv6(0), cacheTime(0), cacheHits(0) {}
+      bool fSidecar; // cache was filled from goodSet
+      uint64_t nGeneration; // of the shared table the cache was filled from (frontends)
+      FlagSpecificData() : nIPv4(0), nIPv6(0), cacheTime(0), cacheHits(0), fSidecar(false), nGeneration(0) {}
   };
 
   dns_opt_t dns_opt; // must be first
   const int id;
-  std::map<uint64_t, FlagSpecificData> perflag;
+  std::vector<const char*> vHosts; // DNS zones, for dns_opt
+  std::vector<int> vZoneNet;       // index in vNets of every zone
+  std::vector<std::map<uint64_t, FlagSpecificData> > perflag; // per network
   std::atomic<uint64_t> dbQueries;
   std::set<uint64_t> filterWhitelist;
 
-  void cacheHit(uint64_t requestedFlags, bool force = false) {
-    static bool nets[NET_MAX] = {};
-    if (!nets[NET_IPV4]) {
-        nets[NET_IPV4] = true;
-        nets[NET_IPV6] = true;
+  void cacheHit(int nNet, uint64_t requestedFlags, bool force = false) {
+    static int quota[NET_MAX] = {};
+    if (!quota[NET_IPV4]) {
+        quota[NET_IPV4] = 1000;
+        quota[NET_IPV6] = 1000;
     }
     time_t now = time(NULL);
-    FlagSpecificData& thisflag = perflag[requestedFlags];
+    FlagSpecificData& thisflag = perflag[nNet][requestedFlags];
     thisflag.cacheHits++;
+    CGoodTableReader *pTable = pFrontendTable;
+    if (pTable && nNet == 0) {
+      // a frontend: refill whenever the crawler has published a new table
+      uint64_t nGeneration = pTable->GetGeneration();
+      if (force || thisflag.nGeneration != nGeneration) {
+        thisflag.cache.resize(2 * GOODTABLE_BUCKET_ADDRS);
+        int n4 = std::max(pTable->Read(requestedFlags, 4, &thisflag.cache[0], GOODTABLE_BUCKET_ADDRS, &nGeneration), 0);
+        int n6 = std::max(pTable->Read(requestedFlags, 6, &thisflag.cache[n4], GOODTABLE_BUCKET_ADDRS), 0);
+        thisflag.cache.resize(n4 + n6);
+        thisflag.nGeneration = nGeneration;
+        countCache(thisflag);
+      }
+      return;
+    }
+    if (!fDbReady) {
+      // the database is still loading: answer from the sidecar file (only the primary
+      // network has one)
+      if (!thisflag.fSidecar && nNet == 0) {
+        const std::vector<addr_t> *pAddr = goodSet.Get(requestedFlags);
+        thisflag.cache = pAddr ? *pAddr : std::vector<addr_t>();
+        thisflag.fSidecar = true;
+        countCache(thisflag);
+      }
+      return;
+    }
+    if (thisflag.fSidecar) {
+      force = true;
+      thisflag.fSidecar = false;
+    }
     if (force || thisflag.cacheHits * 400 > (thisflag.cache.size()*thisflag.cache.size()) || (thisflag.cacheHits*thisflag.cacheHits * 20 > thisflag.cache.size() && (now - thisflag.cacheTime > 5))) {
-      set<CNetAddr> ips;
-      AddressDb.GetIPs(ips, requestedFlags, 1000, nets);
+      thisflag.cache.resize(1000);
+      int n = vNets[nNet]->db.SampleIPs(&thisflag.cache[0], 1000, requestedFlags, quota);
       dbQueries++;
-      thisflag.cache.clear();
-      thisflag.nIPv4 = 0;
-      thisflag.nIPv6 = 0;
-      thisflag.cache.reserve(ips.size());
-      for (set<CNetAddr>::iterator it = ips.begin(); it != ips.end(); it++) {
-        struct in_addr addr;
-        struct in6_addr addr6;
-        if ((*it).GetInAddr(&addr)) {
-          addr_t a;
-          a.v = 4;
-          memcpy(&a.data.v4, &addr, 4);
-          thisflag.cache.push_back(a);
-          thisflag.nIPv4++;
-        } else if ((*it).GetIn6Addr(&addr6)) {
-          addr_t a;
-          a.v = 6;
-          memcpy(&a.data.v6, &addr6, 16);
-          thisflag.cache.push_back(a);
-          thisflag.nIPv6++;
-        }
-      }
+      thisflag.cache.resize(n);
+      countCache(thisflag);
       thisflag.cacheHits = 0;
       thisflag.cacheTime = now;
     }
   }
 
+  static void countCache(FlagSpecificData &thisflag) {
+    thisflag.nIPv4 = 0;
+    thisflag.nIPv6 = 0;
+    for (int i = 0; i < thisflag.cache.size(); i++) {
+      if (thisflag.cache[i].v == 4)
+        thisflag.nIPv4++;
+      else
+        thisflag.nIPv6++;
+    }
+  }
+
   CDnsThread(CDnsSeedOpts* opts, int idIn) : id(idIn) {
-    dns_opt.host = opts->host;
+    for (int i = 0; i < vNets.size(); i++) {
+      if (vNets[i]->strHost.empty()) continue;
+      vHosts.push_back(vNets[i]->strHost.c_str());
+      vZoneNet.push_back(i);
+    }
+    dns_opt.hosts = &vHosts[0];
+    dns_opt.nhosts = vHosts.size();
     dns_opt.ns = opts->ns;
     dns_opt.mbox = opts->mbox;
     dns_opt.datattl = 3600;
@@ -299,7 +743,7 @@ public:
     dns_opt.port = opts->nPort;
     dns_opt.nRequests = 0;
     dbQueries = 0;
-    perflag.clear();
+    perflag.resize(vNets.size());
     filterWhitelist = opts->filter_whitelist;
   }
 
@@ -310,8 +754,9 @@ public:
   }
 };
 
-extern "C" int GetIPList(void *data, char *requestedHostname, addr_t* addr, int max, int ipv4, int ipv6) {
+extern "C" int GetIPList(void *data, int zone, char *requestedHostname, addr_t* addr, int max, int ipv4, int ipv6) {
   CDnsThread *thread = (CDnsThread*)data;
+  int nNet = thread->vZoneNet[zone];
 
   uint64_t requestedFlags = 0;
   int hostlen = strlen(requestedHostname);
@@ -323,10 +768,10 @@ extern "C" int GetIPList(void *data, char *requestedHostname, addr_t* addr, int
     else
       return 0;
   }
-  else if (strcasecmp(requestedHostname, thread->dns_opt.host))
+  else if (strcasecmp(requestedHostname, thread->dns_opt.hosts[zone]))
     return 0;
-  thread->cacheHit(requestedFlags);
-  auto& thisflag = thread->perflag[requestedFlags];
+  thread->cacheHit(nNet, requestedFlags);
+  auto& thisflag = thread->perflag[nNet][requestedFlags];
   unsigned int size = thisflag.cache.size();
   unsigned int maxmax = (ipv4 ? thisflag.nIPv4 : 0) + (ipv6 ? thisflag.nIPv6 : 0);
   if (max > size)
@@ -349,6 +794,9 @@ extern "C" int GetIPList(void *data, char *requestedHostname, addr_t* addr, int
     thisflag.cache[i] = addr[i];
     i++;
   }
+  static std::atomic<bool> fAnswered(false);
+  if (max > 0 && !fAnswered.exchange(true))
+    LogStartup(fDbReady ? "first DNS answer (from the database)" : "first DNS answer (from dnsseed.good)");
   return max;
 }
 
@@ -360,88 +808,250 @@ extern "C" void* ThreadDNS(void* arg) {
   return nullptr;
 }
 
-int StatCompare(const CAddrReport& a, const CAddrReport& b) {
-  if (a.uptime[4] == b.uptime[4]) {
-    if (a.uptime[3] == b.uptime[3]) {
-      return a.clientVersion > b.clientVersion;
-    } else {
-      return a.uptime[3] > b.uptime[3];
-    }
-  } else {
-    return a.uptime[4] > b.uptime[4];
+int nReportFormats = REPORT_TEXT;
+int nReportTop = 0;
+
+void WriteStats(const CNetContext &net, const CReportResult &result) {
+    FILE *ff = fopen(net.GetPath("dnsstats", ".log").c_str(), "a");
+    fprintf(ff, "%llu %g %g %g %g %g\n", (unsigned long long)(time(NULL)), result.stat[0], result.stat[1], result.stat[2], result.stat[3], result.stat[4]);
+    fclose(ff);
+}
+
+// Write the good-set sidecar: an answer pool for every filter the DNS threads serve,
+// sampled like their caches. Only for a frozen copy of the database (see DumpDb).
+void WriteGoodSet() {
+  static int quota[NET_MAX] = {};
+  quota[NET_IPV4] = 1000;
+  quota[NET_IPV6] = 1000;
+  std::map<uint64_t, std::vector<addr_t> > mapBuckets;
+  for (std::set<uint64_t>::const_iterator it = setAnswerFlags.begin(); it != setAnswerFlags.end(); it++) {
+    std::vector<addr_t> &vAddr = mapBuckets[*it];
+    vAddr.resize(1000);
+    memset(&vAddr[0], 0, sizeof(addr_t) * vAddr.size());
+    vAddr.resize(AddressDb.SampleIPs_(&vAddr[0], 1000, *it, quota));
   }
+  CGoodSet::Write("dnsseed.good", mapBuckets);
 }
 
-bool isDumpDbRunning = false;
+// Publish a sample of the good nodes for other processes (see shmtable.h), bucketed like
+// the sidecar file, every few seconds.
+extern "C" void* ThreadShmPublisher(void* arg) {
+  CGoodTableWriter *pWriter = (CGoodTableWriter*)arg;
+  static int quota[NET_MAX] = {};
+  quota[NET_IPV4] = GOODTABLE_BUCKET_ADDRS;
+  quota[NET_IPV6] = GOODTABLE_BUCKET_ADDRS;
+  std::vector<addr_t> vAddr;
+  do {
+    std::map<std::pair<uint64_t, int>, std::vector<addr_t> > mapBuckets;
+    for (std::set<uint64_t>::const_iterator it = setAnswerFlags.begin(); it != setAnswerFlags.end(); it++) {
+      vAddr.resize(2 * GOODTABLE_BUCKET_ADDRS);
+      vAddr.resize(AddressDb.SampleIPs(&vAddr[0], vAddr.size(), *it, quota));
+      std::vector<addr_t> &vAddr4 = mapBuckets[std::make_pair(*it, 4)];
+      std::vector<addr_t> &vAddr6 = mapBuckets[std::make_pair(*it, 6)];
+      for (int i = 0; i < vAddr.size(); i++)
+        (vAddr[i].v == 4 ? vAddr4 : vAddr6).push_back(vAddr[i]);
+    }
+    pWriter->Publish(mapBuckets, time(NULL));
+    Sleep(5000);
+  } while(1);
+  return nullptr;
+}
 
-extern "C" void DumpDb() {
-    if (isDumpDbRunning == true) {
+// write reports and statistics of a network, and (if fSnapshot) a full snapshot of its database
+void DumpDb(CNetContext &net, bool fSnapshot = true) {
+    if (net.fDumping == true) {
         printf("Dump is running\n");
-        while (isDumpDbRunning) {
+        while (net.fDumping) {
             sleep(1); // wait for it to finish before dumping
         }
         return;
     }
-    isDumpDbRunning = true;
+    net.fDumping = true;
 
     char timeString[256];
     time_t tim = time(NULL);
     struct tm *tmp = localtime(&tim);
     strftime(timeString, 256, "[%y-%m-%d %H:%M:%S]", tmp);
     CAddrDbStats stats;
-    AddressDb.GetStats(stats);
-    FILE *statsfp = fopen("addrstats.log", "a");
-    fprintf(statsfp, "%s %i/%i available (%i tried in %is, %i new, %i active), %i banned\n",
+    net.db.GetStats(stats);
+    string strStatsFile = net.GetPath("addrstats", ".log");
+    FILE *statsfp = fopen(strStatsFile.c_str(), "a");
+    fprintf(statsfp, "%s %i/%i available (%i tried in %is, %i new, %i active), %i banned, %lli evicted, %lli over quota from %i sources, ~%i MB; max crawler stall %i ms\n",
            timeString, stats.nGood, stats.nAvail, stats.nTracked, stats.nAge, stats.nNew,
-           stats.nAvail - stats.nTracked - stats.nNew, stats.nBanned);
+           stats.nAvail - stats.nTracked - stats.nNew, stats.nBanned, (long long)stats.nEvicted,
+           (long long)stats.nOverQuota, stats.nSources, (int)(stats.nMemory >> 20), (int)(net.db.GetMaxStall() / 1000));
+    string strTimeToGood;
+    for (int i = 0; i < 5; i++)
+      strTimeToGood += stats.nTimeToGood[i] < 0 ? string(i ? "/-" : "-") : strprintf(i ? "/%is" : "%is", stats.nTimeToGood[i]);
+    fprintf(statsfp, "%s first tries: %lli/%lli reachable; time to 1/10/100/1000/10000 good nodes: %s\n",
+           timeString, (long long)stats.nFirstGood, (long long)stats.nFirstTried, strTimeToGood.c_str());
+    // the warm start timeline, until it is complete
+    if (stats.nWarmTotal && !net.fWarmReported) {
+      string strWarm;
+      for (int i = 0; i < 4; i++)
+        strWarm += stats.nWarmMillis[i] < 0 ? string(i ? "/-" : "-") : strprintf(i ? "/%ims" : "%ims", stats.nWarmMillis[i]);
+      fprintf(statsfp, "%s warm start: %i/%i previously good nodes revalidated, %i good again; first reconfirmed/50%%/90%%/all tried after %s\n",
+             timeString, stats.nWarmDone, stats.nWarmTotal, stats.nWarmGood, strWarm.c_str());
+      net.fWarmReported = stats.nWarmMillis[3] >= 0;
+    }
+    CRevisitStats revisit;
+    net.db.GetRevisitStats(revisit);
+    fprintf(statsfp, "%s revisits: %.0f per hour scheduled, made %is late on average; good nodes last tried up to %llis ago, %i beyond the staleness target\n",
+           timeString, revisit.dProbeRate, revisit.nLate, (long long)revisit.nOldest, revisit.nStale);
+    CGroupStats groupStats;
+    net.db.GetGroupStats(groupStats, 3);
+    string strWaiting;
+    for (int i = 0; i < groupStats.vTop.size(); i++)
+      strWaiting += strprintf("%s %i (group of %s)", i ? "," : "", groupStats.vTop[i].first, groupStats.vTop[i].second.ToStringIP().c_str());
+    fprintf(statsfp, "%s netgroups: %i probed (%i at the cap), %i nodes in flight; %i due nodes held back (%lli so far), %lli untried ones passed over; most waiting:%s\n",
+           timeString, groupStats.nGroups, groupStats.nFull, groupStats.nInFlight, groupStats.nParked, (long long)groupStats.nParkedTotal,
+           (long long)groupStats.nSkipped, strWaiting.empty() ? " none" : strWaiting.c_str());
+    if (stats.nClusters || stats.nClusterDeferred)
+      fprintf(statsfp, "%s duplicates: %i nodes seen under several addresses, %lli probes of their other addresses put off\n",
+             timeString, stats.nClusters, (long long)stats.nClusterDeferred);
+    if (net.pKeepAlive) {
+      CKeepAliveStats keepStats;
+      net.pKeepAlive->GetStats(keepStats);
+      fprintf(statsfp, "%s keep-alive: %i links open, %lli opened, %lli unreachable, %lli dropped; %lli pongs, %lli probes recorded without reconnecting\n",
+             timeString, keepStats.nLinks, (long long)keepStats.nOpened, (long long)keepStats.nFailed, (long long)keepStats.nDropped,
+             (long long)keepStats.nPongs, (long long)keepStats.nProbes);
+      if (net.pKeepAlive->IsHarvesting())
+        fprintf(statsfp, "%s harvest: %lli addresses gossiped on keep-alive links, %lli not seen lately passed to the database\n",
+               timeString, (long long)keepStats.nGossip, (long long)keepStats.nHarvested);
+    }
+    if (pFederation && &net == vNets[0]) {
+      CFederationStats fedStats;
+      pFederation->GetStats(fedStats);
+      fprintf(statsfp, "%s federation: %i peers, %lli outcomes sent (%lli skipped), %lli received, %lli applied, %lli failed handshakes\n",
+             timeString, fedStats.nPeers, (long long)fedStats.nSent, (long long)fedStats.nSkipped, (long long)fedStats.nReceived,
+             (long long)fedStats.nApplied, (long long)fedStats.nAuthFailed);
+    }
+    if (pCrawlControl && &net == vNets[0]) {
+      CCrawlControlStats ctlStats;
+      pCrawlControl->GetStats(ctlStats);
+      fprintf(statsfp, "%s crawl control: %i probes in flight allowed (%i..%i), %i in flight, %i crawlers idle, %.1f probes/s; "
+                       "timeouts %.0f%% (usually %.0f%%), connect %.0f ms (usually %.0f ms); %lli steps up, %lli cuts%s%s\n",
+             timeString, ctlStats.nSetpoint, ctlStats.nMin, ctlStats.nMax, ctlStats.nActive, ctlStats.nIdle, ctlStats.dRate,
+             100 * ctlStats.dFail, 100 * ctlStats.dFailBase, ctlStats.dConnectMs, ctlStats.dConnectMsBase,
+             (long long)ctlStats.nIncreases, (long long)ctlStats.nDecreases,
+             ctlStats.nLastCut ? strprintf(", last %llis ago: ", (long long)(time(NULL) - ctlStats.nLastCut)).c_str() : "",
+             ctlStats.strLastCut.c_str());
+    }
+    if (pPartition && &net == vNets[0]) {
+      string strCheck;
+      for (int i = 0; i < pPartition->GetMembers(); i++) {
+        if (i == pPartition->GetSelf()) continue;
+        strCheck += strprintf(" %s%s %lli/%lli", pPartition->GetName(i).c_str(), pPartition->IsAlive(i) ? "" : " (silent)",
+                              (long long)pPartition->GetAgree(i), (long long)(pPartition->GetAgree(i) + pPartition->GetDisagree(i)));
+      }
+      fprintf(statsfp, "%s cluster: %i/%i members alive, %lli picks left to their owners, %lli taken over; sample outcomes agreeing with ours:%s\n",
+             timeString, pPartition->GetAlive(), pPartition->GetMembers(), (long long)stats.nDeferred, (long long)stats.nTakenOver, strCheck.c_str());
+    }
     fclose(statsfp);
 
-    vector<CAddrReport> vReport = AddressDb.GetAll();
-    sort(vReport.begin(), vReport.end(), StatCompare);
-
-    FILE *f = fopen("dnsseed.dat.new","w+");
-    if (f) {
-        {
-        CAutoFile cf(f);
-        cf << AddressDb;
-        }
-      rename("dnsseed.dat.new", "dnsseed.dat");
+    // Without database changes since the last reports, their contents would be identical.
+    int64 nChanges = net.db.GetChanges();
+    if (!fSnapshot && nChanges == net.nLastReportChanges) {
+      WriteStats(net, net.lastResult);
+      net.fDumping = false;
+      return;
     }
 
-    FILE *d = fopen("dnsseed.dump", "w");
-    fprintf(d, "# address                                        good  lastSuccess    %%(2h)   %%(8h)   %%(1d)   %%(7d)  %%(30d)  blocks      svcs  version\n");
-
-    double stat[5]={0,0,0,0,0};
-    for (vector<CAddrReport>::const_iterator it = vReport.begin(); it < vReport.end(); it++) {
-        CAddrReport rep = *it;
-        fprintf(d, "%-47s  %4d  %11" PRId64 "  %6.2f%% %6.2f%% %6.2f%% %6.2f%% %6.2f%%  %6i  %08" PRIx64 "  %5i \"%s\"\n",
-                rep.ip.ToString().c_str(),(int)rep.fGood, rep.lastSuccess, 100.0*rep.uptime[0], 100.0*rep.uptime[1],
-                100.0*rep.uptime[2], 100.0*rep.uptime[3], 100.0*rep.uptime[4], rep.blocks, rep.services,
-                rep.clientVersion, rep.clientSubVersion.c_str());
-        stat[0] += rep.uptime[0];
-        stat[1] += rep.uptime[1];
-        stat[2] += rep.uptime[2];
-        stat[3] += rep.uptime[3];
-        stat[4] += rep.uptime[4];
+    // Serialize and report from a forked child, which sees a frozen copy-on-write image of
+    // the database; crawlers only wait for the fork itself. The child passes the report
+    // summary back through a pipe.
+    int fds[2];
+    if (pipe(fds) != 0) {
+      printf("Error: pipe failed: %s\n", strerror(errno));
+      net.fDumping = false;
+      return;
     }
-    fclose(d);
-
-    FILE *ff = fopen("dnsstats.log", "a");
-    fprintf(ff, "%llu %g %g %g %g %g\n", (unsigned long long)(time(NULL)), stat[0], stat[1], stat[2], stat[3], stat[4]);
-    fclose(ff);
-    isDumpDbRunning = false;
+    string strDb = net.GetPath("dnsseed", ".dat"), strDbNew = strDb + ".new";
+    pid_t pid = net.db.ForkSnapshot(fSnapshot);
+    if (pid == 0) {
+      close(fds[0]);
+      bool ret = true;
+      if (fSnapshot)
+        ret = net.db.Save_(strDbNew.c_str()) && rename(strDbNew.c_str(), strDb.c_str()) == 0;
+      CReportResult result;
+      WriteReports(net.db, net.GetPath("dnsseed", ""), nReportFormats, nReportTop, result);
+      if (&net == vNets[0])
+        WriteGoodSet();
+      if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+        ret = false;
+      _exit(ret ? 0 : 1);
+    }
+    close(fds[1]);
+    CReportResult result;
+    bool fResult;
+    if (pid < 0) {
+      printf("Error: fork failed: %s\n", strerror(errno));
+      if (fSnapshot && net.db.Save(strDbNew.c_str())) {
+        if (rename(strDbNew.c_str(), strDb.c_str()) == 0 && net.db.GetJournal())
+          net.db.GetJournal()->RemoveOld();
+      }
+      // the reports are needed all the more now: write them from the live database
+      net.db.ReadLocked([&]() {
+        WriteReports(net.db, net.GetPath("dnsseed", ""), nReportFormats, nReportTop, result);
+        if (&net == vNets[0])
+          WriteGoodSet();
+      });
+      fResult = true;
+    } else {
+      fResult = read(fds[0], &result, sizeof(result)) == sizeof(result);
+      int status;
+      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+      if (fSnapshot && WIFEXITED(status) && WEXITSTATUS(status) == 0 && net.db.GetJournal())
+        net.db.GetJournal()->RemoveOld();
+    }
+    if (fResult) {
+      FILE *statsfp = fopen(strStatsFile.c_str(), "a");
+      fprintf(statsfp, "%s reported %i of %i nodes in %i ms CPU\n", timeString, result.nRows, result.nNodes, (int)(result.nCpuMicros / 1000));
+      fclose(statsfp);
+      WriteStats(net, result);
+      net.lastResult = result;
+      net.nLastReportChanges = nChanges;
+    }
+    close(fds[0]);
+    net.fDumping = false;
 }
 
 extern "C" void SIGINTHandler(int signum) {
   printf("\n\nExit Handler invoked\n");
-  DumpDb();
+  for (int i=0; i<vNets.size(); i++)
+    DumpDb(*vNets[i]);
   exit(0);
 }
 
-extern "C" void* ThreadDumper(void*) {
+extern "C" void* ThreadDumper(void* arg) {
+  CDnsSeedOpts *opts = (CDnsSeedOpts*)arg;
   do {
     sleep(300);  // dump every 5 minutes
-    DumpDb();
+    // with a journal, only compact it into a new snapshot once enough has changed
+    for (int i=0; i<vNets.size(); i++)
+      DumpDb(*vNets[i], !vNets[i]->journal || vNets[i]->db.GetDirty() >= opts->nCompactDirty);
+  } while(1);
+  return nullptr;
+}
+
+extern "C" void* ThreadJournal(void*) {
+  do {
+    Sleep(1000);
+    for (int i=0; i<vNets.size(); i++)
+      if (vNets[i]->journal)
+        vNets[i]->journal->Flush();
+  } while(1);
+  return nullptr;
+}
+
+extern "C" void* ThreadSweeper(void*) {
+  do {
+    Sleep(1000);
+    int nWork = 0;
+    for (int i=0; i<vNets.size(); i++)
+      nWork += vNets[i]->db.Sweep(); // move due nodes to the front of the schedule, lift expired bans
+    if (nWork)
+      pCrawlControl->Wake((nWork + 15) / 16); // crawlers take 16 at a time
   } while(1);
   return nullptr;
 }
@@ -469,68 +1079,29 @@ extern "C" void* ThreadStats(void*) {
       requests += dnsThread[i]->dns_opt.nRequests;
       queries += dnsThread[i]->dbQueries;
     }
-    printf("%s %i/%i available (%i tried in %is, %i new, %i active), %i banned; %llu DNS requests, %llu db queries",
+    printf("%s %i/%i available (%i tried in %is, %i new, %i active), %i banned, %lli evicted, ~%i MB; %llu DNS requests, %llu db queries",
            timeString, stats.nGood, stats.nAvail, stats.nTracked, stats.nAge, stats.nNew,
-           stats.nAvail - stats.nTracked - stats.nNew, stats.nBanned,
-           (unsigned long long)requests, (unsigned long long)queries);
+           stats.nAvail - stats.nTracked - stats.nNew, stats.nBanned, (long long)stats.nEvicted,
+           (int)(stats.nMemory >> 20), (unsigned long long)requests, (unsigned long long)queries);
+    for (int i=1; i<vNets.size(); i++) {
+      vNets[i]->db.GetStats(stats);
+      printf("; %s: %i/%i available", vNets[i]->params.strName.c_str(), stats.nGood, stats.nAvail);
+    }
     Sleep(1000);
   } while(1);
   return nullptr;
 }
 
-static const string mainnet_seeds[] =
-    {
-      "node01.veil-project.com",
-      "node02.veil-project.com",
-      "node03.veil-project.com",
-      "node04.veil-project.com",
-      "node05.veil-project.com",
-      "node06.veil-project.com",
-      "node07.veil-project.com",
-      "node08.veil-project.com",
-      "veilseed.veil-stats.com",
-      "seed.veil.rune.network",
-      "veil-seed.pontificatingnobody.com",
-      "116.203.43.112",
-      "159.69.20.168",
-      "94.130.180.117",
-      "94.130.185.98",
-      "195.201.24.97",
-      "116.203.40.38",
-      "195.201.24.15",
-      "195.201.24.37",
-      "127.0.0.1",
-      "::1",
-      ""
-    };
-static const string testnet_seeds[] =
-    {
-      "veilseedtestnet.veil-stats.com",
-      "veilseedtest.codeofalltrades.com",
-      "seedtest.veil.rune.network",
-      "veil-seed.test.pontificatingnobody.com",
-      "159.69.223.84",
-      "95.201.21.157",
-      "104.40.2.126",
-      "95.216.169.35",
-      "116.203.45.190",
-      "[2a01:4f8:1c1c:b3b2::1]",
-      "127.0.0.1",
-      "::1",
-      ""
-    };
-static const string *seeds = mainnet_seeds;
-
 extern "C" void* ThreadSeeder(void*) {
-  if (!fMainNet){
-    AddressDb.Add(CService("127.0.0.1", GetDefaultPort(), false), true);
-  }
   do {
-    for (int i=0; seeds[i] != ""; i++) {
-      vector<CNetAddr> ips;
-      LookupHost(seeds[i].c_str(), ips);
-      for (vector<CNetAddr>::iterator it = ips.begin(); it != ips.end(); it++) {
-        AddressDb.Add(CService(*it, GetDefaultPort()), true);
+    for (int n=0; n<vNets.size(); n++) {
+      const CNetParams &params = vNets[n]->params;
+      for (int i=0; i<params.vSeeds.size(); i++) {
+        vector<CNetAddr> ips;
+        LookupHost(params.vSeeds[i].c_str(), ips);
+        for (vector<CNetAddr>::iterator it = ips.begin(); it != ips.end(); it++) {
+          vNets[n]->db.Add(CService(*it, params.nDefaultPort), true);
+        }
       }
     }
     Sleep(1800000);
@@ -538,11 +1109,93 @@ extern "C" void* ThreadSeeder(void*) {
   return nullptr;
 }
 
+// start the DNS threads (at most once)
+void StartDNS(CDnsSeedOpts &opts) {
+  if (!dnsThread.empty()) return;
+  string strHosts;
+  for (int i=0; i<vNets.size(); i++)
+    if (!vNets[i]->strHost.empty())
+      strHosts += (strHosts.empty() ? "" : ", ") + vNets[i]->strHost;
+  printf("Starting %i DNS threads for %s on %s (port %i)...", opts.nDnsThreads, strHosts.c_str(), opts.ns, opts.nPort);
+  for (int i=0; i<opts.nDnsThreads; i++) {
+    pthread_t threadDns;
+    dnsThread.push_back(new CDnsThread(&opts, i));
+    pthread_create(&threadDns, NULL, ThreadDNS, dnsThread[i]);
+    printf(".");
+    Sleep(20);
+  }
+  printf("done\n");
+}
+
+// Load the database of a network and replay its journal; false if it starts from scratch.
+bool LoadNet(CNetContext &net, const CDnsSeedOpts &opts) {
+  CAddrDb &db = net.db;
+  string strDb = net.GetPath("dnsseed", ".dat");
+  bool fLoaded = false;
+  db.SetRevisit(opts.nRevisitMax, opts.nStaleness);
+  if (access(strDb.c_str(), F_OK) == 0) {
+    printf("Loading %s...", strDb.c_str());
+    int64 nStart = GetTimeMillis();
+    string strError;
+    int ret = db.Load(strDb.c_str(), strError);
+    if (ret == 0) {
+      // legacy format, converted by the next snapshot
+      FILE *f = fopen(strDb.c_str(),"r");
+      CAutoFile cf(f);
+      cf >> db;
+      printf("(legacy format) ");
+    } else if (ret < 0) {
+      printf("failed: %s\n", strError.c_str());
+      exit(1);
+    }
+    CAddrDbStats stats;
+    db.GetStats(stats);
+    printf("done (%i nodes in %i ms)\n", stats.nAvail, (int)(GetTimeMillis() - nStart));
+    fLoaded = true;
+  }
+  if (opts.fConvertDb) {
+    string strDbNew = strDb + ".new";
+    if (!fLoaded || !db.Save(strDbNew.c_str()) || rename(strDbNew.c_str(), strDb.c_str()) != 0) {
+      fprintf(stderr, "Conversion of %s failed.\n", strDb.c_str());
+      exit(1);
+    }
+    printf("Converted %s to version %u.\n", strDb.c_str(), DBFILE_VERSION);
+    return true;
+  }
+  if (!opts.fNoJournal) {
+    CAddrJournal *journal = new CAddrJournal(net.GetPath("dnsseed", ".jnl"));
+    printf("Replaying %s...", journal->GetPath().c_str());
+    int nReplayed = 0;
+    uint64 nSeq = db.GetSnapshotSeq();
+    db.ReplayJournal(journal->GetOldPath(), nReplayed, nSeq);
+    long nValid = db.ReplayJournal(journal->GetPath(), nReplayed, nSeq);
+    if (journal->Open(nSeq, nValid)) {
+      db.SetJournal(journal);
+      net.journal = journal;
+      printf("done (%i changes)\n", nReplayed);
+    } else {
+      delete journal;
+    }
+  }
+  if (opts.fWipeBan)
+      db.banned.clear();
+  if (opts.fWipeIgnore)
+      db.ResetIgnores();
+  db.SetMaxNodes(opts.nMaxNodes);
+  db.SetQuotas(opts.nSourceQuota, opts.nGroupQuota);
+  db.SetGroupFlight(opts.nGroupFlight);
+  db.SetRttBias(opts.nRttBias);
+  return fLoaded || net.journal;
+}
+
 int main(int argc, char **argv) {
+  nStartMillis = GetTimeMillis();
   signal(SIGPIPE, SIG_IGN);
   setbuf(stdout, NULL);
   CDnsSeedOpts opts;
   opts.ParseCommandLine(argc, argv);
+  nReportFormats = opts.nReportFormats;
+  nReportTop = opts.nReportTop;
   printf("Supporting whitelisted filters: ");
   for (std::set<uint64_t>::const_iterator it = opts.filter_whitelist.begin(); it != opts.filter_whitelist.end(); it++) {
       if (it != opts.filter_whitelist.begin()) {
@@ -573,14 +1226,13 @@ int main(int argc, char **argv) {
     }
   }
   bool fDNS = true;
-  if (opts.fUseTestNet) {
+  if (opts.fUseTestNet)
       printf("Using testnet.\n");
-      pchMessageStart[0] = 0xa8;
-      pchMessageStart[1] = 0xd1;
-      pchMessageStart[2] = 0xa7;
-      pchMessageStart[3] = 0xc4;
-      seeds = testnet_seeds;
-      fMainNet = false;
+  vNets.push_back(new CNetContext(opts.fUseTestNet ? TestNetParams() : MainNetParams(), AddressDb, opts.host ? opts.host : "", ""));
+  for (int i=0; i<opts.vZones.size(); i++) {
+    const CNetParams &params = *FindNetParams(opts.vZones[i].first);
+    printf("Also crawling %s net, for %s.\n", params.strName.c_str(), opts.vZones[i].second.c_str());
+    vNets.push_back(new CNetContext(params, *new CAddrDb(), opts.vZones[i].second, "-" + params.strName));
   }
   if (!opts.ns) {
     printf("No nameserver set. Not starting DNS server.\n");
@@ -594,45 +1246,128 @@ int main(int argc, char **argv) {
     fprintf(stderr, "No e-mail address set. Please use -m.\n");
     exit(1);
   }
-  FILE *f = fopen("dnsseed.dat","r");
-  if (f) {
-    printf("Loading dnsseed.dat...");
-    CAutoFile cf(f);
-    cf >> AddressDb;
-    if (opts.fWipeBan)
-        AddressDb.banned.clear();
-    if (opts.fWipeIgnore)
-        AddressDb.ResetIgnores();
-    printf("done\n");
-    signal(SIGINT, SIGINTHandler);  // Setup a signal handler to dump the database if we ctrl-c
+  setAnswerFlags = opts.filter_whitelist;
+  setAnswerFlags.insert(0);
+  if (opts.frontend) {
+    // DNS only: no database, no crawling
+    if (!fDNS) {
+      fprintf(stderr, "A frontend needs -h and -n.\n");
+      exit(1);
+    }
+    CGoodTableReader *pTable = new CGoodTableReader();
+    string strError;
+    while (!pTable->Open(opts.frontend, strError)) {
+      printf("Waiting for shared table %s: %s\n", opts.frontend, strError.c_str());
+      Sleep(5000);
+    }
+    printf("Serving DNS from shared table %s (updated %i s ago)\n", opts.frontend, (int)(time(NULL) - pTable->GetTime()));
+    pFrontendTable = pTable;
+    fDbReady = true;
+    StartDNS(opts);
+    do {
+      Sleep(10000);
+      // the crawler may have been restarted with a new table; the old mapping stays valid
+      // (DNS threads may still read it), so it is not unmapped
+      if (time(NULL) - pTable->GetTime() > 60) {
+        CGoodTableReader *pNew = new CGoodTableReader();
+        if (pNew->Open(opts.frontend, strError) && pNew->GetTime() > pTable->GetTime()) {
+          printf("Switching to a new shared table %s\n", opts.frontend);
+          pFrontendTable = pTable = pNew;
+        } else {
+          delete pNew;
+        }
+      }
+    } while(1);
   }
-  pthread_t threadDns, threadSeed, threadDump, threadStats;
-  if (fDNS) {
-    printf("Starting %i DNS threads for %s on %s (port %i)...", opts.nDnsThreads, opts.host, opts.ns, opts.nPort);
-    dnsThread.clear();
-    for (int i=0; i<opts.nDnsThreads; i++) {
-      dnsThread.push_back(new CDnsThread(&opts, i));
-      pthread_create(&threadDns, NULL, ThreadDNS, dnsThread[i]);
-      printf(".");
-      Sleep(20);
-    }
-    printf("done\n");
+  // With a good-set sidecar, DNS can answer while the database loads.
+  if (fDNS && !opts.fConvertDb && access("dnsseed.good", F_OK) == 0) {
+    string strError;
+    if (goodSet.Load("dnsseed.good", strError)) {
+      printf("Serving DNS from dnsseed.good (written %i s ago) until the database is loaded\n", (int)(time(NULL) - goodSet.GetTime()));
+      StartDNS(opts);
+    } else {
+      printf("Ignoring dnsseed.good: %s\n", strError.c_str());
+    }
   }
+  bool fLoaded = false;
+  for (int i=0; i<vNets.size(); i++)
+    fLoaded |= LoadNet(*vNets[i], opts);
+  if (opts.fConvertDb)
+    exit(0);
+  if (fLoaded)
+    signal(SIGINT, SIGINTHandler);  // Setup a signal handler to dump the database if we ctrl-c
+  pthread_t threadSeed, threadDump, threadStats, threadJournal, threadSweep;
+  fDbReady = true;
+  if (opts.fedListen || !opts.vFedPeers.empty()) {
+    if (!opts.vFedMembers.empty()) {
+      pPartition = new CCrawlPartition(opts.vFedMembers, opts.strFedName, opts.nFedSample);
+      AddressDb.SetPartition(pPartition);
+      printf("Crawling a share of the nodes as %s, one of %i cluster members (%i%% cross-checked)\n", opts.strFedName.c_str(), pPartition->GetMembers(), opts.nFedSample);
+    }
+    pFederation = new CFederation(AddressDb, opts.fedKey, opts.strFedName, pPartition);
+    if (opts.fedListen && !pFederation->Listen(opts.fedListen))
+      exit(1);
+    for (int i=0; i<opts.vFedPeers.size(); i++)
+      pFederation->Connect(opts.vFedPeers[i]);
+    printf("Federation: %s%s, %i peers to connect to\n", opts.fedListen ? "listening on " : "not listening",
+           opts.fedListen ? opts.fedListen : "", (int)opts.vFedPeers.size());
+  }
+  if (!dnsThread.empty())
+    LogStartup("database loaded, DNS switched to live data");
+  if (fDNS)
+    StartDNS(opts);
   printf("Starting seeder...");
   pthread_create(&threadSeed, NULL, ThreadSeeder, NULL);
   printf("done\n");
-  printf("Starting %i crawler threads...", opts.nThreads);
+  int nWarm = 0;
+  bool fJournal = false;
+  for (int i=0; i<vNets.size(); i++) {
+    nWarm += vNets[i]->db.BeginWarmStart();
+    fJournal |= vNets[i]->journal != NULL;
+  }
+  int nWarmThreads = nWarm ? (opts.nWarmThreads < 0 ? opts.nThreads : opts.nWarmThreads) : 0;
+  if (nWarm)
+    printf("Revalidating %i previously good nodes first...\n", nWarm);
+  int nCrawlMin = opts.nCrawlMin < 0 ? std::max(opts.nThreads / 8, 1) : std::min(opts.nCrawlMin, opts.nThreads);
+  pCrawlControl = new CCrawlControl(nCrawlMin, opts.nThreads);
+  printf("Starting %i crawler threads (%i for the warm start, at least %i probing)...", opts.nThreads + nWarmThreads, nWarmThreads, nCrawlMin);
   pthread_attr_t attr_crawler;
   pthread_attr_init(&attr_crawler);
   pthread_attr_setstacksize(&attr_crawler, 0x20000);
+  pthread_attr_setdetachstate(&attr_crawler, PTHREAD_CREATE_DETACHED);
   for (int i=0; i<opts.nThreads; i++) {
     pthread_t thread;
-    pthread_create(&thread, &attr_crawler, ThreadCrawler, &opts.nThreads);
+    pthread_create(&thread, &attr_crawler, ThreadCrawler, NULL);
+  }
+  for (int i=0; i<nWarmThreads; i++) {
+    pthread_t thread;
+    pthread_create(&thread, &attr_crawler, ThreadWarmCrawler, NULL);
   }
   pthread_attr_destroy(&attr_crawler);
   printf("done\n");
+  if (opts.nKeepAlive) {
+    printf("Keeping connections to up to %i good nodes per network%s\n", opts.nKeepAlive, opts.fHarvest ? ", harvesting their addr gossip" : "");
+    for (int i=0; i<vNets.size(); i++) {
+      vNets[i]->pKeepAlive = new CKeepAlive(vNets[i]->db, vNets[i]->params, opts.nKeepAlive, opts.fHarvest);
+      vNets[i]->pKeepAlive->Start();
+    }
+  }
   pthread_create(&threadStats, NULL, ThreadStats, NULL);
-  pthread_create(&threadDump, NULL, ThreadDumper, NULL);
+  if (fJournal)
+    pthread_create(&threadJournal, NULL, ThreadJournal, NULL);
+  pthread_create(&threadSweep, NULL, ThreadSweeper, NULL);
+  if (opts.shm) {
+    CGoodTableWriter *pWriter = new CGoodTableWriter();
+    string strError;
+    if (pWriter->Open(opts.shm, strError)) {
+      pthread_t threadShm;
+      pthread_create(&threadShm, NULL, ThreadShmPublisher, pWriter);
+      printf("Publishing good nodes in shared table %s\n", GetGoodTableName(opts.shm).c_str());
+    } else {
+      printf("Error: cannot open shared table %s: %s\n", opts.shm, strError.c_str());
+    }
+  }
+  pthread_create(&threadDump, NULL, ThreadDumper, &opts);
   void* res;
   pthread_join(threadDump, &res);
   return 0;
@@ -180,21 +180,27 @@ bool LookupNumeric(const char *pszName, CService& addr, int portDefault)
     return Lookup(pszName, addr, portDefault, false);
 }
 
+// A failed SOCKS negotiation: closes the socket, and leaves nErr in errno for the caller
+bool static SocksError(SOCKET& hSocket, int nErr, const char *pszError)
+{
+    closesocket(hSocket);
+    errno = nErr;
+    return error(pszError);
+}
+
 bool static Socks4(const CService &addrDest, SOCKET& hSocket)
 {
     printf("SOCKS4 connecting %s\n", addrDest.ToString().c_str());
     if (!addrDest.IsIPv4())
     {
-        closesocket(hSocket);
-        return error("Proxy destination is not IPv4");
+        return SocksError(hSocket, EAFNOSUPPORT, "Proxy destination is not IPv4");
     }
     char pszSocks4IP[] = "\4\1\0\0\0\0\0\0user";
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
     if (!addrDest.GetSockAddr((struct sockaddr*)&addr, &len) || addr.sin_family != AF_INET)
     {
-        closesocket(hSocket);
-        return error("Cannot get proxy destination address");
+        return SocksError(hSocket, EAFNOSUPPORT, "Cannot get proxy destination address");
     }
     memcpy(pszSocks4IP + 2, &addr.sin_port, 2);
     memcpy(pszSocks4IP + 4, &addr.sin_addr, 4);
@@ -204,21 +210,18 @@ bool static Socks4(const CService &addrDest, SOCKET& hSocket)
     int ret = send(hSocket, pszSocks4, nSize, MSG_NOSIGNAL);
     if (ret != nSize)
     {
-        closesocket(hSocket);
-        return error("Error sending to proxy");
+        return SocksError(hSocket, ECONNABORTED, "Error sending to proxy");
     }
     char pchRet[8];
     if (recv(hSocket, pchRet, 8, 0) != 8)
     {
-        closesocket(hSocket);
-        return error("Error reading proxy response");
+        return SocksError(hSocket, ECONNABORTED, "Error reading proxy response");
     }
     if (pchRet[1] != 0x5a)
     {
-        closesocket(hSocket);
         if (pchRet[1] != 0x5b)
             printf("ERROR: Proxy returned error %d\n", pchRet[1]);
-        return false;
+        return SocksError(hSocket, ECONNREFUSED, "Proxy rejected the request");
     }
     printf("SOCKS4 connected %s\n", addrDest.ToString().c_str());
     return true;
@@ -229,8 +232,7 @@ bool static Socks5(string strDest, int port, SOCKET& hSocket)
     printf("SOCKS5 connecting %s\n", strDest.c_str());
     if (strDest.size() > 255)
     {
-        closesocket(hSocket);
-        return error("Hostname too long");
+        return SocksError(hSocket, ENAMETOOLONG, "Hostname too long");
     }
     char pszSocks5Init[] = "\5\1\0";
     char *pszSocks5 = pszSocks5Init;
@@ -239,19 +241,16 @@ bool static Socks5(string strDest, int port, SOCKET& hSocket)
     ssize_t ret = send(hSocket, pszSocks5, nSize, MSG_NOSIGNAL);
     if (ret != nSize)
     {
-        closesocket(hSocket);
-        return error("Error sending to proxy");
+        return SocksError(hSocket, ECONNABORTED, "Error sending to proxy");
     }
     char pchRet1[2];
     if (recv(hSocket, pchRet1, 2, 0) != 2)
     {
-        closesocket(hSocket);
-        return error("Error reading proxy response");
+        return SocksError(hSocket, ECONNABORTED, "Error reading proxy response");
     }
     if (pchRet1[0] != 0x05 || pchRet1[1] != 0x00)
     {
-        closesocket(hSocket);
-        return error("Proxy failed to initialize");
+        return SocksError(hSocket, EPROTO, "Proxy failed to initialize");
     }
     string strSocks5("\5\1");
     strSocks5 += '\000'; strSocks5 += '\003';
@@ -262,40 +261,35 @@ bool static Socks5(string strDest, int port, SOCKET& hSocket)
     ret = send(hSocket, strSocks5.c_str(), strSocks5.size(), MSG_NOSIGNAL);
     if (ret != (ssize_t)strSocks5.size())
     {
-        closesocket(hSocket);
-        return error("Error sending to proxy");
+        return SocksError(hSocket, ECONNABORTED, "Error sending to proxy");
     }
     char pchRet2[4];
     if (recv(hSocket, pchRet2, 4, 0) != 4)
     {
-        closesocket(hSocket);
-        return error("Error reading proxy response");
+        return SocksError(hSocket, ECONNABORTED, "Error reading proxy response");
     }
     if (pchRet2[0] != 0x05)
     {
-        closesocket(hSocket);
-        return error("Proxy failed to accept request");
+        return SocksError(hSocket, EPROTO, "Proxy failed to accept request");
     }
     if (pchRet2[1] != 0x00)
     {
-        closesocket(hSocket);
         switch (pchRet2[1])
         {
-            case 0x01: return error("Proxy error: general failure");
-            case 0x02: return error("Proxy error: connection not allowed");
-            case 0x03: return error("Proxy error: network unreachable");
-            case 0x04: return error("Proxy error: host unreachable");
-            case 0x05: return error("Proxy error: connection refused");
-            case 0x06: return error("Proxy error: TTL expired");
-            case 0x07: return error("Proxy error: protocol error");
-            case 0x08: return error("Proxy error: address type not supported");
-            default:   return error("Proxy error: unknown");
+            case 0x01: return SocksError(hSocket, ECONNREFUSED, "Proxy error: general failure");
+            case 0x02: return SocksError(hSocket, EACCES, "Proxy error: connection not allowed");
+            case 0x03: return SocksError(hSocket, ENETUNREACH, "Proxy error: network unreachable");
+            case 0x04: return SocksError(hSocket, EHOSTUNREACH, "Proxy error: host unreachable");
+            case 0x05: return SocksError(hSocket, ECONNREFUSED, "Proxy error: connection refused");
+            case 0x06: return SocksError(hSocket, ETIMEDOUT, "Proxy error: TTL expired");
+            case 0x07: return SocksError(hSocket, EPROTO, "Proxy error: protocol error");
+            case 0x08: return SocksError(hSocket, EAFNOSUPPORT, "Proxy error: address type not supported");
+            default:   return SocksError(hSocket, EPROTO, "Proxy error: unknown");
         }
     }
     if (pchRet2[2] != 0x00)
     {
-        closesocket(hSocket);
-        return error("Error: malformed proxy response");
+        return SocksError(hSocket, EPROTO, "Error: malformed proxy response");
     }
     char pchRet3[256];
     switch (pchRet2[3])
@@ -306,22 +300,20 @@ bool static Socks5(string strDest, int port, SOCKET& hSocket)
         {
             ret = recv(hSocket, pchRet3, 1, 0) != 1;
             if (ret)
-                return error("Error reading from proxy");
+                return SocksError(hSocket, ECONNABORTED, "Error reading from proxy");
             int nRecv = pchRet3[0];
             ret = recv(hSocket, pchRet3, nRecv, 0) != nRecv;
             break;
         }
-        default: closesocket(hSocket); return error("Error: malformed proxy response");
+        default: return SocksError(hSocket, EPROTO, "Error: malformed proxy response");
     }
     if (ret)
     {
-        closesocket(hSocket);
-        return error("Error reading from proxy");
+        return SocksError(hSocket, ECONNABORTED, "Error reading from proxy");
     }
     if (recv(hSocket, pchRet3, 2, 0) != 2)
     {
-        closesocket(hSocket);
-        return error("Error reading from proxy");
+        return SocksError(hSocket, ECONNABORTED, "Error reading from proxy");
     }
     printf("SOCKS5 connected %s\n", strDest.c_str());
     return true;
@@ -335,6 +327,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
     socklen_t len = sizeof(sockaddr);
     if (!addrConnect.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
         printf("Cannot connect to %s: unsupported network\n", addrConnect.ToString().c_str());
+        errno = EAFNOSUPPORT;
         return false;
     }
 
@@ -375,12 +368,15 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
             {
                 printf("connection timeout\n");
                 closesocket(hSocket);
+                errno = ETIMEDOUT;
                 return false;
             }
             if (nRet == SOCKET_ERROR)
             {
-                printf("select() for connection failed: %i\n",WSAGetLastError());
+                int nErr = WSAGetLastError();
+                printf("select() for connection failed: %i\n",nErr);
                 closesocket(hSocket);
+                errno = nErr;
                 return false;
             }
             socklen_t nRetSize = sizeof(nRet);
@@ -390,14 +386,17 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
             if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
 #endif
             {
-                printf("getsockopt() for connection failed: %i\n",WSAGetLastError());
+                int nErr = WSAGetLastError();
+                printf("getsockopt() for connection failed: %i\n",nErr);
                 closesocket(hSocket);
+                errno = nErr;
                 return false;
             }
             if (nRet != 0)
             {
                 printf("connect() failed after select(): %s\n",strerror(nRet));
                 closesocket(hSocket);
+                errno = nRet;
                 return false;
             }
         }
@@ -407,8 +406,10 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         else
 #endif
         {
-            printf("connect() failed: %i\n",WSAGetLastError());
+            int nErr = WSAGetLastError();
+            printf("connect() failed: %i\n",nErr);
             closesocket(hSocket);
+            errno = nErr;
             return false;
         }
     }
@@ -496,6 +497,8 @@ bool ConnectSocket(const CService &addrDest, SOCKET& hSocketRet, int nTimeout)
             return false;
         break;
     default:
+        closesocket(hSocket);
+        errno = EINVAL;
         return false;
     }
 
@@ -524,7 +527,7 @@ bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest
     switch(nameproxyInfo.second)
     {
         default:
-        case 4: return false;
+        case 4: closesocket(hSocket); errno = EINVAL; return false;
         case 5:
             if (!Socks5(strDest, port, hSocket))
                 return false;
@@ -1142,6 +1145,56 @@ std::string CService::ToStringIPPort() const
     }
 }
 
+static size_t FormatDecimal(char *psz, unsigned int n)
+{
+    char buf[10];
+    size_t len = 0;
+    do {
+        buf[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    for (size_t i = 0; i < len; i++)
+        psz[i] = buf[len - 1 - i];
+    return len;
+}
+
+size_t CService::FormatIPPort(char *psz, size_t nSize) const
+{
+    char buf[80];
+    size_t len = 0;
+    if (IsTor() || IsI2P()) {
+        static const char *pbase32 = "abcdefghijklmnopqrstuvwxyz234567";
+        // 10 bytes are exactly 16 base32 characters, no padding
+        for (int i = 0; i < 16; i++) {
+            int nBit = i * 5;
+            int nByte = 6 + nBit / 8;
+            unsigned int v = ip[nByte] << 8 | (nByte + 1 < 16 ? ip[nByte + 1] : 0);
+            buf[len++] = pbase32[(v >> (11 - nBit % 8)) & 31];
+        }
+        const char *pszSuffix = IsTor() ? ".onion:" : ".oc.b32.i2p:";
+        memcpy(buf + len, pszSuffix, strlen(pszSuffix));
+        len += strlen(pszSuffix);
+    } else if (IsIPv4()) {
+        for (int i = 3; i >= 0; i--) {
+            len += FormatDecimal(buf + len, GetByte(i));
+            buf[len++] = i ? '.' : ':';
+        }
+    } else {
+        buf[len++] = '[';
+        if (!inet_ntop(AF_INET6, ip, buf + len, sizeof(buf) - len))
+            return 0;
+        len += strlen(buf + len);
+        buf[len++] = ']';
+        buf[len++] = ':';
+    }
+    len += FormatDecimal(buf + len, port);
+    if (len >= nSize)
+        return 0;
+    memcpy(psz, buf, len);
+    psz[len] = 0;
+    return len;
+}
+
 std::string CService::ToString() const
 {
     return ToStringIPPort();
@@ -0,0 +1,100 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <string.h>
+
+#include "netparams.h"
+
+using namespace std;
+
+static const char *mainnet_seeds[] =
+    {
+      "node01.veil-project.com",
+      "node02.veil-project.com",
+      "node03.veil-project.com",
+      "node04.veil-project.com",
+      "node05.veil-project.com",
+      "node06.veil-project.com",
+      "node07.veil-project.com",
+      "node08.veil-project.com",
+      "veilseed.veil-stats.com",
+      "seed.veil.rune.network",
+      "veil-seed.pontificatingnobody.com",
+      "116.203.43.112",
+      "159.69.20.168",
+      "94.130.180.117",
+      "94.130.185.98",
+      "195.201.24.97",
+      "116.203.40.38",
+      "195.201.24.15",
+      "195.201.24.37",
+      "127.0.0.1",
+      "::1",
+      NULL
+    };
+static const char *testnet_seeds[] =
+    {
+      "veilseedtestnet.veil-stats.com",
+      "veilseedtest.codeofalltrades.com",
+      "seedtest.veil.rune.network",
+      "veil-seed.test.pontificatingnobody.com",
+      "159.69.223.84",
+      "95.201.21.157",
+      "104.40.2.126",
+      "95.216.169.35",
+      "116.203.45.190",
+      "[2a01:4f8:1c1c:b3b2::1]",
+      "127.0.0.1",
+      "::1",
+      NULL
+    };
+
+static CNetParams MakeNetParams(const char *pszName, const unsigned char *pchMessageStart, unsigned short nPort,
+                                int nRequireVersion, int nRequireHeight, const char **ppszSeeds) {
+  CNetParams params;
+  params.strName = pszName;
+  memcpy(params.pchMessageStart, pchMessageStart, MESSAGE_START_SIZE);
+  params.nDefaultPort = nPort;
+  params.nRequireVersion = nRequireVersion;
+  params.nRequireHeight = nRequireHeight;
+  for (int i = 0; ppszSeeds[i]; i++)
+    params.vSeeds.push_back(ppszSeeds[i]);
+  return params;
+}
+
+const CNetParams &MainNetParams() {
+  static const unsigned char pchMessageStart[MESSAGE_START_SIZE] = { 0xb6, 0xcf, 0xd0, 0xa3 };
+  static const CNetParams params = MakeNetParams("main", pchMessageStart, 58810, 70027, 450000, mainnet_seeds);
+  return params;
+}
+
+const CNetParams &TestNetParams() {
+  static const unsigned char pchMessageStart[MESSAGE_START_SIZE] = { 0xa8, 0xd1, 0xa7, 0xc4 };
+  static const CNetParams params = MakeNetParams("test", pchMessageStart, 58811, 70025, 0, testnet_seeds);
+  return params;
+}
+
+const CNetParams *FindNetParams(const string &strName) {
+  if (strName == "main") return &MainNetParams();
+  if (strName == "test") return &TestNetParams();
+  return NULL;
+}
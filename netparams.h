@@ -0,0 +1,49 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _NETPARAMS_H_
+#define _NETPARAMS_H_ 1
+
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+
+// Everything that differs between the networks a seeder can crawl. One process may crawl
+// several of them, each with its own database and DNS zone (see --zone).
+class CNetParams {
+public:
+  std::string strName;        // main, test
+  unsigned char pchMessageStart[MESSAGE_START_SIZE];
+  unsigned short nDefaultPort; // only nodes on it are good
+  int nRequireVersion;        // nor those with an older protocol version
+  int nRequireHeight;         // nor those further behind
+  std::vector<std::string> vSeeds; // host names and addresses to bootstrap from
+};
+
+const CNetParams &MainNetParams();
+const CNetParams &TestNetParams();
+
+// look up a network by name, NULL if there is none
+const CNetParams *FindNetParams(const std::string &strName);
+
+#endif
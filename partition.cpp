@@ -0,0 +1,94 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <assert.h>
+
+#include <algorithm>
+
+#include "partition.h"
+
+using namespace std;
+
+// FNV-1a with a final mix, so that nearby addresses land far apart on the ring
+static uint64_t PartitionHash(const unsigned char *p, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+CCrawlPartition::CCrawlPartition(const vector<string> &vMembersIn, const string &strSelf, int nSamplePercentIn) : vMembers(vMembersIn), nSamplePercent(nSamplePercentIn) {
+  sort(vMembers.begin(), vMembers.end());
+  vMembers.erase(unique(vMembers.begin(), vMembers.end()), vMembers.end());
+  nSelf = GetMember(strSelf);
+  assert(nSelf >= 0 && vMembers.size() <= PARTITION_MAX_MEMBERS);
+  for (int i = 0; i < PARTITION_MAX_MEMBERS; i++) {
+    nSessions[i] = 0;
+    nAgree[i] = 0;
+    nDisagree[i] = 0;
+  }
+  for (int i = 0; i < vMembers.size(); i++) {
+    for (int j = 0; j < PARTITION_VNODES; j++) {
+      string strPoint = strprintf("%s#%i", vMembers[i].c_str(), j);
+      vRing.push_back(make_pair(PartitionHash((const unsigned char*)strPoint.data(), strPoint.size()), i));
+    }
+  }
+  sort(vRing.begin(), vRing.end());
+}
+
+uint64_t CCrawlPartition::Hash(const CService &addr) {
+  unsigned char buf[18];
+  struct in6_addr addr6;
+  addr.GetIn6Addr(&addr6);
+  memcpy(buf, addr6.s6_addr, 16);
+  buf[16] = addr.GetPort() >> 8;
+  buf[17] = addr.GetPort() & 0xff;
+  return PartitionHash(buf, sizeof(buf));
+}
+
+int CCrawlPartition::GetMember(const string &strName) const {
+  vector<string>::const_iterator it = lower_bound(vMembers.begin(), vMembers.end(), strName);
+  return it != vMembers.end() && *it == strName ? it - vMembers.begin() : -1;
+}
+
+int CCrawlPartition::GetAlive() const {
+  int n = 0;
+  for (int i = 0; i < vMembers.size(); i++)
+    n += IsAlive(i);
+  return n;
+}
+
+int CCrawlPartition::GetOwner(const CService &addr) const {
+  size_t nPos = lower_bound(vRing.begin(), vRing.end(), make_pair(Hash(addr), 0)) - vRing.begin();
+  for (size_t i = 0; i < vRing.size(); i++) {
+    int nMember = vRing[(nPos + i) % vRing.size()].second;
+    if (IsAlive(nMember)) return nMember;
+  }
+  return nSelf;
+}
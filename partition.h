@@ -0,0 +1,86 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _PARTITION_H_
+#define _PARTITION_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "netbase.h"
+#include "util.h"
+
+#define PARTITION_MAX_MEMBERS 64
+#define PARTITION_VNODES 64    // points per member on the hash ring
+#define PARTITION_GRACE 1800   // seconds the owner of a node gets to report on it before we probe it ourselves
+
+// Division of crawling among the members of a seeder cluster (see --fedmembers).
+//
+// Addresses are mapped onto a consistent-hash ring with PARTITION_VNODES points per
+// member; an address belongs to the first member clockwise from it that is alive (we
+// ourselves, or a member we have a federation session with). When a member goes
+// silent its arcs fall to the next points on the ring, which are spread over all the
+// others, and return to it when it is back. A sample of the addresses (nSamplePercent)
+// is probed by every member, to cross-validate their results.
+//
+// The hashes are fixed (unlike the hash map seeds in addrkey.h), so that all members
+// agree on them.
+class CCrawlPartition {
+private:
+  std::vector<std::string> vMembers;
+  int nSelf;                                // our index in vMembers
+  int nSamplePercent;
+  std::vector<std::pair<uint64_t, int> > vRing; // points and their members, sorted
+  std::atomic<int> nSessions[PARTITION_MAX_MEMBERS]; // live federation sessions per member
+  std::atomic<int64> nAgree[PARTITION_MAX_MEMBERS];    // sample outcomes of each member that agreed with ours
+  std::atomic<int64> nDisagree[PARTITION_MAX_MEMBERS]; // and that did not
+
+public:
+  // vMembersIn must include strSelf and have at most PARTITION_MAX_MEMBERS entries
+  CCrawlPartition(const std::vector<std::string> &vMembersIn, const std::string &strSelf, int nSamplePercentIn);
+
+  static uint64_t Hash(const CService &addr);
+
+  int GetSelf() const { return nSelf; }
+  int GetMembers() const { return vMembers.size(); }
+  const std::string &GetName(int nMember) const { return vMembers[nMember]; }
+  int GetMember(const std::string &strName) const; // -1 if not a member
+  bool IsAlive(int nMember) const { return nMember == nSelf || nSessions[nMember] > 0; }
+  int GetAlive() const;
+
+  // a federation session with a member started or ended
+  void AddSession(int nMember, int nDelta) { nSessions[nMember] += nDelta; }
+
+  bool IsSample(const CService &addr) const { return Hash(addr) % 100 < nSamplePercent; }
+  int GetOwner(const CService &addr) const; // alive member responsible for probing addr
+  bool IsMine(const CService &addr) const { return IsSample(addr) || GetOwner(addr) == nSelf; }
+
+  // a member's outcome for a sample address, compared to ours
+  void NoteCrossCheck(int nMember, bool fAgree) { (fAgree ? nAgree : nDisagree)[nMember]++; }
+  int64 GetAgree(int nMember) const { return nAgree[nMember]; }
+  int64 GetDisagree(int nMember) const { return nDisagree[nMember]; }
+};
+
+#endif
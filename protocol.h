@@ -33,32 +33,23 @@
 #include <string>
 #include "uint256.h"
 
-static const int MAINNET_DEFAULT_PORT = 58810;
-static const int TESTNET_DEFAULT_PORT = 58811;
-
-extern bool fMainNet;
-static inline unsigned short GetDefaultPort(const bool mainnet = fMainNet)
-{
-    return mainnet ? MAINNET_DEFAULT_PORT : TESTNET_DEFAULT_PORT;
-}
-
 //
 // Message header
-//  (4) message start
+//  (4) message start (see CNetParams)
 //  (12) command
 //  (4) size
 //  (4) checksum
 
-extern unsigned char pchMessageStart[4];
+static const int MESSAGE_START_SIZE = 4;
 
 class CMessageHeader
 {
     public:
         CMessageHeader();
-        CMessageHeader(const char* pszCommand, unsigned int nMessageSizeIn);
+        CMessageHeader(const unsigned char* pchMessageStartIn, const char* pszCommand, unsigned int nMessageSizeIn);
 
         std::string GetCommand() const;
-        bool IsValid() const;
+        bool IsValid(const unsigned char* pchMessageStartIn) const;
 
         IMPLEMENT_SERIALIZE
             (
@@ -72,7 +63,7 @@ class CMessageHeader
     // TODO: make private (improves encapsulation)
     public:
         enum { COMMAND_SIZE=12 };
-        char pchMessageStart[sizeof(::pchMessageStart)];
+        char pchMessageStart[MESSAGE_START_SIZE];
         char pchCommand[COMMAND_SIZE];
         unsigned int nMessageSize;
         unsigned int nChecksum;
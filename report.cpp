@@ -0,0 +1,330 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "db.h"
+#include "report.h"
+
+using namespace std;
+
+// Buffered output with allocation-free formatting of the few field types reports need.
+class CReportBuffer {
+private:
+  FILE *file;
+  size_t nPos;
+  char buf[65536];
+
+public:
+  CReportBuffer(FILE *fileIn) : file(fileIn), nPos(0) {}
+  ~CReportBuffer() { Flush(); }
+
+  void Flush() {
+    if (nPos) fwrite(buf, 1, nPos, file);
+    nPos = 0;
+  }
+
+  void Write(const char *p, size_t n) {
+    if (nPos + n > sizeof(buf)) Flush();
+    if (n > sizeof(buf)) {
+      fwrite(p, 1, n, file);
+      return;
+    }
+    memcpy(buf + nPos, p, n);
+    nPos += n;
+  }
+
+  void Str(const char *psz) { Write(psz, strlen(psz)); }
+
+  void Char(char c, int nCount = 1) {
+    while (nCount-- > 0) {
+      if (nPos == sizeof(buf)) Flush();
+      buf[nPos++] = c;
+    }
+  }
+
+  // like printf("%*lld") (right-aligned) or printf("%-*lld") (nWidth < 0)
+  void Int(int64 n, int nWidth = 0) {
+    char tmp[24];
+    size_t len = 0;
+    uint64 u = n < 0 ? -(uint64)n : n;
+    do {
+      tmp[sizeof(tmp) - 1 - len++] = '0' + u % 10;
+      u /= 10;
+    } while (u);
+    if (n < 0) tmp[sizeof(tmp) - 1 - len++] = '-';
+    Field(tmp + sizeof(tmp) - len, len, nWidth);
+  }
+
+  // like printf("%0*llx")
+  void Hex(uint64 n, int nDigits) {
+    static const char *pszHex = "0123456789abcdef";
+    char tmp[16];
+    size_t len = 0;
+    do {
+      tmp[sizeof(tmp) - 1 - len++] = pszHex[n & 15];
+      n >>= 4;
+    } while (n);
+    Char('0', nDigits - (int)len);
+    Write(tmp + sizeof(tmp) - len, len);
+  }
+
+  // like printf("%*.2f")
+  void Fixed2(double d, int nWidth) {
+    char tmp[32];
+    int64 n = (int64)(d * 100 + (d < 0 ? -0.5 : 0.5));
+    bool fNeg = n < 0;
+    uint64 u = fNeg ? -(uint64)n : n;
+    size_t len = 0;
+    tmp[sizeof(tmp) - 1 - len++] = '0' + u % 10;
+    tmp[sizeof(tmp) - 1 - len++] = '0' + (u / 10) % 10;
+    tmp[sizeof(tmp) - 1 - len++] = '.';
+    u /= 100;
+    do {
+      tmp[sizeof(tmp) - 1 - len++] = '0' + u % 10;
+      u /= 10;
+    } while (u);
+    if (fNeg) tmp[sizeof(tmp) - 1 - len++] = '-';
+    Field(tmp + sizeof(tmp) - len, len, nWidth);
+  }
+
+  // p padded to |nWidth|, right-aligned if nWidth > 0, left-aligned if nWidth < 0
+  void Field(const char *p, size_t len, int nWidth) {
+    if (nWidth > 0) Char(' ', nWidth - (int)len);
+    Write(p, len);
+    if (nWidth < 0) Char(' ', -nWidth - (int)len);
+  }
+
+  // a string inside double quotes, escaped for CSV ("" for ") or JSON
+  void Quoted(const string &str, bool fJSON) {
+    Char('"');
+    for (size_t i = 0; i < str.size(); i++) {
+      unsigned char c = str[i];
+      if (c == '"') {
+        Str(fJSON ? "\\\"" : "\"\"");
+      } else if (fJSON && c == '\\') {
+        Str("\\\\");
+      } else if (fJSON && c < 0x20) {
+        Str("\\u00");
+        Hex(c, 2);
+      } else {
+        Char(c);
+      }
+    }
+    Char('"');
+  }
+};
+
+struct CReportEntry {
+  double uptime1W;
+  double uptime1M;
+  int clientVersion;
+  const CAddrInfo *info;
+};
+
+// best nodes first: by 30-day uptime, then 7-day uptime, then client version
+static bool StatCompare(const CReportEntry& a, const CReportEntry& b) {
+  if (a.uptime1M == b.uptime1M) {
+    if (a.uptime1W == b.uptime1W) {
+      return a.clientVersion > b.clientVersion;
+    } else {
+      return a.uptime1W > b.uptime1W;
+    }
+  } else {
+    return a.uptime1M > b.uptime1M;
+  }
+}
+
+// a round trip time in whole ms, or pszUnknown if not measured
+static void WriteRtt(CReportBuffer &out, float ms, const char *pszUnknown, int nWidth = 0) {
+  if (ms < 0)
+    out.Field(pszUnknown, strlen(pszUnknown), nWidth);
+  else
+    out.Int((int64)(ms + 0.5), nWidth);
+}
+
+static void WriteTextRow(CReportBuffer &out, const CAddrReport &rep, const char *pszAddr, size_t nAddrLen) {
+  out.Field(pszAddr, nAddrLen, -47);
+  out.Char(' ', 2);
+  out.Int(rep.fGood, 4);
+  out.Char(' ', 2);
+  out.Int(rep.lastSuccess, 11);
+  out.Char(' ', 2);
+  for (int i = 0; i < 5; i++) {
+    out.Fixed2(100.0 * rep.uptime[i], 6);
+    out.Str(i < 4 ? "% " : "%  ");
+  }
+  out.Int(rep.blocks, 6);
+  out.Char(' ', 2);
+  out.Hex(rep.services, 8);
+  out.Char(' ', 2);
+  out.Int(rep.clientVersion, 5);
+  out.Char(' ');
+  out.Char('"');
+  out.Str(GetSubVersion(rep.clientSubVersion).c_str());
+  out.Char('"');
+  // appended after the columns existing parsers know
+  const float rtt[4] = {rep.rtt.connect, rep.rtt.handshake, rep.rtt.ping, rep.rtt.jitter};
+  for (int i = 0; i < 4; i++) {
+    out.Char(' ');
+    WriteRtt(out, rtt[i], "-", 5);
+  }
+  out.Char('\n');
+}
+
+static void WriteCSVRow(CReportBuffer &out, const CAddrReport &rep, const char *pszAddr, size_t nAddrLen) {
+  out.Write(pszAddr, nAddrLen);
+  out.Char(',');
+  out.Int(rep.fGood);
+  out.Char(',');
+  out.Int(rep.lastSuccess);
+  for (int i = 0; i < 5; i++) {
+    out.Char(',');
+    out.Fixed2(100.0 * rep.uptime[i], 0);
+  }
+  out.Char(',');
+  out.Int(rep.blocks);
+  out.Char(',');
+  out.Hex(rep.services, 8);
+  out.Char(',');
+  out.Int(rep.clientVersion);
+  out.Char(',');
+  out.Quoted(GetSubVersion(rep.clientSubVersion), false);
+  const float rtt[4] = {rep.rtt.connect, rep.rtt.handshake, rep.rtt.ping, rep.rtt.jitter};
+  for (int i = 0; i < 4; i++) {
+    out.Char(',');
+    WriteRtt(out, rtt[i], "");
+  }
+  out.Char('\n');
+}
+
+static void WriteJSONRow(CReportBuffer &out, const CAddrReport &rep, const char *pszAddr, size_t nAddrLen) {
+  out.Str("{\"address\":\"");
+  out.Write(pszAddr, nAddrLen);
+  out.Str(rep.fGood ? "\",\"good\":true" : "\",\"good\":false");
+  out.Str(",\"lastSuccess\":");
+  out.Int(rep.lastSuccess);
+  out.Str(",\"uptime\":[");
+  for (int i = 0; i < 5; i++) {
+    if (i) out.Char(',');
+    out.Fixed2(100.0 * rep.uptime[i], 0);
+  }
+  out.Str("],\"blocks\":");
+  out.Int(rep.blocks);
+  out.Str(",\"services\":");
+  out.Int(rep.services);
+  out.Str(",\"version\":");
+  out.Int(rep.clientVersion);
+  out.Str(",\"subversion\":");
+  out.Quoted(GetSubVersion(rep.clientSubVersion), true);
+  static const char *pszRtt[4] = {",\"rttConnect\":", ",\"rttHandshake\":", ",\"rttPing\":", ",\"rttJitter\":"};
+  const float rtt[4] = {rep.rtt.connect, rep.rtt.handshake, rep.rtt.ping, rep.rtt.jitter};
+  for (int i = 0; i < 4; i++) {
+    out.Str(pszRtt[i]);
+    WriteRtt(out, rtt[i], "null");
+  }
+  out.Str("}\n");
+}
+
+int ParseReportFormats(const char *psz) {
+  int nFormats = 0;
+  while (*psz) {
+    const char *pszEnd = strchr(psz, ',');
+    size_t len = pszEnd ? pszEnd - psz : strlen(psz);
+    if (len == 4 && !strncmp(psz, "text", len)) nFormats |= REPORT_TEXT;
+    else if (len == 3 && !strncmp(psz, "csv", len)) nFormats |= REPORT_CSV;
+    else if (len == 4 && !strncmp(psz, "json", len)) nFormats |= REPORT_JSON;
+    else return 0;
+    psz += len;
+    if (*psz == ',') psz++;
+  }
+  return nFormats;
+}
+
+static const struct {
+  int nFormat;
+  const char *pszExt;
+  const char *pszHeader;
+} reportFiles[] = {
+  {REPORT_TEXT, ".dump", "# address                                        good  lastSuccess    %(2h)   %(8h)   %(1d)   %(7d)  %(30d)  blocks      svcs  version  conn  hshk  ping  jitr\n"},
+  {REPORT_CSV, ".csv", "address,good,lastSuccess,uptime2h,uptime8h,uptime1d,uptime7d,uptime30d,blocks,services,version,subversion,rttconnect,rtthandshake,rttping,rttjitter\n"},
+  {REPORT_JSON, ".jsonl", ""},
+};
+
+void WriteReports(const CAddrDb &db, const string &strBase, int nFormats, int nTop, CReportResult &result) {
+  struct timespec tsStart, tsEnd;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tsStart);
+
+  // collect sort keys only; rows are formatted straight from the database afterwards
+  vector<CReportEntry> vEntry;
+  memset(result.stat, 0, sizeof(result.stat));
+  CAddrReport rep;
+  CAddrReportCursor cursor(db);
+  const CAddrInfo *info;
+  while ((info = cursor.Next()) != NULL) {
+    info->GetReport(db.GetNetParams(), rep);
+    CReportEntry entry = {rep.uptime[3], rep.uptime[4], rep.clientVersion, info};
+    vEntry.push_back(entry);
+    for (int i = 0; i < 5; i++)
+      result.stat[i] += rep.uptime[i];
+  }
+  result.nNodes = vEntry.size();
+  size_t nRows = vEntry.size();
+  if (nTop > 0 && nTop < nRows) {
+    nRows = nTop;
+    partial_sort(vEntry.begin(), vEntry.begin() + nRows, vEntry.end(), StatCompare);
+  } else {
+    sort(vEntry.begin(), vEntry.end(), StatCompare);
+  }
+  result.nRows = nRows;
+
+  for (int f = 0; f < sizeof(reportFiles) / sizeof(reportFiles[0]); f++) {
+    if (!(nFormats & reportFiles[f].nFormat)) continue;
+    string strFile = strBase + reportFiles[f].pszExt;
+    string strTmp = strFile + ".new";
+    FILE *file = fopen(strTmp.c_str(), "w");
+    if (!file) continue;
+    {
+      CReportBuffer out(file);
+      out.Str(reportFiles[f].pszHeader);
+      char pszAddr[80];
+      for (size_t i = 0; i < nRows; i++) {
+        vEntry[i].info->GetReport(db.GetNetParams(), rep);
+        size_t nAddrLen = rep.ip.FormatIPPort(pszAddr, sizeof(pszAddr));
+        switch (reportFiles[f].nFormat) {
+          case REPORT_TEXT: WriteTextRow(out, rep, pszAddr, nAddrLen); break;
+          case REPORT_CSV: WriteCSVRow(out, rep, pszAddr, nAddrLen); break;
+          case REPORT_JSON: WriteJSONRow(out, rep, pszAddr, nAddrLen); break;
+        }
+      }
+    }
+    fclose(file);
+    rename(strTmp.c_str(), strFile.c_str());
+  }
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tsEnd);
+  result.nCpuMicros = (int64)(tsEnd.tv_sec - tsStart.tv_sec) * 1000000 + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1000;
+}
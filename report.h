@@ -0,0 +1,53 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _REPORT_H_
+#define _REPORT_H_ 1
+
+#include "util.h"
+
+class CAddrDb;
+
+// report formats
+enum {
+  REPORT_TEXT = 1, // dnsseed.dump, the traditional format (also read by combine.pl)
+  REPORT_CSV = 2,  // dnsseed.csv
+  REPORT_JSON = 4, // dnsseed.jsonl, one JSON object per node
+};
+
+struct CReportResult {
+  int nNodes;        // nodes that went into the reports
+  int nRows;         // rows written per format (nNodes, or fewer with a top-K limit)
+  double stat[5];    // summed uptimes of all nodes (for dnsstats.log)
+  int64 nCpuMicros;  // CPU time spent generating the reports
+};
+
+// Parse a comma-separated list of format names (text,csv,json); returns 0 if invalid.
+int ParseReportFormats(const char *psz);
+
+// Stream reports of a frozen copy of the database (see CAddrDb::ForkSnapshot) to the
+// files of the selected formats. Nodes are ordered by StatCompare; with nTop > 0 only
+// the best nTop are written, which only needs a partial sort. The files are named after
+// strBase (dnsseed.dump and so on for "dnsseed").
+void WriteReports(const CAddrDb &db, const std::string &strBase, int nFormats, int nTop, CReportResult &result);
+
+#endif
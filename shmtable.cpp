@@ -0,0 +1,190 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "shmtable.h"
+
+using namespace std;
+
+#define GOODTABLE_READ_TRIES 0x100000 // attempts to get a consistent copy (about a second, if the writer died while updating)
+
+static CGoodTableBucket *GetBuckets(CGoodTableHeader *pHeader) {
+  return (CGoodTableBucket*)(pHeader + 1);
+}
+
+static addr_t *GetAddrs(CGoodTableHeader *pHeader, int nBucket) {
+  return (addr_t*)(GetBuckets(pHeader) + GOODTABLE_MAX_BUCKETS) + nBucket * GOODTABLE_BUCKET_ADDRS;
+}
+
+string GetGoodTableName(const string &strName) {
+  return strName.empty() || strName[0] != '/' ? "/" + strName : strName;
+}
+
+CGoodTableWriter::~CGoodTableWriter() {
+  if (pHeader)
+    munmap(pHeader, GOODTABLE_SIZE);
+}
+
+bool CGoodTableWriter::Open(const string &strName, string &strError) {
+  string strPath = GetGoodTableName(strName);
+  int fd = shm_open(strPath.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0 && errno == EEXIST) {
+    // ours from an earlier run (readers that still map it carry on), but never a table
+    // someone else created or could write to
+    fd = shm_open(strPath.c_str(), O_RDWR, 0);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) != 0) {
+      strError = strerror(errno);
+      close(fd);
+      return false;
+    }
+    if (fd >= 0 && (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))) {
+      strError = "exists, but is not owned by this user or is writable by others";
+      close(fd);
+      return false;
+    }
+    if (fd >= 0 && st.st_size != 0 && st.st_size != GOODTABLE_SIZE) {
+      // left by an incompatible version; readers that still map it see it go stale
+      close(fd);
+      shm_unlink(strPath.c_str());
+      fd = shm_open(strPath.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+  }
+  if (fd < 0 || ftruncate(fd, GOODTABLE_SIZE) != 0) {
+    strError = strerror(errno);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  void *p = mmap(NULL, GOODTABLE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    strError = strerror(errno);
+    return false;
+  }
+  pHeader = (CGoodTableHeader*)p;
+  if (memcmp(pHeader->magic, GOODTABLE_MAGIC, sizeof(GOODTABLE_MAGIC)) != 0 || pHeader->nVersion != GOODTABLE_VERSION ||
+      pHeader->nAddrSize != sizeof(addr_t)) {
+    pHeader->nVersion = GOODTABLE_VERSION;
+    pHeader->nSize = GOODTABLE_SIZE;
+    pHeader->nAddrSize = sizeof(addr_t);
+    pHeader->nBuckets = 0;
+    memcpy(pHeader->magic, GOODTABLE_MAGIC, sizeof(GOODTABLE_MAGIC));
+  }
+  return true;
+}
+
+void CGoodTableWriter::Publish(const map<pair<uint64_t, int>, vector<addr_t> > &mapBuckets, int64_t nTime) {
+  if (!pHeader) return;
+  // an odd nSeq left by a writer that died while updating stays odd until we are done
+  uint32_t nSeq = pHeader->nSeq.load(std::memory_order_relaxed) | 1;
+  pHeader->nSeq.store(nSeq, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  CGoodTableBucket *pBuckets = GetBuckets(pHeader);
+  int nBucket = 0;
+  for (map<pair<uint64_t, int>, vector<addr_t> >::const_iterator it = mapBuckets.begin(); it != mapBuckets.end() && nBucket < GOODTABLE_MAX_BUCKETS; it++, nBucket++) {
+    const vector<addr_t> &vAddr = (*it).second;
+    CGoodTableBucket &bucket = pBuckets[nBucket];
+    bucket.nFlags = (*it).first.first;
+    bucket.nNet = (*it).first.second;
+    bucket.nAddrs = min(vAddr.size(), (size_t)GOODTABLE_BUCKET_ADDRS);
+    if (bucket.nAddrs)
+      memcpy(GetAddrs(pHeader, nBucket), &vAddr[0], bucket.nAddrs * sizeof(addr_t));
+  }
+  pHeader->nBuckets = nBucket;
+  __atomic_store_n(&pHeader->nTime, nTime, __ATOMIC_RELEASE);
+  __atomic_store_n(&pHeader->nGeneration, pHeader->nGeneration + 1, __ATOMIC_RELEASE);
+  pHeader->nSeq.store(nSeq + 1, std::memory_order_release);
+}
+
+CGoodTableReader::~CGoodTableReader() {
+  Close();
+}
+
+void CGoodTableReader::Close() {
+  if (pHeader)
+    munmap((void*)pHeader, GOODTABLE_SIZE);
+  pHeader = NULL;
+}
+
+bool CGoodTableReader::Open(const string &strName, string &strError) {
+  Close();
+  int fd = shm_open(GetGoodTableName(strName).c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    strError = strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != GOODTABLE_SIZE) {
+    strError = "unexpected size (incompatible version?)";
+    close(fd);
+    return false;
+  }
+  void *p = mmap(NULL, GOODTABLE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    strError = strerror(errno);
+    return false;
+  }
+  pHeader = (const CGoodTableHeader*)p;
+  if (memcmp(pHeader->magic, GOODTABLE_MAGIC, sizeof(GOODTABLE_MAGIC)) != 0 || pHeader->nVersion != GOODTABLE_VERSION ||
+      pHeader->nSize != GOODTABLE_SIZE || pHeader->nAddrSize != sizeof(addr_t)) {
+    strError = "not initialized, or incompatible version";
+    Close();
+    return false;
+  }
+  return true;
+}
+
+int CGoodTableReader::Read(uint64_t nFlags, int nNet, addr_t *pAddr, int nMax, uint64_t *pGeneration) const {
+  if (!pHeader) return -1;
+  CGoodTableHeader *pTable = const_cast<CGoodTableHeader*>(pHeader); // only read
+  for (int nTry = 0; nTry < GOODTABLE_READ_TRIES; nTry++) {
+    uint32_t nSeq = pTable->nSeq.load(std::memory_order_acquire);
+    if (nSeq & 1) continue;
+    int ret = -1;
+    uint32_t nBuckets = min(pTable->nBuckets, (uint32_t)GOODTABLE_MAX_BUCKETS);
+    const CGoodTableBucket *pBuckets = GetBuckets(pTable);
+    for (uint32_t i = 0; i < nBuckets; i++) {
+      if (pBuckets[i].nFlags == nFlags && pBuckets[i].nNet == nNet) {
+        ret = min(min(pBuckets[i].nAddrs, (uint32_t)GOODTABLE_BUCKET_ADDRS), (uint32_t)max(nMax, 0));
+        if (ret)
+          memcpy(pAddr, GetAddrs(pTable, i), ret * sizeof(addr_t));
+        break;
+      }
+    }
+    uint64_t nGeneration = pTable->nGeneration;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (pTable->nSeq.load(std::memory_order_relaxed) == nSeq) {
+      if (pGeneration) *pGeneration = nGeneration;
+      return ret;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,127 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _SHMTABLE_H_
+#define _SHMTABLE_H_ 1
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "addr.h"
+
+// Good-node table in POSIX shared memory, version 1
+//
+//   CGoodTableHeader
+//   CGoodTableBucket[GOODTABLE_MAX_BUCKETS]
+//   addr_t[GOODTABLE_MAX_BUCKETS][GOODTABLE_BUCKET_ADDRS]
+//
+// The crawler (see --shm) publishes a sample of its good nodes every few seconds, bucketed
+// like the DNS caches by service filter and network (4 or 6, as in addr_t::v), so that
+// other processes on the host - DNS frontends (see --frontend), local nodes - can read
+// fresh peers without talking to it. The layout is fixed, so a reader maps the segment
+// once and then reads it without any system calls.
+//
+// Consistency is a seqlock: the writer makes nSeq odd, updates the buckets and makes it
+// even again. A reader copies what it needs and retries if nSeq was odd or changed
+// meanwhile. There is a single writer; readers never write. The segment survives
+// restarts of the crawler (it is reused if compatible), and a reader can tell a
+// crawler that stopped publishing from the age of nTime.
+
+static const char GOODTABLE_MAGIC[4] = {'V', 'S', 'G', 'T'};
+static const uint32_t GOODTABLE_VERSION = 1;
+
+#define GOODTABLE_MAX_BUCKETS 64
+#define GOODTABLE_BUCKET_ADDRS 1000
+
+struct CGoodTableHeader {
+  char magic[4];
+  uint32_t nVersion;
+  uint32_t nSize;          // of the whole segment, as a sanity check
+  uint32_t nAddrSize;      // sizeof(addr_t)
+  std::atomic<uint32_t> nSeq; // odd while the writer is updating
+  uint32_t nBuckets;       // buckets in use
+  int64_t nTime;           // time of the last update
+  uint64_t nGeneration;    // number of updates so far
+  uint64_t reserved;
+};
+
+struct CGoodTableBucket {
+  uint64_t nFlags;         // requested service flags the addresses were sampled for
+  int32_t nNet;            // 4 or 6
+  uint32_t nAddrs;
+};
+
+static_assert(sizeof(CGoodTableHeader) == 48, "unexpected CGoodTableHeader size");
+static_assert(sizeof(CGoodTableBucket) == 16, "unexpected CGoodTableBucket size");
+
+static const size_t GOODTABLE_SIZE = sizeof(CGoodTableHeader) + GOODTABLE_MAX_BUCKETS * (sizeof(CGoodTableBucket) + GOODTABLE_BUCKET_ADDRS * sizeof(addr_t));
+
+// shared memory object names start with a slash
+std::string GetGoodTableName(const std::string &strName);
+
+// Publishes the table (in the crawler).
+class CGoodTableWriter {
+private:
+  CGoodTableHeader *pHeader;
+
+public:
+  CGoodTableWriter() : pHeader(NULL) {}
+  ~CGoodTableWriter();
+
+  // create the segment, or reuse it if it has the right layout
+  bool Open(const std::string &strName, std::string &strError);
+
+  // replace the contents: addresses per (service filter, network), at most
+  // GOODTABLE_MAX_BUCKETS buckets of GOODTABLE_BUCKET_ADDRS addresses each
+  void Publish(const std::map<std::pair<uint64_t, int>, std::vector<addr_t> > &mapBuckets, int64_t nTime);
+};
+
+// Reads the table (in DNS frontends and other consumers). Read() only touches memory.
+class CGoodTableReader {
+private:
+  const CGoodTableHeader *pHeader;
+
+public:
+  CGoodTableReader() : pHeader(NULL) {}
+  ~CGoodTableReader();
+
+  bool Open(const std::string &strName, std::string &strError);
+  void Close();
+  bool IsOpen() const { return pHeader != NULL; }
+
+  // Copy the addresses for a service filter and network (4 or 6) into pAddr[0..nMax).
+  // Returns their number, or -1 if the table has no such bucket. If pGeneration is
+  // given, it receives the generation the copy is from.
+  int Read(uint64_t nFlags, int nNet, addr_t *pAddr, int nMax, uint64_t *pGeneration = NULL) const;
+
+  // changes with every update, so readers can tell when to read again
+  uint64_t GetGeneration() const { return pHeader ? __atomic_load_n(&pHeader->nGeneration, __ATOMIC_ACQUIRE) : 0; }
+  // time of the last update (0 if not open)
+  int64_t GetTime() const { return pHeader ? __atomic_load_n(&pHeader->nTime, __ATOMIC_ACQUIRE) : 0; }
+};
+
+#endif
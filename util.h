@@ -25,6 +25,7 @@
 
 #include <pthread.h>
 #include <errno.h>
+#include <sys/time.h>
 #include <openssl/sha.h>
 #include <stdarg.h>
 
@@ -94,6 +95,18 @@ template<typename T1> inline uint256 Hash(const T1 pbegin, const T1 pend)
     return hash2;
 }
 
+int64 static inline GetTimeMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int64 static inline GetTimeMillis() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 void static inline Sleep(int nMilliSec) {
     struct timespec wa;
     wa.tv_sec = nMilliSec/1000;
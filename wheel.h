@@ -0,0 +1,248 @@
+// Copyright (c) 2009-2018 The Bitcoin Core developers
+// Copyright (c) 2009-2018 Bitcoin Developers
+// Copyright (c) 2019 The Veil Developers
+/*
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in
+** all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+** THE SOFTWARE.
+*/
+#ifndef _WHEEL_H_
+#define _WHEEL_H_ 1
+
+#include <stdint.h>
+
+#include <vector>
+
+// Hierarchical timing wheel: a set of values, each with a due time in seconds.
+//
+// Level 0 has one slot per second for the next 256 seconds, level 1 one slot per
+// 256 seconds for the next 2^16 seconds, and so on. Advance() moves the clock
+// forward; entries whose slot comes up are either due (and appended to the ready
+// list) or cascade into a slot of a finer level. Insert, Remove and PopReady are
+// O(1); Advance is O(1) amortized per second and per entry. The ready list is in
+// the order entries became due, so its head is the most overdue one.
+//
+// Entries are identified by handles (indices into a pool), which stay valid until
+// the entry is removed or popped.
+template<typename T>
+class CTimingWheel {
+private:
+  enum {
+    BITS = 8,
+    SLOTS = 1 << BITS,
+    LEVELS = 4,
+    READY = LEVELS * SLOTS, // index of the ready list in vList
+  };
+
+  struct CEntry {
+    T value;
+    int64_t nDue;
+    int nPrev, nNext; // neighbours in the list (-1 at the ends), nNext links the free list
+    int nList;        // list the entry is in, -1 if free
+  };
+
+  struct CList {
+    int nHead, nTail;
+    CList() : nHead(-1), nTail(-1) {}
+  };
+
+  std::vector<CEntry> vEntry;
+  std::vector<CList> vList;
+  int nLevelCount[LEVELS]; // entries per level
+  int nFree;               // head of the free list
+  int nSize;
+  int nReady;
+  int64_t nNow;            // all entries with nDue <= nNow are in the ready list
+
+  void Link(int h, int nList) {
+    CEntry &e = vEntry[h];
+    CList &l = vList[nList];
+    e.nList = nList;
+    e.nPrev = l.nTail;
+    e.nNext = -1;
+    if (l.nTail >= 0) vEntry[l.nTail].nNext = h; else l.nHead = h;
+    l.nTail = h;
+    if (nList == READY) nReady++; else nLevelCount[nList / SLOTS]++;
+  }
+
+  void Unlink(int h) {
+    CEntry &e = vEntry[h];
+    CList &l = vList[e.nList];
+    if (e.nPrev >= 0) vEntry[e.nPrev].nNext = e.nNext; else l.nHead = e.nNext;
+    if (e.nNext >= 0) vEntry[e.nNext].nPrev = e.nPrev; else l.nTail = e.nPrev;
+    if (e.nList == READY) nReady--; else nLevelCount[e.nList / SLOTS]--;
+    e.nList = -1;
+  }
+
+  // put an unlinked entry in the list matching its due time
+  void Place(int h) {
+    int64_t nDelta = vEntry[h].nDue - nNow;
+    if (nDelta <= 0) {
+      Link(h, READY);
+      return;
+    }
+    int64_t nDue = vEntry[h].nDue;
+    int nLevel = 0;
+    while (nLevel < LEVELS - 1 && nDelta >= ((int64_t)1 << (BITS * (nLevel + 1))))
+      nLevel++;
+    if (nDelta >= ((int64_t)1 << (BITS * LEVELS)))
+      nDue = nNow + ((int64_t)1 << (BITS * LEVELS)) - 1; // far future, revisited on cascade
+    Link(h, nLevel * SLOTS + ((nDue >> (BITS * nLevel)) & (SLOTS - 1)));
+  }
+
+  // re-place all entries of a slot (after the clock reached it)
+  template<typename F>
+  void Cascade(int nList, F &fDue) {
+    int h = vList[nList].nHead;
+    while (h >= 0) {
+      int nNext = vEntry[h].nNext;
+      Unlink(h);
+      Place(h);
+      if (vEntry[h].nList == READY) fDue(h);
+      h = nNext;
+    }
+  }
+
+  // list that comes after nList in due order (READY first, then each level from the
+  // slot after the current one), or -1
+  int NextList(int nList) const {
+    int nLevel, nStart;
+    if (nList == READY) {
+      nLevel = 0;
+      nStart = -1;
+    } else {
+      nLevel = nList / SLOTS;
+      nStart = nList % SLOTS;
+    }
+    for (; nLevel < LEVELS; nLevel++) {
+      int nCur = (nNow >> (BITS * nLevel)) & (SLOTS - 1);
+      int nPos = 1;
+      if (nStart >= 0) {
+        nPos = (nStart - nCur) & (SLOTS - 1);
+        nPos = (nPos ? nPos : SLOTS) + 1; // the current slot itself is the last one
+      }
+      if (nLevelCount[nLevel]) {
+        for (; nPos <= SLOTS; nPos++) {
+          int n = nLevel * SLOTS + ((nCur + nPos) & (SLOTS - 1));
+          if (vList[n].nHead >= 0) return n;
+        }
+      }
+      nStart = -1;
+    }
+    return -1;
+  }
+
+public:
+  CTimingWheel(int64_t nNowIn = 0) : vList(READY + 1), nFree(-1), nSize(0), nReady(0), nNow(nNowIn) {
+    for (int i = 0; i < LEVELS; i++) nLevelCount[i] = 0;
+  }
+
+  int size() const { return nSize; }
+  int GetReady() const { return nReady; }   // number of due entries
+  int64_t GetNow() const { return nNow; }
+  const T &Get(int h) const { return vEntry[h].value; }
+  int64_t GetDue(int h) const { return vEntry[h].nDue; }
+
+  // add a value due at nDue; returns its handle
+  int Insert(const T &value, int64_t nDue) {
+    int h;
+    if (nFree >= 0) {
+      h = nFree;
+      nFree = vEntry[h].nNext;
+    } else {
+      h = vEntry.size();
+      vEntry.push_back(CEntry());
+    }
+    vEntry[h].value = value;
+    vEntry[h].nDue = nDue;
+    Place(h);
+    nSize++;
+    return h;
+  }
+
+  void Remove(int h) {
+    Unlink(h);
+    vEntry[h].value = T();
+    vEntry[h].nNext = nFree;
+    nFree = h;
+    nSize--;
+  }
+
+  // move an entry to a new due time; returns its (unchanged) handle
+  int Reschedule(int h, int64_t nDue) {
+    Unlink(h);
+    vEntry[h].nDue = nDue;
+    Place(h);
+    return h;
+  }
+
+  // handle of the most overdue entry, or -1 if nothing is due
+  int GetFirstReady() const { return vList[READY].nHead; }
+
+  // remove the most overdue entry; only call if GetReady() > 0
+  T PopReady() {
+    int h = vList[READY].nHead;
+    T ret = vEntry[h].value;
+    Remove(h);
+    return ret;
+  }
+
+  // Move the clock forward to nTo. fDue(h) is called for each entry that becomes due.
+  template<typename F>
+  void Advance(int64_t nTo, F fDue) {
+    while (nNow < nTo) {
+      if (nSize == nReady) {
+        nNow = nTo;
+        break;
+      }
+      // skip ahead to the end of the current level 0 round if nothing is in it
+      if (nLevelCount[0] == 0) {
+        int64_t nSkip = nNow | (SLOTS - 1);
+        if (nSkip > nTo - 1) nSkip = nTo - 1;
+        if (nSkip > nNow) nNow = nSkip;
+      }
+      nNow++;
+      for (int nLevel = 1; nLevel < LEVELS; nLevel++) {
+        if (nNow & (((int64_t)1 << (BITS * nLevel)) - 1)) break;
+        Cascade(nLevel * SLOTS + ((nNow >> (BITS * nLevel)) & (SLOTS - 1)), fDue);
+      }
+      int nList = nNow & (SLOTS - 1);
+      int h = vList[nList].nHead;
+      while (h >= 0) {
+        int nNext = vEntry[h].nNext;
+        Unlink(h);
+        Link(h, READY);
+        fDue(h);
+        h = nNext;
+      }
+    }
+  }
+
+  // iteration over all entries, due ones first, then roughly in order of due time
+  int First() const {
+    if (vList[READY].nHead >= 0) return vList[READY].nHead;
+    int n = NextList(READY);
+    return n < 0 ? -1 : vList[n].nHead;
+  }
+  int Next(int h) const {
+    if (vEntry[h].nNext >= 0) return vEntry[h].nNext;
+    int n = NextList(vEntry[h].nList);
+    return n < 0 ? -1 : vList[n].nHead;
+  }
+};
+
+#endif